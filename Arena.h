@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+// Bump allocator. Allocation is a pointer increment inside the current
+// block; nothing is freed individually. reset() rewinds to the first block
+// and keeps every block, so once an arena has grown to the size of the
+// largest batch it is reused without touching malloc again.
+class Arena {
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    struct Block { std::unique_ptr<char[]> data; size_t size; };
+    std::vector<Block> blocks;
+    size_t current = 0; // block being filled
+    size_t used = 0;    // bytes used in it
+public:
+    Arena() = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    // align must be a power of two no larger than alignof(std::max_align_t),
+    // which is what new[] guarantees for the start of each block
+    void *allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        while (current < blocks.size()) {
+            size_t at = (used + align - 1) & ~(align - 1);
+            if (at + size <= blocks[current].size) { used = at + size; return blocks[current].data.get() + at; }
+            current++;
+            used = 0;
+        }
+        size_t n = size > BLOCK_SIZE ? size : BLOCK_SIZE;
+        blocks.push_back(Block{std::unique_ptr<char[]>(new char[n]), n});
+        current = blocks.size() - 1;
+        used = size;
+        return blocks[current].data.get();
+    }
+
+    // Everything allocated so far becomes invalid; the memory is kept
+    void reset() { current = 0; used = 0; }
+
+    size_t blockCount() const { return blocks.size(); }
+    size_t capacity() const {
+        size_t n = 0;
+        for (const Block &b : blocks) n += b.size;
+        return n;
+    }
+};
@@ -0,0 +1,325 @@
+#pragma once
+#include "DFA.h"
+#include "FlatNFA.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Compiled automaton file (written by recalc-compile). A header followed by
+// sections of plain arrays, each starting on an 8-byte boundary, holding
+// exactly what DFAView and PikeVM read: once mapped, matching runs on the
+// file's bytes with no parsing, copying or pointer fixups.
+//   DFA:     table int32[states * classes], byteClass u8[256], accept u8[states],
+//            patternIndex u32[states + 1] into patternIds u32[] (ids each state accepts)
+//   NFA:     NInst[insts], the FlatNFA instruction array
+//   sources: sourceIndex u32[patterns + 1] into sourceText, the pattern strings
+// Integers are in the writer's byte order; endianTag makes a file from a
+// machine of the other order fail validation instead of matching garbage.
+struct AutomatonFileHeader {
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t ENDIAN_TAG = 0x01020304;
+    enum Flags : uint32_t { HAS_DFA = 1, HAS_NFA = 2, UNANCHORED = 4, ALL_FLAGS = 7 };
+
+    char magic[8];      // "RECALCAU"
+    uint32_t version;
+    uint32_t endianTag;
+    uint64_t fileSize;
+    uint64_t checksum;  // FNV-1a of the whole file with this field zeroed
+    uint32_t flags;
+    uint32_t numPatterns;
+    uint32_t dfaStates, dfaClasses;
+    int32_t dfaStart;
+    uint32_t dfaPatternIds;
+    uint64_t dfaTableOff, dfaByteClassOff, dfaAcceptOff, dfaPatternIndexOff, dfaPatternIdsOff;
+    uint32_t nfaInsts;
+    int32_t nfaStart;
+    uint64_t nfaCodeOff;
+    uint64_t sourceIndexOff, sourceTextOff, sourceTextSize;
+};
+static_assert(sizeof(AutomatonFileHeader) == 136, "header layout is part of the file format");
+static_assert(std::is_trivially_copyable<AutomatonFileHeader>::value, "header is read in place");
+static_assert(sizeof(NInst) == 12 && offsetof(NInst, c) == 1 && offsetof(NInst, x) == 4 && offsetof(NInst, y) == 8,
+              "NInst layout is part of the file format");
+
+inline uint64_t fnv1a64(const unsigned char *p, size_t n, uint64_t h = 14695981039346656037ull) {
+    for (size_t i = 0; i < n; ++i) { h ^= p[i]; h *= 1099511628211ull; }
+    return h;
+}
+
+// Checksum of a file image, reading its checksum field as zero
+inline uint64_t automatonChecksum(const unsigned char *p, size_t n) {
+    const size_t at = offsetof(AutomatonFileHeader, checksum);
+    const unsigned char zero[8] = {};
+    uint64_t h = fnv1a64(p, at);
+    h = fnv1a64(zero, 8, h);
+    return fnv1a64(p + at + 8, n - at - 8, h);
+}
+
+// File image for patterns compiled into dfa and/or nfa (either may be null).
+// unanchored: the DFA was built in search mode (compileDFA's unanchored).
+inline std::string serializeAutomaton(const std::vector<std::string> &patterns, const DFA *dfa, const FlatNFA *nfa, bool unanchored) {
+    if (!dfa && !nfa) throw std::runtime_error("nothing to serialize: no DFA and no NFA");
+    std::string out(sizeof(AutomatonFileHeader), '\0');
+    AutomatonFileHeader h{};
+    std::memcpy(h.magic, "RECALCAU", 8);
+    h.version = AutomatonFileHeader::VERSION;
+    h.endianTag = AutomatonFileHeader::ENDIAN_TAG;
+    h.numPatterns = (uint32_t)patterns.size();
+    h.flags = (dfa ? (uint32_t)AutomatonFileHeader::HAS_DFA : 0) | (nfa ? (uint32_t)AutomatonFileHeader::HAS_NFA : 0) |
+              (unanchored ? (uint32_t)AutomatonFileHeader::UNANCHORED : 0);
+    auto section = [&](const void *p, size_t n) {
+        out.resize((out.size() + 7) & ~(size_t)7, '\0');
+        uint64_t off = out.size();
+        out.append((const char *)p, n);
+        return off;
+    };
+    if (dfa) {
+        h.dfaStates = (uint32_t)dfa->numStates;
+        h.dfaClasses = (uint32_t)dfa->numClasses;
+        h.dfaStart = dfa->start;
+        std::vector<uint32_t> index{0}, ids;
+        for (const auto &ps : dfa->patterns) {
+            for (int id : ps) ids.push_back((uint32_t)id);
+            index.push_back((uint32_t)ids.size());
+        }
+        h.dfaPatternIds = (uint32_t)ids.size();
+        h.dfaTableOff = section(dfa->table.data(), dfa->table.size() * sizeof(int32_t));
+        h.dfaByteClassOff = section(dfa->byteClass.data(), 256);
+        h.dfaAcceptOff = section(dfa->accept.data(), dfa->accept.size());
+        h.dfaPatternIndexOff = section(index.data(), index.size() * sizeof(uint32_t));
+        h.dfaPatternIdsOff = section(ids.data(), ids.size() * sizeof(uint32_t));
+    }
+    if (nfa) {
+        h.nfaInsts = (uint32_t)nfa->size();
+        h.nfaStart = nfa->start;
+        // field by field, so the padding bytes are zero and the checksum repeatable
+        std::vector<unsigned char> code(nfa->size() * sizeof(NInst), 0);
+        for (size_t i = 0; i < nfa->size(); ++i) {
+            const NInst &in = nfa->insts[i];
+            unsigned char *rec = code.data() + i * sizeof(NInst);
+            rec[offsetof(NInst, op)] = (unsigned char)in.op;
+            rec[offsetof(NInst, c)] = in.c;
+            std::memcpy(rec + offsetof(NInst, x), &in.x, sizeof(int));
+            std::memcpy(rec + offsetof(NInst, y), &in.y, sizeof(int));
+        }
+        h.nfaCodeOff = section(code.data(), code.size());
+    }
+    std::vector<uint32_t> sourceIndex{0};
+    std::string text;
+    for (const auto &p : patterns) { text += p; sourceIndex.push_back((uint32_t)text.size()); }
+    h.sourceIndexOff = section(sourceIndex.data(), sourceIndex.size() * sizeof(uint32_t));
+    h.sourceTextOff = section(text.data(), text.size());
+    h.sourceTextSize = text.size();
+    out.resize((out.size() + 7) & ~(size_t)7, '\0');
+    h.fileSize = out.size();
+    std::memcpy(&out[0], &h, sizeof h);
+    h.checksum = automatonChecksum((const unsigned char *)out.data(), out.size());
+    std::memcpy(&out[offsetof(AutomatonFileHeader, checksum)], &h.checksum, sizeof h.checksum);
+    return out;
+}
+
+// Read-only mapping of a whole file; throws if it can't be opened or mapped
+class MappedFile {
+    const char *ptr = nullptr;
+    size_t len = 0;
+#ifdef _WIN32
+    HANDLE map = nullptr;
+#endif
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string &path) {
+#ifdef _WIN32
+        HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (f == INVALID_HANDLE_VALUE) throw std::runtime_error("cannot open " + path);
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(f, &size)) { CloseHandle(f); throw std::runtime_error("cannot stat " + path); }
+        len = (size_t)size.QuadPart;
+        if (len) {
+            map = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            ptr = map ? (const char *)MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        }
+        CloseHandle(f);
+        if (len && !ptr) { if (map) CloseHandle(map); throw std::runtime_error("cannot map " + path); }
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("cannot open " + path);
+        struct stat sb;
+        if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) { close(fd); throw std::runtime_error("not a regular file: " + path); }
+        len = (size_t)sb.st_size;
+        if (len) {
+            void *p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) { close(fd); throw std::runtime_error("cannot map " + path); }
+            ptr = (const char *)p;
+        }
+        close(fd);
+#endif
+    }
+    ~MappedFile() {
+        if (!ptr) return;
+#ifdef _WIN32
+        UnmapViewOfFile(ptr);
+        CloseHandle(map);
+#else
+        munmap((void *)ptr, len);
+#endif
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return ptr; }
+    size_t size() const { return len; }
+};
+
+// A validated compiled automaton, matched in place. Construction checks the
+// magic, version, byte order, size and checksum, then every section bound
+// and every index the matchers will follow (table entries, byte classes,
+// instruction targets, pattern ids), so a damaged file throws
+// std::runtime_error here and can never send a match out of bounds.
+// Immutable after construction: share it between threads, with one PikeVM
+// (nfaVM) per thread as usual.
+class CompiledAutomaton {
+    MappedFile file; // empty when viewing caller memory
+    const unsigned char *base = nullptr;
+    size_t size = 0;
+    const AutomatonFileHeader *h = nullptr;
+
+    [[noreturn]] static void fail(const std::string &why) { throw std::runtime_error("invalid automaton file: " + why); }
+
+    // count elements of elemSize at off, aligned and inside the file
+    template <class T>
+    const T *section(uint64_t off, uint64_t count, const char *what) const {
+        if (off % alignof(T) != 0 || off > size || count > (size - off) / sizeof(T)) fail(std::string(what) + " out of bounds");
+        return (const T *)(base + off);
+    }
+
+    void validate() {
+        if (size < sizeof(AutomatonFileHeader)) fail("too small");
+        if ((uintptr_t)base % 8 != 0) fail("data not 8-byte aligned");
+        h = (const AutomatonFileHeader *)base;
+        if (std::memcmp(h->magic, "RECALCAU", 8) != 0) fail("bad magic");
+        if (h->endianTag != AutomatonFileHeader::ENDIAN_TAG) fail("written with the other byte order");
+        if (h->version != AutomatonFileHeader::VERSION) fail("unsupported version " + std::to_string(h->version));
+        if (h->fileSize != size) fail("size mismatch (truncated?)");
+        if (automatonChecksum(base, size) != h->checksum) fail("checksum mismatch");
+        if ((h->flags & ~(uint32_t)AutomatonFileHeader::ALL_FLAGS) || !(h->flags & (AutomatonFileHeader::HAS_DFA | AutomatonFileHeader::HAS_NFA)))
+            fail("bad flags");
+        if (hasDFA()) {
+            uint64_t states = h->dfaStates, classes = h->dfaClasses;
+            if (states < 1 || classes < 1 || classes > 256) fail("bad DFA dimensions");
+            if (h->dfaStart < 0 || (uint64_t)h->dfaStart >= states) fail("DFA start out of range");
+            const int32_t *t = section<int32_t>(h->dfaTableOff, states * classes, "DFA table");
+            for (uint64_t i = 0; i < states * classes; ++i)
+                if (t[i] < 0 || (uint64_t)t[i] >= states || (i < classes && t[i] != DFA::DEAD)) fail("DFA transition out of range");
+            const uint8_t *bc = section<uint8_t>(h->dfaByteClassOff, 256, "byte classes");
+            for (int b = 0; b < 256; ++b) if (bc[b] >= classes) fail("byte class out of range");
+            const uint8_t *acc = section<uint8_t>(h->dfaAcceptOff, states, "DFA accept");
+            if (acc[DFA::DEAD]) fail("dead state accepts");
+            const uint32_t *idx = section<uint32_t>(h->dfaPatternIndexOff, states + 1, "DFA pattern index");
+            const uint32_t *ids = section<uint32_t>(h->dfaPatternIdsOff, h->dfaPatternIds, "DFA pattern ids");
+            if (idx[0] != 0 || idx[states] != h->dfaPatternIds) fail("bad DFA pattern index");
+            for (uint64_t s = 0; s < states; ++s) if (idx[s] > idx[s + 1]) fail("bad DFA pattern index");
+            for (uint32_t i = 0; i < h->dfaPatternIds; ++i) if (ids[i] >= h->numPatterns) fail("pattern id out of range");
+        }
+        if (hasNFA()) {
+            uint64_t n = h->nfaInsts;
+            const NInst *code = section<NInst>(h->nfaCodeOff, n, "NFA code");
+            if (h->nfaStart < -1 || h->nfaStart >= (int64_t)n) fail("NFA start out of range");
+            auto target = [&](int pc) { return pc >= 0 && (uint64_t)pc < n; };
+            for (uint64_t i = 0; i < n; ++i) {
+                const NInst &in = code[i];
+                bool ok;
+                switch (in.op) {
+                    case OP_CHAR: case OP_EPS: ok = target(in.x); break;
+                    case OP_RANGE: ok = target(in.x) && in.y >= in.c && in.y <= 255; break;
+                    case OP_SPLIT: ok = target(in.x) && target(in.y); break;
+                    case OP_MATCH: ok = in.x >= 0 && (uint64_t)in.x < h->numPatterns; break;
+                    case OP_FAIL: ok = true; break;
+                    default: ok = false;
+                }
+                if (!ok) fail("NFA instruction " + std::to_string(i) + " is malformed");
+            }
+        }
+        const uint32_t *si = section<uint32_t>(h->sourceIndexOff, (uint64_t)h->numPatterns + 1, "pattern index");
+        section<char>(h->sourceTextOff, h->sourceTextSize, "pattern text");
+        if (si[0] != 0 || si[h->numPatterns] != h->sourceTextSize) fail("bad pattern index");
+        for (uint32_t i = 0; i < h->numPatterns; ++i) if (si[i] > si[i + 1]) fail("bad pattern index");
+    }
+
+public:
+    // Maps path and validates it
+    explicit CompiledAutomaton(const std::string &path) : file(path) {
+        base = (const unsigned char *)file.data();
+        size = file.size();
+        validate();
+    }
+    // Validates a file image already in memory (8-byte aligned), which must
+    // outlive this object
+    CompiledAutomaton(const void *data, size_t n) : base((const unsigned char *)data), size(n) { validate(); }
+
+    CompiledAutomaton(const CompiledAutomaton &) = delete;
+    CompiledAutomaton &operator=(const CompiledAutomaton &) = delete;
+
+    bool hasDFA() const { return h->flags & AutomatonFileHeader::HAS_DFA; }
+    bool hasNFA() const { return h->flags & AutomatonFileHeader::HAS_NFA; }
+    bool unanchored() const { return h->flags & AutomatonFileHeader::UNANCHORED; }
+    size_t fileSize() const { return size; }
+
+    size_t patternCount() const { return h->numPatterns; }
+    std::string_view pattern(size_t i) const {
+        const uint32_t *si = (const uint32_t *)(base + h->sourceIndexOff);
+        return std::string_view((const char *)base + h->sourceTextOff + si[i], si[i + 1] - si[i]);
+    }
+
+    // Requires hasDFA()
+    DFAView dfa() const {
+        return DFAView{(const int32_t *)(base + h->dfaTableOff), base + h->dfaByteClassOff, base + h->dfaAcceptOff,
+                       h->dfaStart, (int)h->dfaStates, (int)h->dfaClasses};
+    }
+    // Sorted ids of the patterns DFA state s accepts
+    void dfaPatterns(int32_t s, std::vector<int> &out) const {
+        const uint32_t *idx = (const uint32_t *)(base + h->dfaPatternIndexOff);
+        const uint32_t *ids = (const uint32_t *)(base + h->dfaPatternIdsOff);
+        out.assign(ids + idx[s], ids + idx[s + 1]);
+    }
+
+    // Requires hasNFA(); the VM keeps per-thread scratch, the code stays in the file
+    PikeVM nfaVM() const { return PikeVM((const NInst *)(base + h->nfaCodeOff), h->nfaInsts, h->nfaStart); }
+
+    // Whole-input match (anchored files): the DFA when there is one, else the NFA
+    bool matches(const char *p, size_t n) const {
+        if (hasDFA()) return dfa().matches(p, n);
+        PikeVM vm = nfaVM();
+        return vm.matches(p, n);
+    }
+    bool matches(const std::string &s) const { return matches(s.data(), s.size()); }
+
+    // Sorted ids of the patterns that match all of p[0, n)
+    void matchSet(const char *p, size_t n, std::vector<int> &ids) const {
+        if (hasDFA()) {
+            DFAView d = dfa();
+            int32_t s = d.start;
+            for (size_t i = 0; i < n; ++i) s = d.next(s, (unsigned char)p[i]);
+            dfaPatterns(s, ids);
+            return;
+        }
+        PikeVM vm = nfaVM();
+        vm.matchSet(p, n, ids);
+    }
+};
@@ -0,0 +1,314 @@
+#pragma once
+#include "Stats.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <ostream>
+#include <istream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cctype>
+#include <iterator>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Micro-benchmark harness: named benchmarks, auto-calibrated iteration
+// counts, allocation counts, peak RSS, JSON output and comparison against a
+// saved JSON run.
+//
+// Allocations are counted only if the program includes CountingNew.h
+// (bench.cpp does); otherwise they read 0.
+
+// Peak resident set size of the process in KiB, 0 where unknown. On Linux
+// resetPeakRSS() rewinds the peak to the current size, so a read after one
+// benchmark is that benchmark's peak; elsewhere the peak only grows.
+inline uint64_t peakRSSKiB() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (K32GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof pmc)) return pmc.PeakWorkingSetSize / 1024;
+    return 0;
+#elif defined(__linux__)
+    if (std::FILE *f = std::fopen("/proc/self/status", "r")) {
+        char line[256];
+        unsigned long long kb = 0;
+        while (std::fgets(line, sizeof line, f))
+            if (std::sscanf(line, "VmHWM: %llu kB", &kb) == 1) break;
+        std::fclose(f);
+        if (kb) return kb;
+    }
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? (uint64_t)ru.ru_maxrss : 0;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return (uint64_t)ru.ru_maxrss / 1024; // bytes on macOS
+#else
+    return (uint64_t)ru.ru_maxrss;
+#endif
+#endif
+}
+
+inline void resetPeakRSS() {
+#ifdef __linux__
+    if (std::FILE *f = std::fopen("/proc/self/clear_refs", "w")) {
+        std::fputs("5", f);
+        std::fclose(f);
+    }
+#endif
+}
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations = 0;     // per timed repetition
+    double nsPerOp = 0;          // median over the repetitions
+    double bytesPerOp = 0;       // input bytes one op consumes; 0 if not meaningful
+    double allocsPerOp = 0;
+    double allocBytesPerOp = 0;
+    uint64_t peakRSSKiB = 0;
+
+    double bytesPerSec() const { return bytesPerOp > 0 && nsPerOp > 0 ? bytesPerOp * 1e9 / nsPerOp : 0; }
+};
+
+class BenchSuite {
+public:
+    struct Options {
+        std::string filter;        // run only benchmarks whose name contains this
+        double minSeconds = 0.2;   // each repetition runs at least this long
+        int repetitions = 5;
+    };
+
+    explicit BenchSuite(Options options) : opt(std::move(options)) {}
+
+    // fn runs one op; bytes is how much input that op consumes
+    void add(const std::string &name, double bytes, std::function<void()> fn) {
+        cases.push_back(Case{name, bytes, std::move(fn)});
+    }
+
+    // Runs every selected benchmark, printing a line per result to log
+    std::vector<BenchResult> run(std::ostream &log) {
+        std::vector<BenchResult> results;
+        for (Case &c : cases) {
+            if (!opt.filter.empty() && c.name.find(opt.filter) == std::string::npos) continue;
+            results.push_back(measure(c));
+            printRow(log, results.back());
+        }
+        return results;
+    }
+
+    static void printHeader(std::ostream &log) {
+        log << std::left << std::setw(44) << "benchmark" << std::right << std::setw(14) << "ns/op" << std::setw(12) << "MB/s"
+            << std::setw(12) << "allocs/op" << std::setw(12) << "peak KiB" << "\n";
+    }
+
+private:
+    struct Case {
+        std::string name;
+        double bytes;
+        std::function<void()> fn;
+    };
+    Options opt;
+    std::vector<Case> cases;
+
+    static double elapsedNs(std::function<void()> &fn, uint64_t iters) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iters; ++i) fn();
+        auto t1 = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(t1 - t0).count();
+    }
+
+    BenchResult measure(Case &c) {
+        resetPeakRSS();
+        BenchResult r;
+        r.name = c.name;
+        r.bytesPerOp = c.bytes;
+
+        // grow the iteration count until a repetition lasts minSeconds (the
+        // first single op doubles as the warm-up)
+        uint64_t iters = 1;
+        double t = elapsedNs(c.fn, 1);
+        while (t < opt.minSeconds * 1e9 && iters < (uint64_t)1 << 40) {
+            double perOp = t / (double)iters;
+            uint64_t want = perOp > 0 ? (uint64_t)(opt.minSeconds * 1e9 / perOp * 1.2) : iters * 10;
+            iters = std::max(iters * 2, std::min(want, iters * 100));
+            t = elapsedNs(c.fn, iters);
+        }
+        // allocations are sampled over the timed repetitions, i.e. in steady state
+        AllocCounter &ac = allocationCounter();
+        uint64_t n0 = ac.count.load(), b0 = ac.bytes.load();
+        std::vector<double> times;
+        for (int i = 0; i < std::max(1, opt.repetitions); ++i) times.push_back(elapsedNs(c.fn, iters) / (double)iters);
+        double ops = (double)iters * (double)times.size();
+        r.allocsPerOp = (double)(ac.count.load() - n0) / ops;
+        r.allocBytesPerOp = (double)(ac.bytes.load() - b0) / ops;
+        std::sort(times.begin(), times.end());
+        r.iterations = iters;
+        r.nsPerOp = times[times.size() / 2];
+        r.peakRSSKiB = peakRSSKiB();
+        return r;
+    }
+
+    static void printRow(std::ostream &log, const BenchResult &r) {
+        std::ostringstream ns, mbs, allocs;
+        ns << std::fixed << std::setprecision(r.nsPerOp < 100 ? 2 : 0) << r.nsPerOp;
+        if (r.bytesPerSec() > 0) mbs << std::fixed << std::setprecision(1) << r.bytesPerSec() / 1e6; else mbs << "-";
+        allocs << std::fixed << std::setprecision(r.allocsPerOp == (uint64_t)r.allocsPerOp ? 0 : 2) << r.allocsPerOp;
+        log << std::left << std::setw(44) << r.name << std::right << std::setw(14) << ns.str() << std::setw(12) << mbs.str()
+            << std::setw(12) << allocs.str() << std::setw(12) << r.peakRSSKiB << "\n";
+    }
+};
+
+// --- JSON ---------------------------------------------------------------
+
+inline std::string jsonEscape(const std::string &s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') { out += '\\'; out += c; }
+        else if ((unsigned char)c < 0x20) { char u[8]; std::snprintf(u, sizeof u, "\\u%04x", c); out += u; }
+        else out += c;
+    }
+    return out;
+}
+
+// {"schema": 1, "benchmarks": [{"name": ..., "ns_per_op": ..., ...}, ...]}
+inline void writeBenchJSON(std::ostream &out, const std::vector<BenchResult> &results) {
+    std::streamsize precision = out.precision();
+    out << "{\n  \"schema\": 1,\n  \"benchmarks\": [\n";
+    out << std::setprecision(17);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &r = results[i];
+        out << "    {\"name\": \"" << jsonEscape(r.name) << "\", \"iterations\": " << r.iterations
+            << ", \"ns_per_op\": " << r.nsPerOp << ", \"bytes_per_op\": " << r.bytesPerOp
+            << ", \"bytes_per_sec\": " << r.bytesPerSec() << ", \"allocs_per_op\": " << r.allocsPerOp
+            << ", \"alloc_bytes_per_op\": " << r.allocBytesPerOp << ", \"peak_rss_kib\": " << r.peakRSSKiB << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    out.precision(precision);
+}
+
+// Reads back what writeBenchJSON wrote: every object holding a "name" string,
+// with its numeric fields. Anything else is skipped.
+inline std::vector<BenchResult> readBenchJSON(std::istream &in) {
+    std::string s((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::vector<BenchResult> results;
+    size_t i = 0;
+    auto skipSpace = [&] { while (i < s.size() && std::isspace((unsigned char)s[i])) i++; };
+    auto readString = [&] {
+        std::string out;
+        for (i++; i < s.size() && s[i] != '"'; ++i) {
+            if (s[i] == '\\' && i + 1 < s.size()) {
+                i++;
+                if (s[i] == 'u' && i + 4 < s.size()) { out += (char)std::strtol(s.substr(i + 1, 4).c_str(), nullptr, 16); i += 4; }
+                else out += s[i] == 'n' ? '\n' : s[i] == 't' ? '\t' : s[i];
+            } else out += s[i];
+        }
+        i++;
+        return out;
+    };
+    while ((i = s.find('{', i)) != std::string::npos) {
+        i++;
+        std::map<std::string, double> nums;
+        std::string name;
+        bool named = false;
+        for (;;) {
+            skipSpace();
+            if (i >= s.size() || s[i] != '"') break;
+            std::string key = readString();
+            skipSpace();
+            if (i >= s.size() || s[i] != ':') break;
+            i++;
+            skipSpace();
+            if (i < s.size() && s[i] == '"') {
+                std::string v = readString();
+                if (key == "name") { name = v; named = true; }
+            } else if (i < s.size() && (s[i] == '[' || s[i] == '{')) {
+                break; // a container, e.g. the top level's "benchmarks"
+            } else {
+                char *end;
+                double v = std::strtod(s.c_str() + i, &end);
+                if (end == s.c_str() + i) break;
+                nums[key] = v;
+                i = (size_t)(end - s.c_str());
+            }
+            skipSpace();
+            if (i < s.size() && s[i] == ',') i++;
+        }
+        if (!named) continue;
+        BenchResult r;
+        r.name = name;
+        r.iterations = (uint64_t)nums["iterations"];
+        r.nsPerOp = nums["ns_per_op"];
+        r.bytesPerOp = nums["bytes_per_op"];
+        r.allocsPerOp = nums["allocs_per_op"];
+        r.allocBytesPerOp = nums["alloc_bytes_per_op"];
+        r.peakRSSKiB = (uint64_t)nums["peak_rss_kib"];
+        results.push_back(r);
+    }
+    return results;
+}
+
+// --- Comparison -----------------------------------------------------------
+
+struct BenchDelta {
+    std::string name;
+    double baseNs, curNs;
+    double baseAllocs, curAllocs;
+    bool slower;     // time grew by more than the threshold
+    bool moreAllocs; // allocation count grew at all (it is deterministic)
+};
+
+// Pairs up benchmarks by name; ones present in only one run are left out
+inline std::vector<BenchDelta> compareBench(const std::vector<BenchResult> &baseline, const std::vector<BenchResult> &current,
+                                            double thresholdPercent) {
+    std::map<std::string, const BenchResult *> base;
+    for (const BenchResult &b : baseline) base[b.name] = &b;
+    std::vector<BenchDelta> out;
+    for (const BenchResult &c : current) {
+        auto it = base.find(c.name);
+        if (it == base.end()) continue;
+        const BenchResult &b = *it->second;
+        out.push_back(BenchDelta{c.name, b.nsPerOp, c.nsPerOp, b.allocsPerOp, c.allocsPerOp,
+                                 c.nsPerOp > b.nsPerOp * (1 + thresholdPercent / 100), c.allocsPerOp > b.allocsPerOp + 0.5});
+    }
+    return out;
+}
+
+// Prints the comparison; returns the number of regressions
+inline int printBenchComparison(std::ostream &log, const std::vector<BenchDelta> &deltas) {
+    int regressions = 0;
+    std::ios::fmtflags flags = log.flags();
+    std::streamsize precision = log.precision();
+    log << std::left << std::setw(44) << "benchmark" << std::right << std::setw(14) << "base ns" << std::setw(14) << "ns"
+        << std::setw(10) << "change" << "  " << std::setw(20) << "allocs/op" << "\n";
+    for (const BenchDelta &d : deltas) {
+        std::ostringstream change, allocs;
+        change << std::showpos << std::fixed << std::setprecision(1) << (d.baseNs > 0 ? (d.curNs / d.baseNs - 1) * 100 : 0) << "%";
+        allocs << std::setprecision(4) << d.baseAllocs << " -> " << d.curAllocs;
+        log << std::left << std::setw(44) << d.name << std::right << std::fixed << std::setprecision(1) << std::setw(14) << d.baseNs
+            << std::setw(14) << d.curNs << std::setw(10) << change.str() << "  " << std::setw(20) << allocs.str();
+        log.unsetf(std::ios::floatfield);
+        if (d.slower) log << "  SLOWER";
+        if (d.moreAllocs) log << "  MORE ALLOCS";
+        log << "\n";
+        if (d.slower || d.moreAllocs) regressions++;
+    }
+    log.flags(flags);
+    log.precision(precision);
+    return regressions;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include "Parser.h"
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+
+// Flat bytecode for arithmetic ASTs. The tree is compiled once in postorder,
+// so evaluating it is a single loop over a contiguous array: no virtual calls,
+// no dynamic_cast, no allocation and no trace strings.
+enum class Op : uint8_t { PUSH, LOAD, NEG, ADD, SUB, MUL, DIV };
+
+struct Instr {
+    Op op;
+    uint32_t arg; // PUSH: index into Bytecode::constants, LOAD: variable slot
+};
+
+struct Bytecode {
+    std::vector<Instr> code;
+    std::vector<double> constants;
+    std::vector<std::string> variables; // slot -> name, in order of first use
+    int maxStack = 0; // deepest the operand stack gets
+
+    // slot of a variable, or -1 if the expression doesn't use it
+    int slotOf(const std::string &name) const {
+        for (size_t i = 0; i < variables.size(); ++i) if (variables[i] == name) return (int)i;
+        return -1;
+    }
+};
+
+// Postorder walk of the AST. Unary + compiles to nothing.
+class BytecodeCompiler {
+    Bytecode out;
+    int depth = 0;
+
+    void emit(Op op, uint32_t arg, int stackEffect) {
+        out.code.push_back(Instr{op, arg});
+        depth += stackEffect;
+        if (depth > out.maxStack) out.maxStack = depth;
+    }
+
+    // Emits one node; walkPostorder has already emitted its children
+    void compileNode(const ASTNode *node) {
+        if (const NumberNode *n = dynamic_cast<const NumberNode*>(node)) {
+            out.constants.push_back(n->value);
+            emit(Op::PUSH, (uint32_t)(out.constants.size() - 1), +1);
+        } else if (const VariableNode *v = dynamic_cast<const VariableNode*>(node)) {
+            int slot = out.slotOf(v->name);
+            if (slot < 0) { slot = (int)out.variables.size(); out.variables.push_back(v->name); }
+            emit(Op::LOAD, (uint32_t)slot, +1);
+        } else if (const UnaryNode *u = dynamic_cast<const UnaryNode*>(node)) {
+            if (u->op == '-') emit(Op::NEG, 0, 0);
+        } else if (const BinaryNode *b = dynamic_cast<const BinaryNode*>(node)) {
+            switch (b->op) {
+                case '+': emit(Op::ADD, 0, -1); break;
+                case '-': emit(Op::SUB, 0, -1); break;
+                case '*': emit(Op::MUL, 0, -1); break;
+                case '/': emit(Op::DIV, 0, -1); break;
+                default: throw std::runtime_error(std::string("Unknown operator: ") + b->op);
+            }
+        } else {
+            throw std::runtime_error("Unknown AST node");
+        }
+    }
+
+public:
+    Bytecode compile(const ASTNode *root) {
+        out = Bytecode{};
+        depth = 0;
+        walkPostorder(root, [this](const ASTNode *node, int) { compileNode(node); });
+        return std::move(out);
+    }
+};
+
+inline Bytecode compileBytecode(const ASTNode *root) { return BytecodeCompiler().compile(root); }
+
+// Stack machine for Bytecode. The operand stack is kept between runs and only
+// grows, so repeated evaluation of the same program never allocates.
+class StackVM {
+    std::vector<double> stack;
+public:
+    // vars[i] is the value of bc.variables[i]
+    double run(const Bytecode &bc, const double *vars = nullptr) {
+        if (!vars && !bc.variables.empty()) throw std::runtime_error("Unknown variable: " + bc.variables[0]);
+        if (stack.size() < (size_t)bc.maxStack) stack.resize(bc.maxStack);
+        double *sp = stack.data(); // next free slot
+        const double *k = bc.constants.data();
+        for (const Instr &in : bc.code) {
+            switch (in.op) {
+                case Op::PUSH: *sp++ = k[in.arg]; break;
+                case Op::LOAD: *sp++ = vars[in.arg]; break;
+                case Op::NEG: sp[-1] = -sp[-1]; break;
+                case Op::ADD: sp--; sp[-1] += sp[0]; break;
+                case Op::SUB: sp--; sp[-1] -= sp[0]; break;
+                case Op::MUL: sp--; sp[-1] *= sp[0]; break;
+                case Op::DIV: sp--; sp[-1] /= sp[0]; break;
+            }
+        }
+        return stack[0];
+    }
+};
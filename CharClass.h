@@ -0,0 +1,222 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <array>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cctype>
+
+// A set of bytes as sorted, disjoint, non-adjacent ranges. Every regex atom
+// is one: a literal is a one-byte class, [...] and . are written as ranges.
+struct CharClass {
+    struct Range { unsigned char lo, hi; };
+    std::vector<Range> ranges;
+
+    static CharClass byte(unsigned char c) { return CharClass{{{c, c}}}; }
+    static CharClass any() { return CharClass{{{0, 255}}}; }
+
+    void add(unsigned char lo, unsigned char hi) { ranges.push_back({lo, hi}); }
+
+    // Sort and merge overlapping or touching ranges
+    void normalize() {
+        std::sort(ranges.begin(), ranges.end(), [](const Range &a, const Range &b) { return a.lo < b.lo; });
+        std::vector<Range> out;
+        for (const Range &r : ranges) {
+            if (!out.empty() && r.lo <= out.back().hi + 1) out.back().hi = std::max(out.back().hi, r.hi);
+            else out.push_back(r);
+        }
+        ranges.swap(out);
+    }
+
+    // Complement of a normalized class
+    void negate() {
+        std::vector<Range> out;
+        int next = 0;
+        for (const Range &r : ranges) {
+            if (r.lo > next) out.push_back({(unsigned char)next, (unsigned char)(r.lo - 1)});
+            next = r.hi + 1;
+        }
+        if (next <= 255) out.push_back({(unsigned char)next, 255});
+        ranges.swap(out);
+    }
+
+    bool contains(unsigned char c) const {
+        for (const Range &r : ranges) if (c >= r.lo && c <= r.hi) return true;
+        return false;
+    }
+    bool isByte() const { return ranges.size() == 1 && ranges[0].lo == ranges[0].hi; }
+    bool empty() const { return ranges.empty(); }
+
+    // Bytes that can't stand for themselves in a postfix regex
+    static bool isSpecial(unsigned char c) {
+        return c == 0 || c == '.' || c == '|' || c == '*' || c == '+' || c == '?' || c == '(' || c == ')' ||
+               c == '[' || c == ']' || c == '{' || c == '}' || c == '\\';
+    }
+
+    // Postfix spelling: the byte itself for an ordinary literal, otherwise
+    // [lo-hi...] with every byte but letters and digits written \xHH. The
+    // spelling has no ']' inside, so readers can skip it with a find.
+    std::string spelling() const {
+        if (isByte() && !isSpecial(ranges[0].lo)) return std::string(1, (char)ranges[0].lo);
+        std::string s = "[";
+        for (const Range &r : ranges) {
+            s += escape(r.lo);
+            if (r.hi != r.lo) s += "-" + escape(r.hi);
+        }
+        return s + "]";
+    }
+
+    static std::string escape(unsigned char c) {
+        if (std::isalnum(c)) return std::string(1, (char)c);
+        const char *hex = "0123456789abcdef";
+        return std::string("\\x") + hex[c >> 4] + hex[c & 15];
+    }
+};
+
+// Regex atom syntax, shared by the infix pattern and the postfix spelling:
+//   c        the byte c (anything but . | * + ? ( ) [ ] { \)
+//   .        any byte
+//   \c       the byte c literally; \n \t \r \f \v and \xHH as in C
+//   [...]    any byte listed; a-z is a range, a leading ^ negates, and a ]
+//            right after [ or [^ is literal, as is - first or last
+// Malformed atoms throw std::runtime_error naming the offset.
+inline unsigned char parseEscape(const std::string &re, size_t &i) {
+    size_t at = i++; // re[at] == '\\'
+    if (i >= re.size()) throw std::runtime_error("Dangling \\ at offset " + std::to_string(at));
+    char c = re[i++];
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        case 'x': {
+            auto digit = [&](size_t k) {
+                if (k >= re.size() || !std::isxdigit((unsigned char)re[k]))
+                    throw std::runtime_error("\\x needs two hex digits at offset " + std::to_string(at));
+                return std::isdigit((unsigned char)re[k]) ? re[k] - '0' : (std::tolower((unsigned char)re[k]) - 'a' + 10);
+            };
+            int v = digit(i) * 16 + digit(i + 1);
+            i += 2;
+            return (unsigned char)v;
+        }
+        default: return (unsigned char)c;
+    }
+}
+
+inline CharClass parseBracket(const std::string &re, size_t &i) {
+    size_t at = i++; // re[at] == '['
+    CharClass cc;
+    bool negated = i < re.size() && re[i] == '^';
+    if (negated) i++;
+    bool first = true;
+    for (;;) {
+        if (i >= re.size()) throw std::runtime_error("Unterminated character class at offset " + std::to_string(at));
+        if (re[i] == ']' && !first) { i++; break; }
+        first = false;
+        size_t itemAt = i;
+        unsigned char lo = re[i] == '\\' ? parseEscape(re, i) : (unsigned char)re[i++];
+        unsigned char hi = lo;
+        if (i + 1 < re.size() && re[i] == '-' && re[i + 1] != ']') {
+            i++;
+            hi = re[i] == '\\' ? parseEscape(re, i) : (unsigned char)re[i++];
+            if (hi < lo) throw std::runtime_error("Invalid range in character class at offset " + std::to_string(itemAt));
+        }
+        cc.add(lo, hi);
+    }
+    cc.normalize();
+    if (negated) cc.negate();
+    if (cc.empty()) throw std::runtime_error("Character class at offset " + std::to_string(at) + " matches nothing");
+    return cc;
+}
+
+// The atom at re[i] (which must not be an operator), advancing i past it
+inline CharClass parseAtom(const std::string &re, size_t &i) {
+    char c = re[i];
+    if (c == '[') return parseBracket(re, i);
+    if (c == '\\') return CharClass::byte(parseEscape(re, i));
+    i++;
+    if (c == '.') return CharClass::any();
+    return CharClass::byte((unsigned char)c);
+}
+
+// Counted repetition {n}, {n,} or {n,m} at re[i] == '{', advancing i past
+// it; max is -1 for {n,}. Counts go up to MAX_REPEAT.
+constexpr int MAX_REPEAT = 1000000;
+inline void parseRepeat(const std::string &re, size_t &i, int &min, int &max) {
+    size_t at = i++;
+    auto bad = [&](const char *why) { return std::runtime_error(std::string(why) + " at offset " + std::to_string(at)); };
+    auto number = [&] {
+        if (i >= re.size() || !std::isdigit((unsigned char)re[i])) throw bad("Invalid repetition");
+        long v = 0;
+        while (i < re.size() && std::isdigit((unsigned char)re[i])) {
+            v = v * 10 + (re[i++] - '0');
+            if (v > MAX_REPEAT) throw bad("Repetition count too large");
+        }
+        return (int)v;
+    };
+    min = max = number();
+    if (i < re.size() && re[i] == ',') {
+        i++;
+        max = i < re.size() && re[i] == '}' ? -1 : number();
+    }
+    if (i >= re.size() || re[i] != '}') throw bad("Invalid repetition");
+    i++;
+    if (max >= 0 && max < min) throw bad("Repetition {n,m} with m < n");
+    if (max == 0) throw bad("Repetition {0} matches only the empty string");
+}
+
+// Postfix spelling of a counted repetition
+inline std::string repeatSpelling(int min, int max) {
+    return "{" + std::to_string(min) + "," + (max < 0 ? "" : std::to_string(max)) + "}";
+}
+
+// Walks a postfix regex (ThompsonNFA::toPostfix) token by token: an
+// operator '.', '|', '*', '+', '?' or '{' (bounds in repeatMin/repeatMax),
+// or an atom
+class PostfixReader {
+    const std::string &s;
+    size_t i = 0;
+public:
+    int repeatMin = 0, repeatMax = -1; // bounds of the last '{' operator; max -1 is unbounded
+
+    explicit PostfixReader(const std::string &postfix) : s(postfix) {}
+    size_t offset() const { return i; } // of the next token
+    // false at the end; otherwise op is the operator, or 0 with atom set
+    bool next(char &op, CharClass &atom) {
+        if (i >= s.size()) return false;
+        op = s[i];
+        if (op == '.' || op == '|' || op == '*' || op == '+' || op == '?') { i++; return true; }
+        if (op == '{') { parseRepeat(s, i, repeatMin, repeatMax); return true; }
+        op = 0;
+        if (s[i] == '[') atom = parseBracket(s, i);
+        else atom = CharClass::byte((unsigned char)s[i++]);
+        return true;
+    }
+};
+
+// Partition of the 256 byte values into classes no edge label tells apart:
+// two bytes share a class when every label contains both or neither. DFA
+// tables have one column per class instead of one per byte, which for
+// typical patterns is a handful of columns instead of 256.
+struct ByteClasses {
+    std::array<uint8_t, 256> classOf{}; // all bytes start in class 0
+    int count = 1;
+    std::vector<unsigned char> representative{0}; // smallest byte of each class
+
+    // Split every class that the label cuts through
+    void split(const CharClass &label) {
+        std::array<bool, 256> in{};
+        for (const auto &r : label.ranges) for (int c = r.lo; c <= r.hi; ++c) in[c] = true;
+        std::vector<int> id(2 * count, -1);
+        int n = 0;
+        representative.clear();
+        for (int c = 0; c < 256; ++c) {
+            int &k = id[2 * classOf[c] + in[c]];
+            if (k < 0) { k = n++; representative.push_back((unsigned char)c); }
+            classOf[c] = (uint8_t)k;
+        }
+        count = n;
+    }
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include "Stats.h"
+#include <new>
+#include <cstdlib>
+
+// Replaces the global operator new/delete so that every heap allocation in
+// the program bumps allocationCounter(). Include it in exactly one .cpp of a
+// program (the replacement functions can't be inline).
+//
+// The deletes are kept out of line: inlined into a caller, GCC would see
+// free() applied to memory from operator new and warn about the mismatch.
+#if defined(_MSC_VER)
+#define RECALC_OUT_OF_LINE __declspec(noinline)
+#else
+#define RECALC_OUT_OF_LINE __attribute__((noinline))
+#endif
+
+void *operator new(std::size_t n) {
+    AllocCounter &c = allocationCounter();
+    c.count.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(n, std::memory_order_relaxed);
+    if (void *p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void *operator new[](std::size_t n) { return ::operator new(n); }
+void *operator new(std::size_t n, const std::nothrow_t &) noexcept {
+    try { return ::operator new(n); } catch (...) { return nullptr; }
+}
+void *operator new[](std::size_t n, const std::nothrow_t &) noexcept { return ::operator new(n, std::nothrow); }
+RECALC_OUT_OF_LINE void operator delete(void *p) noexcept { std::free(p); }
+RECALC_OUT_OF_LINE void operator delete[](void *p) noexcept { std::free(p); }
+RECALC_OUT_OF_LINE void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+RECALC_OUT_OF_LINE void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+RECALC_OUT_OF_LINE void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+RECALC_OUT_OF_LINE void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
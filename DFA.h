@@ -0,0 +1,462 @@
+#pragma once
+#include "NFA.h"
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <iterator>
+#include <array>
+
+// Set-of-states view of a ThompsonNFA used by the DFA builders: edges are
+// flattened into per-state arrays and a state set is a sorted vector of ids,
+// so equal sets compare equal and can key a map. Moves are labelled with
+// byte classes (ThompsonNFA::byteClasses), not bytes. Counted repetitions
+// are unrolled (ThompsonNFA::buildExpanded): a DFA can't count.
+class NFAStepper {
+    std::vector<std::vector<int>> eps;                   // epsilon edges per NFA state
+    std::vector<std::vector<std::pair<int, int>>> moves; // (class, target) edges per NFA state
+    std::vector<uint32_t> mark;
+    uint32_t markGen = 0;
+    std::vector<int> scratch;
+    std::vector<int> patternOf; // pattern id of each accept state, -1 elsewhere
+public:
+    std::vector<int> startSet; // closure of the start state, empty if there is no NFA
+    ByteClasses classes;
+
+    explicit NFAStepper(const ThompsonNFA &nfa) {
+        if (!nfa.hasCounters()) { init(nfa); return; }
+        ThompsonNFA plain;
+        plain.buildExpanded(nfa);
+        init(plain);
+    }
+
+private:
+    void init(const ThompsonNFA &nfa) {
+        classes = nfa.byteClasses();
+        size_t n = nfa.stateCount();
+        eps.resize(n);
+        moves.resize(n);
+        mark.assign(n, 0);
+        patternOf.assign(n, -1);
+        for (size_t i = 0; i < n; ++i) {
+            const NState *st = nfa.state((int)i);
+            if (st->accept) patternOf[i] = st->pattern;
+            for (auto &kv : st->trans) {
+                for (auto *t : kv.second) {
+                    if (kv.first == 0) eps[i].push_back(t->id);
+                    else moves[i].push_back({classes.classOf[(unsigned char)kv.first], t->id});
+                }
+            }
+            // classes never straddle a range, so a class is inside iff its first byte is
+            for (auto &r : st->ranges)
+                for (int k = 0; k < classes.count; ++k)
+                    if (classes.representative[k] >= r.lo && classes.representative[k] <= r.hi) moves[i].push_back({k, r.to->id});
+        }
+        if (nfa.start) closure({nfa.start->id}, startSet);
+    }
+
+public:
+    const std::vector<std::pair<int, int>> &movesOf(int s) const { return moves[s]; }
+    bool accepts(const std::vector<int> &set) const {
+        for (int s : set) if (patternOf[s] >= 0) return true;
+        return false;
+    }
+
+    // sorted ids of the patterns accepted by set
+    void patternsOf(const std::vector<int> &set, std::vector<int> &out) const {
+        out.clear();
+        for (int s : set) if (patternOf[s] >= 0) out.push_back(patternOf[s]);
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+
+    // epsilon-closure of seed into out
+    void closure(const std::vector<int> &seed, std::vector<int> &out) {
+        out.clear();
+        if (++markGen == 0) { std::fill(mark.begin(), mark.end(), 0); markGen = 1; }
+        uint32_t g = markGen;
+        std::vector<int> &st = scratch;
+        st.clear();
+        for (int s : seed) if (mark[s] != g) { mark[s] = g; st.push_back(s); }
+        while (!st.empty()) {
+            int cur = st.back(); st.pop_back();
+            out.push_back(cur);
+            for (int t : eps[cur]) if (mark[t] != g) { mark[t] = g; st.push_back(t); }
+        }
+        std::sort(out.begin(), out.end());
+    }
+
+    // one step on any byte of class cls
+    void step(const std::vector<int> &cur, int cls, std::vector<int> &out) {
+        std::vector<int> moved;
+        for (int s : cur)
+            for (auto &m : moves[s]) if (m.first == cls) moved.push_back(m.second);
+        closure(moved, out);
+    }
+};
+
+// Lazy DFA over a ThompsonNFA (on-the-fly subset construction).
+// Every set of NFA states reached while matching becomes a cached DFA state
+// with a transition row of one entry per byte class. Rows are filled one entry at a time, the
+// first time a byte is read in that state, so a warm cache matches with one
+// table load per input byte. The cache is capped by a memory budget: when it
+// is full it is flushed and rebuilt from the current state, and if it keeps
+// thrashing we give up on caching and step the NFA sets directly.
+// Accept/reject is the same as ThompsonNFA::simulate, without any tracing.
+// The cache is mutable, so one LazyDFA must not be shared between threads.
+class LazyDFA {
+public:
+    static constexpr int UNKNOWN = -1; // row entry not computed yet
+    static constexpr int DEAD = 0;     // empty state set, can never accept
+
+    struct Stats {
+        size_t statesBuilt = 0;   // DFA states created (across flushes)
+        size_t cacheFlushes = 0;  // times the cache hit the memory budget
+        size_t nfaFallbacks = 0;  // matches finished by plain NFA stepping
+    };
+    Stats stats;
+
+    explicit LazyDFA(const ThompsonNFA &nfa, size_t memoryBudget = 1 << 20)
+        : nfa(nfa), stride((size_t)this->nfa.classes.count), budget(memoryBudget) { reset(); }
+
+    bool matches(const std::string &s) { return matches(s.data(), s.size()); }
+
+    bool matches(const char *p, size_t n) {
+        if (nfa.startSet.empty()) return false;
+        int cur = startState();
+        bytesSinceFlush = 0;
+        for (size_t i = 0; i < n; ++i) {
+            int cls = nfa.classes.classOf[(unsigned char)p[i]];
+            int nxt = table[(size_t)cur * stride + cls];
+            if (nxt == UNKNOWN) {
+                nxt = fillTransition(cur, cls);
+                if (nxt == UNKNOWN) return finishOnNFA(sets[cur], p + i, n - i);
+            }
+            if (nxt == DEAD) return false;
+            cur = nxt;
+            bytesSinceFlush++;
+        }
+        return accepting[cur] != 0;
+    }
+
+    size_t cachedStates() const { return sets.size(); }
+    size_t memoryUsed() const { return used; }
+
+    // Drop every cached state (the NFA tables are kept)
+    void reset() {
+        sets.clear();
+        accepting.clear();
+        table.clear();
+        index.clear();
+        used = 0;
+        startId = UNKNOWN;
+        addState({}); // DEAD
+    }
+
+private:
+    // A cache that flushes this often and builds a state every few bytes is
+    // doing more subset construction than matching; stop caching then.
+    static constexpr size_t MIN_FLUSHES_BEFORE_BAILOUT = 3;
+    static constexpr size_t MIN_BYTES_PER_STATE = 10;
+
+    NFAStepper nfa;
+
+    std::vector<std::vector<int>> sets;  // NFA state set of each DFA state
+    std::vector<char> accepting;
+    size_t stride;                       // byte classes, the length of a row
+    std::vector<int> table;              // sets.size() rows of stride entries
+    std::map<std::vector<int>, int> index;
+    int startId = UNKNOWN;
+    size_t budget;
+    size_t used = 0;
+    size_t bytesSinceFlush = 0;
+    size_t statesSinceFlush = 0;
+    size_t flushesThisMatch = 0;
+
+    size_t stateCost(const std::vector<int> &set) const {
+        return stride * sizeof(int) + set.size() * sizeof(int) + sizeof(std::vector<int>) + 64;
+    }
+
+    int addState(const std::vector<int> &set) {
+        int id = (int)sets.size();
+        sets.push_back(set);
+        accepting.push_back(nfa.accepts(set) ? 1 : 0);
+        table.insert(table.end(), stride, UNKNOWN);
+        index.emplace(set, id);
+        used += stateCost(set);
+        if (id != DEAD) { stats.statesBuilt++; statesSinceFlush++; }
+        return id;
+    }
+
+    int findOrAdd(const std::vector<int> &set) {
+        if (set.empty()) return DEAD;
+        auto it = index.find(set);
+        return it != index.end() ? it->second : addState(set);
+    }
+
+    int startState() {
+        flushesThisMatch = 0;
+        if (startId == UNKNOWN) startId = findOrAdd(nfa.startSet);
+        return startId;
+    }
+
+    // Compute and cache the transition of state cur on class cls. Returns the
+    // target (ids may change if the cache was flushed to make room), or
+    // UNKNOWN when the cache is thrashing and the caller should fall back to
+    // the NFA.
+    int fillTransition(int cur, int cls) {
+        std::vector<int> target;
+        nfa.step(sets[cur], cls, target);
+        if (target.empty()) { table[(size_t)cur * stride + cls] = DEAD; return DEAD; }
+        auto it = index.find(target);
+        if (it != index.end()) { table[(size_t)cur * stride + cls] = it->second; return it->second; }
+        if (used + stateCost(target) > budget && sets.size() > 1) {
+            bool thrashing = flushesThisMatch >= MIN_FLUSHES_BEFORE_BAILOUT &&
+                             bytesSinceFlush < MIN_BYTES_PER_STATE * std::max<size_t>(statesSinceFlush, 1);
+            if (thrashing) return UNKNOWN;
+            reset();
+            stats.cacheFlushes++;
+            flushesThisMatch++;
+            bytesSinceFlush = 0;
+            statesSinceFlush = 0;
+            return addState(target);
+        }
+        int id = addState(target);
+        table[(size_t)cur * stride + cls] = id;
+        return id;
+    }
+
+    bool finishOnNFA(std::vector<int> cur, const char *p, size_t n) {
+        stats.nfaFallbacks++;
+        std::vector<int> nxt;
+        for (size_t i = 0; i < n; ++i) {
+            nfa.step(cur, nfa.classes.classOf[(unsigned char)p[i]], nxt);
+            if (nxt.empty()) return false;
+            cur.swap(nxt);
+        }
+        return nfa.accepts(cur);
+    }
+};
+
+// Non-owning view of DFA tables, laid out as in DFA: a built DFA (DFA::view)
+// or one mapped straight from a compiled automaton file (AutomatonFile.h)
+struct DFAView {
+    const int32_t *table = nullptr;
+    const uint8_t *byteClass = nullptr;
+    const uint8_t *accept = nullptr;
+    int32_t start = 0;
+    int numStates = 0;
+    int numClasses = 1;
+
+    constexpr bool matches(const char *p, size_t n) const {
+        const size_t k = (size_t)numClasses;
+        int32_t s = start;
+        for (size_t i = 0; i < n; ++i) s = table[(size_t)s * k + byteClass[(unsigned char)p[i]]];
+        return accept[s] != 0;
+    }
+    bool matches(const std::string &s) const { return matches(s.data(), s.size()); }
+    constexpr int32_t next(int32_t s, unsigned char b) const { return table[(size_t)s * numClasses + byteClass[b]]; }
+};
+
+// Dense, fully built DFA: state x byte class -> state, with state 0 the dead
+// state (every row entry points back to it, nothing accepts). A row has one
+// entry per byte class, so a pattern over a few distinct bytes gets a table
+// a few entries wide instead of 256. Immutable once built.
+struct DFA {
+    static constexpr int DEAD = 0;
+
+    int start = DEAD;
+    int numStates = 0;
+    int numClasses = 1;                   // row length
+    std::array<uint8_t, 256> byteClass{}; // column of each byte
+    std::vector<int32_t> table;   // numStates rows of numClasses entries
+    std::vector<uint8_t> accept;  // 1 if the state is accepting
+    std::vector<std::vector<int>> patterns; // ids of the patterns each state accepts
+    int statesBeforeMinimization = 0;
+
+    // One table load per byte and no early exit: the dead state just absorbs
+    // the rest of the input.
+    bool matches(const char *p, size_t n) const {
+        const int32_t *t = table.data();
+        const uint8_t *cls = byteClass.data();
+        size_t k = (size_t)numClasses;
+        int32_t s = start;
+        for (size_t i = 0; i < n; ++i) s = t[(size_t)s * k + cls[(unsigned char)p[i]]];
+        return accept[s] != 0;
+    }
+    int32_t next(int32_t s, unsigned char b) const { return table[(size_t)s * numClasses + byteClass[b]]; }
+    size_t tableBytes() const { return table.size() * sizeof(int32_t); }
+    DFAView view() const { return DFAView{table.data(), byteClass.data(), accept.data(), start, numStates, numClasses}; }
+    bool matches(const std::string &s) const { return matches(s.data(), s.size()); }
+};
+
+// Hopcroft's partition refinement. Returns the minimal DFA equivalent to dfa,
+// keeping the dead state as state 0.
+inline DFA minimizeDFA(const DFA &dfa) {
+    int n = dfa.numStates, K = dfa.numClasses;
+    // predecessors: pred[c] lists, for every target, the states that go there on c
+    std::vector<std::vector<int>> predStart(K, std::vector<int>(n + 1, 0));
+    std::vector<std::vector<int>> predList(K, std::vector<int>(n));
+    for (int c = 0; c < K; ++c) {
+        std::vector<int> &ps = predStart[c];
+        for (int q = 0; q < n; ++q) ps[dfa.table[(size_t)q * K + c] + 1]++;
+        for (int q = 0; q < n; ++q) ps[q + 1] += ps[q];
+        std::vector<int> fill(ps.begin(), ps.end() - 1);
+        for (int q = 0; q < n; ++q) predList[c][fill[dfa.table[(size_t)q * K + c]]++] = q;
+    }
+
+    // partition: elems grouped by block, each block is [first[b], end[b])
+    std::vector<int> elems(n), loc(n), blk(n), first, end, marked;
+    std::vector<char> inWork;
+    std::vector<int> work;
+    {
+        // states accepting different patterns are never equivalent
+        std::map<std::vector<int>, std::vector<int>> groups;
+        for (int q = 0; q < n; ++q) groups[dfa.patterns[q]].push_back(q);
+        int k = 0;
+        for (auto &g : groups) {
+            int b = (int)first.size();
+            first.push_back(k);
+            for (int q : g.second) { elems[k] = q; loc[q] = k; blk[q] = b; k++; }
+            end.push_back(k); marked.push_back(0);
+            inWork.push_back(1); work.push_back(b);
+        }
+    }
+
+    std::vector<int> splitter, touched;
+    while (!work.empty()) {
+        int a = work.back(); work.pop_back();
+        inWork[a] = 0;
+        splitter.assign(elems.begin() + first[a], elems.begin() + end[a]);
+        for (int c = 0; c < K; ++c) {
+            touched.clear();
+            for (int t : splitter) {
+                for (int i = predStart[c][t]; i < predStart[c][t + 1]; ++i) {
+                    int q = predList[c][i], b = blk[q];
+                    if (marked[b] == 0) touched.push_back(b);
+                    // move q into the marked prefix of its block
+                    int pos = first[b] + marked[b]++;
+                    int other = elems[pos];
+                    elems[loc[q]] = other; loc[other] = loc[q];
+                    elems[pos] = q; loc[q] = pos;
+                }
+            }
+            for (int b : touched) {
+                int m = marked[b];
+                marked[b] = 0;
+                if (m == end[b] - first[b]) continue;
+                // the marked prefix becomes a new block
+                int nb = (int)first.size();
+                first.push_back(first[b]); end.push_back(first[b] + m); marked.push_back(0);
+                first[b] += m;
+                for (int i = first[nb]; i < end[nb]; ++i) blk[elems[i]] = nb;
+                if (inWork[b]) { inWork.push_back(1); work.push_back(nb); }
+                else {
+                    int smaller = (end[nb] - first[nb] <= end[b] - first[b]) ? nb : b;
+                    inWork.push_back(0);
+                    inWork[smaller] = 1; work.push_back(smaller);
+                }
+            }
+        }
+    }
+
+    // number blocks so the dead state's block is 0
+    int numBlocks = (int)first.size();
+    std::vector<int> id(numBlocks, -1);
+    int next = 0;
+    id[blk[DFA::DEAD]] = next++;
+    for (int b = 0; b < numBlocks; ++b) if (id[b] < 0) id[b] = next++;
+
+    DFA out;
+    out.numStates = numBlocks;
+    out.statesBeforeMinimization = dfa.statesBeforeMinimization;
+    out.start = id[blk[dfa.start]];
+    out.accept.assign(numBlocks, 0);
+    out.patterns.resize(numBlocks);
+    std::vector<int32_t> cols((size_t)numBlocks * K); // column-major
+    for (int b = 0; b < numBlocks; ++b) {
+        int q = elems[first[b]], nb = id[b];
+        out.accept[nb] = dfa.accept[q];
+        out.patterns[nb] = dfa.patterns[q];
+        for (int c = 0; c < K; ++c) cols[(size_t)c * numBlocks + nb] = id[blk[dfa.table[(size_t)q * K + c]]];
+    }
+    // merged states can leave classes that now lead to the same places:
+    // keep one column for each distinct one
+    std::map<std::vector<int32_t>, int> colIndex;
+    std::vector<int> colOf(K);
+    for (int c = 0; c < K; ++c) {
+        std::vector<int32_t> col(cols.begin() + (std::ptrdiff_t)c * numBlocks, cols.begin() + (std::ptrdiff_t)(c + 1) * numBlocks);
+        colOf[c] = colIndex.emplace(col, (int)colIndex.size()).first->second;
+    }
+    out.numClasses = (int)colIndex.size();
+    for (int b = 0; b < 256; ++b) out.byteClass[b] = (uint8_t)colOf[dfa.byteClass[b]];
+    out.table.assign((size_t)numBlocks * out.numClasses, DFA::DEAD);
+    for (int c = 0; c < K; ++c)
+        for (int q = 0; q < numBlocks; ++q) out.table[(size_t)q * out.numClasses + colOf[c]] = cols[(size_t)c * numBlocks + q];
+    return out;
+}
+
+// Ahead-of-time subset construction over the whole NFA followed by Hopcroft
+// minimization. Throws instead of building more than maxStates DFA states,
+// since the subset construction can blow up exponentially.
+// With unanchored set the start state is re-entered before every byte, so a
+// state accepts when some match ends at the current position (search mode).
+inline DFA compileDFA(const ThompsonNFA &nfa, size_t maxStates = 10000, bool unanchored = false) {
+    NFAStepper stepper(nfa);
+    DFA dfa;
+    std::vector<std::vector<int>> sets{{}}; // DEAD
+    std::map<std::vector<int>, int> index;
+    auto add = [&](const std::vector<int> &set) {
+        if (set.empty()) return (int)DFA::DEAD;
+        auto it = index.find(set);
+        if (it != index.end()) return it->second;
+        if (sets.size() >= maxStates)
+            throw std::runtime_error("DFA state limit exceeded (" + std::to_string(maxStates) + " states)");
+        int id = (int)sets.size();
+        sets.push_back(set);
+        index.emplace(set, id);
+        return id;
+    };
+    dfa.start = add(stepper.startSet);
+    const int K = stepper.classes.count;
+    dfa.numClasses = K;
+    dfa.byteClass = stepper.classes.classOf;
+
+    // classes that actually leave a set are gathered per class; all others go to DEAD
+    std::vector<std::vector<int>> moved(K);
+    std::vector<int> used;
+    std::vector<int> target;
+    std::vector<int> merged;
+    for (size_t q = 0; q < sets.size(); ++q) {
+        dfa.table.insert(dfa.table.end(), K, unanchored && q != DFA::DEAD ? dfa.start : DFA::DEAD);
+        used.clear();
+        for (int s : sets[q]) {
+            for (auto &m : stepper.movesOf(s)) {
+                if (moved[m.first].empty()) used.push_back(m.first);
+                moved[m.first].push_back(m.second);
+            }
+        }
+        for (int c : used) {
+            stepper.closure(moved[c], target);
+            moved[c].clear();
+            if (unanchored) {
+                merged.clear();
+                std::set_union(target.begin(), target.end(), stepper.startSet.begin(), stepper.startSet.end(), std::back_inserter(merged));
+                target.swap(merged);
+            }
+            int t = add(target);
+            dfa.table[q * K + c] = t;
+        }
+    }
+    dfa.numStates = (int)sets.size();
+    dfa.accept.resize(sets.size());
+    dfa.patterns.resize(sets.size());
+    for (size_t q = 0; q < sets.size(); ++q) {
+        stepper.patternsOf(sets[q], dfa.patterns[q]);
+        dfa.accept[q] = dfa.patterns[q].empty() ? 0 : 1;
+    }
+    dfa.statesBeforeMinimization = (int)sets.size();
+    return minimizeDFA(dfa);
+}
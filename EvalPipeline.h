@@ -0,0 +1,241 @@
+#pragma once
+#include "Parser.h"
+#include "Bytecode.h"
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <istream>
+#include <ostream>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+// FIFO with a fixed capacity shared by one producer and one consumer thread.
+// push() blocks while the queue is full, so a fast stage can't run ahead of
+// a slow one by more than capacity items; pop() blocks until an item arrives
+// or the producer has called close().
+template <class T>
+class BoundedQueue {
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    std::mutex m;
+    std::condition_variable notFull, notEmpty;
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity ? capacity : 1) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lk(m);
+        notFull.wait(lk, [this] { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    // false once the queue is closed and drained
+    bool pop(T &out) {
+        std::unique_lock<std::mutex> lk(m);
+        notEmpty.wait(lk, [this] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        out = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lk(m);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
+
+struct EvalOptions {
+    size_t batchLines = 4096; // lines handed from stage to stage at once
+    size_t queueBatches = 4;  // batches each queue holds before its producer waits
+    int precision = 17;       // significant digits printed (17 round-trips a double)
+    size_t maxLineBytes = 16 << 20; // longer lines give "error: Line too long" (capped at 2 GiB)
+};
+
+struct EvalSummary {
+    uint64_t lines = 0;
+    uint64_t errors = 0;
+};
+
+// Evaluates one expression per input line and writes one output line per
+// input line, in input order: the value, an empty line for a blank input
+// line, or "error: <message>" for a line that fails. Runs as a pipeline of
+// threads joined by bounded queues:
+//   read/split -> scan (ExprScanner) -> parse+compile (ArenaParser) -> evaluate+format (StackVM) -> write
+// Each stage is one thread and each queue is FIFO, so batches come out in the
+// order they went in without any reordering buffer.
+class EvalPipeline {
+    struct Line {
+        uint32_t begin = 0, end = 0;        // text range, then token range after scanning
+        std::string error;                  // set by the stage that failed
+        Bytecode program;
+        bool blank = false;
+    };
+    struct Batch {
+        std::string text;
+        std::vector<Line> lines;
+        std::vector<TokenView> tokens;
+        std::string output;
+    };
+    using BatchPtr = std::unique_ptr<Batch>;
+
+    EvalOptions opt;
+
+public:
+    explicit EvalPipeline(EvalOptions options = EvalOptions()) : opt(options) {}
+
+    EvalSummary run(std::istream &in, std::ostream &out) {
+        BoundedQueue<BatchPtr> toScan(opt.queueBatches), toParse(opt.queueBatches), toEval(opt.queueBatches), toWrite(opt.queueBatches);
+        std::thread reader([&] { readStage(in, toScan); });
+        std::thread scanner([&] { stage(toScan, toParse, [this](Batch &b) { scan(b); }); });
+        std::thread parser([&] {
+            ArenaParser p; // one arena for the whole stream, rewound per line
+            stage(toParse, toEval, [&](Batch &b) { parse(b, p); });
+        });
+        std::thread evaluator([&] {
+            StackVM vm;
+            stage(toEval, toWrite, [&](Batch &b) { evaluate(b, vm); });
+        });
+        EvalSummary sum;
+        BatchPtr b;
+        while (toWrite.pop(b)) {
+            out.write(b->output.data(), (std::streamsize)b->output.size());
+            sum.lines += b->lines.size();
+            for (const Line &l : b->lines) if (!l.error.empty()) sum.errors++;
+        }
+        out.flush();
+        reader.join();
+        scanner.join();
+        parser.join();
+        evaluator.join();
+        return sum;
+    }
+
+private:
+    template <class F>
+    static void stage(BoundedQueue<BatchPtr> &from, BoundedQueue<BatchPtr> &to, F &&work) {
+        BatchPtr b;
+        while (from.pop(b)) {
+            work(*b);
+            to.push(std::move(b));
+        }
+        to.close();
+    }
+
+    // Reads big blocks and cuts them into batches of whole lines; the partial
+    // last line of a block is carried into the next batch. Lines past
+    // maxLineBytes are dropped as they are read, and a batch is passed on
+    // before its text reaches 1 GiB, so offsets fit in 32 bits.
+    void readStage(std::istream &in, BoundedQueue<BatchPtr> &to) {
+        const size_t BLOCK = 1 << 16, BATCH_TEXT = (size_t)1 << 30;
+        const size_t maxLine = std::min(opt.maxLineBytes, (size_t)1 << 31);
+        std::string carry;
+        bool tooLong = false; // the line being carried is over maxLine
+        BatchPtr b = std::make_unique<Batch>();
+        auto flush = [&] {
+            if (b->lines.empty()) return;
+            to.push(std::move(b));
+            b = std::make_unique<Batch>();
+        };
+        auto endLine = [&](const char *p, size_t n) {
+            if (tooLong || carry.size() + n > maxLine) addTooLong(*b, carry);
+            else addLine(*b, carry, p, n);
+            tooLong = false;
+            if (b->lines.size() == opt.batchLines || b->text.size() >= BATCH_TEXT) flush();
+        };
+        std::vector<char> buf(BLOCK);
+        while (in) {
+            in.read(buf.data(), (std::streamsize)buf.size());
+            size_t got = (size_t)in.gcount();
+            if (got == 0) break;
+            size_t start = 0;
+            for (size_t i = 0; i < got; ++i) {
+                if (buf[i] != '\n') continue;
+                endLine(buf.data() + start, i - start);
+                start = i + 1;
+            }
+            if (!tooLong && carry.size() + (got - start) > maxLine) {
+                tooLong = true;
+                std::string().swap(carry);
+            }
+            if (!tooLong) carry.append(buf.data() + start, got - start);
+        }
+        if (tooLong || !carry.empty()) endLine(nullptr, 0);
+        flush();
+        to.close();
+    }
+
+    static void addTooLong(Batch &b, std::string &carry) {
+        Line l;
+        l.begin = l.end = (uint32_t)b.text.size();
+        l.error = "Line too long";
+        b.lines.push_back(std::move(l));
+        std::string().swap(carry);
+    }
+
+    static void addLine(Batch &b, std::string &carry, const char *p, size_t n) {
+        Line l;
+        l.begin = (uint32_t)b.text.size();
+        b.text += carry;
+        b.text.append(p, n);
+        carry.clear();
+        if (b.text.size() > l.begin && b.text.back() == '\r') b.text.pop_back(); // CRLF input
+        l.end = (uint32_t)b.text.size();
+        b.lines.push_back(std::move(l));
+    }
+
+    static void scan(Batch &b) {
+        ExprScanner sc;
+        std::string_view text(b.text);
+        for (Line &l : b.lines) {
+            sc.reset(text.substr(l.begin, l.end - l.begin));
+            uint32_t first = (uint32_t)b.tokens.size();
+            try {
+                for (TokenView t = sc.next(); t.type != TOK_END; t = sc.next()) {
+                    if (t.type == TOK_INVALID) throw std::runtime_error("Invalid character '" + std::string(t.text) + "' at " + std::to_string(t.pos));
+                    b.tokens.push_back(t);
+                }
+            } catch (const std::exception &ex) {
+                l.error = ex.what();
+                b.tokens.resize(first);
+            }
+            l.blank = l.error.empty() && b.tokens.size() == first;
+            l.begin = first;
+            l.end = (uint32_t)b.tokens.size();
+        }
+    }
+
+    static void parse(Batch &b, ArenaParser &p) {
+        for (Line &l : b.lines) {
+            if (!l.error.empty() || l.blank) continue;
+            try {
+                const ASTNode *ast = p.parse(b.tokens.data() + l.begin, l.end - l.begin);
+                if (!p.consumedAll()) throw std::runtime_error("Unexpected input after expression");
+                l.program = compileBytecode(ast);
+                if (!l.program.variables.empty()) throw std::runtime_error("Unknown variable: " + l.program.variables[0]);
+            } catch (const std::exception &ex) {
+                l.error = ex.what();
+            }
+        }
+    }
+
+    void evaluate(Batch &b, StackVM &vm) const {
+        char num[64];
+        for (const Line &l : b.lines) {
+            if (!l.error.empty()) b.output += "error: " + l.error;
+            else if (!l.blank) {
+                int n = std::snprintf(num, sizeof num, "%.*g", opt.precision, vm.run(l.program));
+                b.output.append(num, (size_t)n);
+            }
+            b.output += '\n';
+        }
+    }
+};
@@ -0,0 +1,172 @@
+#pragma once
+#include "NFA.h"
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+// Compiled ThompsonNFA: states become a contiguous array of instructions that
+// refer to each other by index instead of by pointer.
+enum NOp : uint8_t {
+    OP_CHAR,   // consume byte c, continue at x
+    OP_RANGE,  // consume a byte in [c, y], continue at x
+    OP_SPLIT,  // continue at both x and y (epsilon fork)
+    OP_EPS,    // continue at x (single epsilon edge)
+    OP_MATCH,  // accepting state, x is the pattern id
+    OP_FAIL    // state with no way out
+};
+
+struct NInst {
+    NOp op;
+    unsigned char c;
+    int x, y;
+
+    // true if this is a CHAR or RANGE instruction that reads b
+    bool consumes(unsigned char b) const { return op == OP_CHAR ? c == b : op == OP_RANGE && b >= c && b <= y; }
+};
+
+struct FlatNFA {
+    std::vector<NInst> insts;
+    int start = -1;
+
+    FlatNFA() = default;
+    explicit FlatNFA(const ThompsonNFA &nfa) { compile(nfa); }
+
+    // Instruction i is NFA state q<i>. States whose edges don't fit one
+    // instruction (mixed symbols and epsilons, more than two epsilons, a
+    // class of several ranges) get a chain of extra SPLIT/CHAR/RANGE/MATCH
+    // instructions appended after the states.
+    // Counted repetitions are unrolled first (ThompsonNFA::buildExpanded).
+    void compile(const ThompsonNFA &nfa) {
+        if (nfa.hasCounters()) {
+            ThompsonNFA plain;
+            plain.buildExpanded(nfa);
+            compile(plain);
+            return;
+        }
+        insts.assign(nfa.stateCount(), NInst{OP_FAIL, 0, -1, -1});
+        start = nfa.start ? nfa.start->id : -1;
+        for (size_t i = 0; i < nfa.stateCount(); ++i) {
+            const NState *st = nfa.state((int)i);
+            std::vector<NInst> branches;
+            if (st->accept) branches.push_back({OP_MATCH, 0, st->pattern, -1});
+            for (auto &kv : st->trans)
+                for (auto *t : kv.second)
+                    branches.push_back(kv.first == 0 ? NInst{OP_EPS, 0, t->id, -1} : NInst{OP_CHAR, (unsigned char)kv.first, t->id, -1});
+            for (auto &r : st->ranges) branches.push_back(NInst{OP_RANGE, r.lo, r.to->id, r.hi});
+            if (branches.size() == 1) { insts[i] = branches[0]; continue; }
+            if (branches.empty()) continue;
+            // SPLIT chain, one leg per branch
+            std::vector<int> legs;
+            for (auto &b : branches) legs.push_back(b.op == OP_EPS ? b.x : emit(b));
+            int at = (int)i;
+            for (size_t b = 0; b + 2 < legs.size(); ++b) {
+                int rest = emit({OP_FAIL, 0, -1, -1});
+                insts[at] = {OP_SPLIT, 0, legs[b], rest};
+                at = rest;
+            }
+            insts[at] = {OP_SPLIT, 0, legs[legs.size() - 2], legs.back()};
+        }
+    }
+
+    size_t size() const { return insts.size(); }
+
+private:
+    int emit(const NInst &in) { insts.push_back(in); return (int)insts.size() - 1; }
+};
+
+// Sparse set over [0, capacity): O(1) insert, membership test and clear, with
+// the members kept densely packed for iteration (Briggs & Torczon).
+class SparseSet {
+    std::vector<int> dense, sparse;
+    size_t n = 0;
+public:
+    explicit SparseSet(size_t capacity = 0) : dense(capacity), sparse(capacity) {}
+    // Empties the set and makes room for [0, capacity); never shrinks
+    void reserve(size_t capacity) {
+        n = 0;
+        if (dense.size() < capacity) { dense.resize(capacity); sparse.resize(capacity); }
+    }
+    bool contains(int i) const { size_t s = (size_t)sparse[i]; return s < n && dense[s] == i; }
+    void insert(int i) { sparse[i] = (int)n; dense[n++] = i; }
+    void clear() { n = 0; }
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+    const int *begin() const { return dense.data(); }
+    const int *end() const { return dense.data() + n; }
+};
+
+// Pike-VM style simulation of a FlatNFA. All scratch space is allocated up
+// front, so matching does no allocation and at most O(states) work per byte.
+// Keep one PikeVM per thread; the FlatNFA itself is only read.
+class PikeVM {
+    const NInst *code = nullptr;
+    int start = -1;
+    SparseSet clist, nlist;
+    std::vector<int> stack;
+public:
+    PikeVM() = default;
+    explicit PikeVM(const FlatNFA &p) : PikeVM(p.insts.data(), p.size(), p.start) {}
+    // Instructions held elsewhere, e.g. mapped from a compiled automaton file
+    PikeVM(const NInst *insts, size_t count, int startPc) { reset(insts, count, startPc); }
+
+    // Runs another program, keeping the scratch when it is already big enough
+    void reset(const FlatNFA &p) { reset(p.insts.data(), p.size(), p.start); }
+    void reset(const NInst *insts, size_t count, int startPc) {
+        code = insts;
+        start = startPc;
+        clist.reserve(count);
+        nlist.reserve(count);
+        if (stack.size() < 2 * count + 1) stack.resize(2 * count + 1);
+    }
+
+    bool matches(const std::string &s) { return matches(s.data(), s.size()); }
+
+    bool matches(const char *p, size_t n) {
+        if (!run(p, n)) return false;
+        for (int pc : clist) if (code[pc].op == OP_MATCH) return true;
+        return false;
+    }
+
+    // Ids of every pattern that matches p[0, n), for NFAs built from a set
+    void matchSet(const char *p, size_t n, std::vector<int> &ids) {
+        ids.clear();
+        if (!run(p, n)) return;
+        for (int pc : clist) if (code[pc].op == OP_MATCH) ids.push_back(code[pc].x);
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    }
+
+private:
+    // Leaves the threads alive after p[0, n) in clist; false once none are
+    bool run(const char *p, size_t n) {
+        clist.clear();
+        if (start < 0) return false;
+        addThread(clist, start);
+        for (size_t i = 0; i < n; ++i) {
+            unsigned char b = (unsigned char)p[i];
+            nlist.clear();
+            for (int pc : clist) {
+                const NInst &in = code[pc];
+                if (in.consumes(b)) addThread(nlist, in.x);
+            }
+            std::swap(clist, nlist);
+            if (clist.empty()) return false;
+        }
+        return true;
+    }
+
+    // follow epsilon edges from pc, adding every reached instruction to set
+    void addThread(SparseSet &set, int pc) {
+        size_t sp = 0;
+        stack[sp++] = pc;
+        while (sp) {
+            int cur = stack[--sp];
+            if (set.contains(cur)) continue;
+            set.insert(cur);
+            const NInst &in = code[cur];
+            if (in.op == OP_EPS) stack[sp++] = in.x;
+            else if (in.op == OP_SPLIT) { stack[sp++] = in.y; stack[sp++] = in.x; }
+        }
+    }
+};
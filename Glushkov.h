@@ -0,0 +1,189 @@
+#pragma once
+#include "NFA.h"
+#include <vector>
+#include <string>
+#include <stack>
+#include <array>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+
+// Glushkov (position) automaton of a regex: one state per symbol occurrence
+// (a byte or a whole character class) in the pattern, plus an initial state, and no epsilon edges. Built straight
+// from the postfix form with the usual nullable/first/last/follow rules.
+// Bit 0 stands for the initial state and bit i for position i, so follow[0]
+// is the first set and every state set is a plain bit vector.
+struct GlushkovAutomaton {
+    int positions = 0;                      // symbol occurrences in the pattern
+    std::vector<std::vector<bool>> follow;  // follow[i]: states reachable after state i
+    std::vector<std::vector<bool>> symbol;  // symbol[c][i]: position i reads byte c
+    std::vector<bool> accepting;            // last positions, plus 0 if nullable
+    bool valid = false;                     // false for the empty pattern
+
+    // symbol occurrences in a postfix regex, counted repetitions unrolled,
+    // without building anything (saturates at INT_MAX)
+    static int countPositions(const std::string &postfix) {
+        std::stack<long long> st; // positions of each operand
+        PostfixReader reader(postfix);
+        char op;
+        CharClass atom;
+        auto cap = [](long long v) { return std::min(v, (long long)INT_MAX); };
+        while (reader.next(op, atom)) {
+            if (!op) st.push(1);
+            else if (op == '.' || op == '|') { long long b = st.top(); st.pop(); st.top() = cap(st.top() + b); }
+            else if (op == '{') st.top() = cap(st.top() * copies(reader.repeatMin, reader.repeatMax));
+        }
+        return st.empty() ? 0 : (int)st.top();
+    }
+
+    explicit GlushkovAutomaton(const std::string &postfix) : positions(countPositions(postfix)) {
+        int n = positions + 1;
+        follow.assign(n, std::vector<bool>(n, false));
+        symbol.assign(256, std::vector<bool>(n, false));
+        accepting.assign(n, false);
+
+        // lo: a fragment's positions are lo up to the newest one
+        struct Frag { bool nullable; std::vector<int> first, last; int lo; };
+        std::stack<Frag> st;
+        int next = 1;
+        auto concat = [&](Frag a, const Frag &b) {
+            for (int i : a.last) for (int j : b.first) follow[i][j] = true;
+            Frag r{a.nullable && b.nullable, a.first, b.last, a.lo};
+            if (a.nullable) r.first.insert(r.first.end(), b.first.begin(), b.first.end());
+            if (b.nullable) r.last.insert(r.last.end(), a.last.begin(), a.last.end());
+            return r;
+        };
+        auto loop = [&](const Frag &a) { for (int i : a.last) for (int j : a.first) follow[i][j] = true; };
+        // fresh positions repeating a's, which are a.lo up to end - 1
+        auto clone = [&](const Frag &a, int end) {
+            int shift = next - a.lo;
+            for (int i = a.lo; i < end; ++i) {
+                for (int c = 0; c < 256; ++c) symbol[c][i + shift] = symbol[c][i];
+                for (int j = a.lo; j < end; ++j) follow[i + shift][j + shift] = follow[i][j];
+            }
+            next += end - a.lo;
+            Frag r{a.nullable, a.first, a.last, a.lo + shift};
+            for (int &i : r.first) i += shift;
+            for (int &i : r.last) i += shift;
+            return r;
+        };
+        PostfixReader reader(postfix);
+        char c;
+        CharClass atom;
+        while (reader.next(c, atom)) {
+            if (c == '.') {
+                Frag b = st.top(); st.pop();
+                Frag a = st.top(); st.pop();
+                st.push(concat(a, b));
+            } else if (c == '|') {
+                Frag b = st.top(); st.pop();
+                Frag a = st.top(); st.pop();
+                a.nullable = a.nullable || b.nullable;
+                a.first.insert(a.first.end(), b.first.begin(), b.first.end());
+                a.last.insert(a.last.end(), b.last.begin(), b.last.end());
+                st.push(a);
+            } else if (c == '*' || c == '+') {
+                Frag &a = st.top();
+                loop(a);
+                if (c == '*') a.nullable = true;
+            } else if (c == '?') {
+                st.top().nullable = true;
+            } else if (c == '{') {
+                // a{n,m} = n copies of a, then m - n optional ones (a* without m)
+                Frag a = st.top(); st.pop();
+                int min = reader.repeatMin, max = reader.repeatMax, end = next;
+                std::vector<Frag> parts{a};
+                for (long long i = 1; i < copies(min, max); ++i) parts.push_back(clone(a, end));
+                if (max < 0) loop(parts.back());
+                for (size_t i = (size_t)min; i < parts.size(); ++i) parts[i].nullable = true;
+                Frag r = parts[0];
+                for (size_t i = 1; i < parts.size(); ++i) r = concat(r, parts[i]);
+                st.push(r);
+            } else {
+                int p = next++;
+                for (auto &r : atom.ranges) for (int b = r.lo; b <= r.hi; ++b) symbol[b][p] = true;
+                st.push(Frag{false, {p}, {p}, p});
+            }
+        }
+        if (st.empty()) return;
+        const Frag &top = st.top();
+        valid = true;
+        for (int j : top.first) follow[0][j] = true;
+        for (int i : top.last) accepting[i] = true;
+        if (top.nullable) accepting[0] = true;
+    }
+
+private:
+    // copies of the body that a{min,max} unrolls to
+    static long long copies(int min, int max) { return max >= 0 ? max : std::max(min, 1); }
+};
+
+// Shift-And style bit-parallel simulation of a Glushkov automaton with up to
+// 64*W - 1 positions. A step is D' = Follow(D) & B[c], where Follow(D) is the
+// OR of one precomputed table entry per non-zero byte of D, so matching costs
+// a few word operations per input byte and never allocates.
+template <int W>
+class BitParallelMatcher {
+    using Bits = std::array<uint64_t, W>;
+    static constexpr int CHUNKS = 8 * W; // D is read 8 bits at a time
+
+    std::vector<Bits> followTable; // [chunk * 256 + byte value]
+    std::vector<Bits> byteMask;    // [c]: positions that read c
+    Bits acceptMask{};
+    bool valid = false;
+
+public:
+    static constexpr int MAX_POSITIONS = 64 * W - 1;
+
+    explicit BitParallelMatcher(const GlushkovAutomaton &g) : followTable((size_t)CHUNKS * 256, Bits{}), byteMask(256, Bits{}) {
+        valid = g.valid && g.positions <= MAX_POSITIONS;
+        if (!valid) return;
+        int n = g.positions + 1;
+        for (int i = 0; i < n; ++i) if (g.accepting[i]) set(acceptMask, i);
+        for (int c = 0; c < 256; ++c)
+            for (int i = 1; i < n; ++i) if (g.symbol[c][i]) set(byteMask[c], i);
+        std::vector<Bits> followOf(n, Bits{});
+        for (int i = 0; i < n; ++i)
+            for (int j = 1; j < n; ++j) if (g.follow[i][j]) set(followOf[i], j);
+        for (int k = 0; k < CHUNKS; ++k) {
+            for (int v = 1; v < 256; ++v) {
+                Bits &cell = followTable[(size_t)k * 256 + v];
+                for (int b = 0; b < 8; ++b) {
+                    int i = k * 8 + b;
+                    if ((v >> b & 1) && i < n)
+                        for (int w = 0; w < W; ++w) cell[w] |= followOf[i][w];
+                }
+            }
+        }
+    }
+
+    bool matches(const std::string &s) const { return matches(s.data(), s.size()); }
+
+    bool matches(const char *p, size_t n) const {
+        if (!valid) return false;
+        Bits d{};
+        d[0] = 1; // initial state
+        for (size_t i = 0; i < n; ++i) {
+            Bits f{};
+            for (int w = 0; w < W; ++w) {
+                uint64_t word = d[w];
+                for (int k = w * 8; word; ++k, word >>= 8) {
+                    unsigned v = (unsigned)(word & 0xFF);
+                    if (!v) continue;
+                    const Bits &cell = followTable[(size_t)k * 256 + v];
+                    for (int x = 0; x < W; ++x) f[x] |= cell[x];
+                }
+            }
+            const Bits &m = byteMask[(unsigned char)p[i]];
+            uint64_t any = 0;
+            for (int w = 0; w < W; ++w) { d[w] = f[w] & m[w]; any |= d[w]; }
+            if (!any) return false;
+        }
+        uint64_t hit = 0;
+        for (int w = 0; w < W; ++w) hit |= d[w] & acceptMask[w];
+        return hit != 0;
+    }
+
+private:
+    static void set(Bits &b, int i) { b[i / 64] |= uint64_t(1) << (i % 64); }
+};
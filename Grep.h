@@ -0,0 +1,130 @@
+#pragma once
+#include "DFA.h"
+#include "Prefilter.h"
+#include <cstring>
+#include <cstdint>
+
+// Line-oriented matching over a byte stream that arrives in pieces.
+// All matcher state lives in a small State value, so the input can be fed in
+// chunks of any size (a mapped file in one go, stdin 1 MiB at a time) and the
+// same lines are reported either way. Lines are reported as stream offsets;
+// the caller prints them from its own buffer, nothing is copied here.
+class LineMatcher {
+public:
+    struct State {
+        int32_t dfaState = DFA::DEAD;
+        bool matched = false;     // a match was already found in the current line
+        uint64_t offset = 0;      // bytes consumed so far
+        uint64_t lineStart = 0;   // offset of the first byte of the current line
+        uint64_t lineNumber = 1;
+        PrefilterStats stats;
+    };
+
+    // wholeLine: the entire line must match (anchored DFA, like grep -x).
+    // Otherwise a line matches when any substring does, and dfa must have
+    // been compiled with compileDFA(..., unanchored = true).
+    // literal: a string every match contains (see prefilterLiteral). Lines
+    // without it are skipped by a SIMD search and never reach the DFA.
+    // The DFA's tables are only referenced, so they must outlive the matcher.
+    LineMatcher(const DFA &dfa, bool wholeLine, const std::string &literal = "") : LineMatcher(dfa.view(), wholeLine, literal) {}
+    LineMatcher(const DFAView &dfa, bool wholeLine, const std::string &literal = "")
+        : dfa(dfa), wholeLine(wholeLine), searcher(literal.find('\n') == std::string::npos ? literal : "") {}
+
+    State begin() const {
+        State st;
+        resetLine(st, 0);
+        return st;
+    }
+
+    // Consume p[0, n). onLine(lineStart, lineEnd, lineNumber, matched) is called
+    // for every line completed in this piece; lineEnd excludes the newline.
+    template <class OnLine>
+    void feed(State &st, const char *p, size_t n, OnLine &&onLine) const {
+        const int32_t *t = dfa.table;
+        const uint8_t *cls = dfa.byteClass;
+        const size_t k = (size_t)dfa.numClasses;
+        const uint8_t *acc = dfa.accept;
+        size_t i = 0;
+        while (i < n) {
+            // Result already known for this line: jump to its end
+            if (st.matched || st.dfaState == DFA::DEAD) {
+                const void *nl = std::memchr(p + i, '\n', n - i);
+                if (!nl) break;
+                i = (size_t)((const char *)nl - p);
+                endLine(st, st.offset + i, st.matched, onLine);
+                i++;
+                continue;
+            }
+            if (!searcher.empty() && st.lineStart == st.offset + i) {
+                i = skipToCandidate(st, p, i, n, onLine);
+                if (i == n) break;
+            }
+            int32_t s = st.dfaState;
+            for (; i < n; ++i) {
+                unsigned char b = (unsigned char)p[i];
+                if (b == '\n') break;
+                s = t[(size_t)s * k + cls[b]];
+                if (!wholeLine && acc[s]) { st.matched = true; i++; break; }
+                if (s == DFA::DEAD) { i++; break; }
+            }
+            st.dfaState = s;
+            if (i < n && p[i] == '\n' && !st.matched && s != DFA::DEAD) {
+                endLine(st, st.offset + i, wholeLine && acc[s], onLine);
+                i++;
+            }
+        }
+        st.offset += n;
+    }
+
+    // End of input: report the last line if it had no trailing newline
+    template <class OnLine>
+    void finish(State &st, OnLine &&onLine) const {
+        if (st.lineStart == st.offset) return;
+        bool m = st.matched || (wholeLine && st.dfaState != DFA::DEAD && dfa.accept[st.dfaState]);
+        st.stats.linesVerified++;
+        if (m) st.stats.linesMatched++;
+        onLine(st.lineStart, st.offset, st.lineNumber, m);
+        resetLine(st, st.offset);
+    }
+
+private:
+    DFAView dfa;
+    bool wholeLine;
+    LiteralSearcher searcher;
+
+    // At a line start: find the next occurrence of the literal and reject
+    // every complete line before the one that holds it. Returns where the
+    // DFA should resume (the candidate line, or an unfinished last line that
+    // may still get the literal from the next piece).
+    template <class OnLine>
+    size_t skipToCandidate(State &st, const char *p, size_t i, size_t n, OnLine &onLine) const {
+        st.stats.searches++;
+        const char *hit = searcher.find(p + i, n - i);
+        size_t stop = hit ? (size_t)(hit - p) : n;
+        while (i < stop) {
+            const void *nl = std::memchr(p + i, '\n', stop - i);
+            if (!nl) break;
+            size_t j = (size_t)((const char *)nl - p);
+            st.stats.linesSkipped++;
+            st.stats.bytesSkipped += j + 1 - i;
+            endLine(st, st.offset + j, false, onLine, false);
+            i = j + 1;
+        }
+        return i;
+    }
+
+    void resetLine(State &st, uint64_t at) const {
+        st.lineStart = at;
+        st.dfaState = dfa.start;
+        st.matched = !wholeLine && dfa.accept[dfa.start];
+    }
+
+    template <class OnLine>
+    void endLine(State &st, uint64_t nlOffset, bool matched, OnLine &onLine, bool verified = true) const {
+        if (verified) st.stats.linesVerified++;
+        if (matched) st.stats.linesMatched++;
+        onLine(st.lineStart, nlOffset, st.lineNumber, matched);
+        st.lineNumber++;
+        resetLine(st, nlOffset + 1);
+    }
+};
@@ -0,0 +1,249 @@
+#pragma once
+#include "Bytecode.h"
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <stdexcept>
+
+// Native code for arithmetic formulas. The AST is compiled to Bytecode and
+// each instruction is lowered to x86-64 SSE2 scalar code, written into its
+// own pages and then made read+execute (never writable and executable at
+// once). Operand stack slots 0-4 live in xmm0-xmm4, deeper slots in the
+// native stack frame, and xmm5 is scratch; all of these are caller-saved in
+// both the System V and the Windows x64 conventions, so nothing needs saving.
+// Elsewhere (or if the pages can't be allocated) the same interface runs the
+// bytecode on a StackVM.
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__unix__) || defined(__APPLE__) || defined(_WIN32))
+#define RECALC_HAVE_JIT 1
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#endif
+
+namespace jit {
+
+// x86-64 encoder for the handful of instructions the JIT emits
+class X64Emitter {
+public:
+    std::vector<uint8_t> code;
+
+    enum Reg { RCX = 1, RSP = 4, RDI = 7 };
+    static constexpr int SCRATCH = 5; // xmm5
+
+    // SSE2 scalar double ops (F2 0F xx)
+    enum SseOp : uint8_t { MOVSD_LOAD = 0x10, MOVSD_STORE = 0x11, ADDSD = 0x58, MULSD = 0x59, SUBSD = 0x5C, DIVSD = 0x5E };
+
+    void byte(uint8_t b) { code.push_back(b); }
+    void dword(uint32_t v) { for (int i = 0; i < 4; ++i) byte((uint8_t)(v >> (8 * i))); }
+
+    // op xmmDst, xmmSrc
+    void sseRegReg(SseOp op, int dst, int src) { byte(0xF2); byte(0x0F); byte(op); byte((uint8_t)(0xC0 | dst << 3 | src)); }
+    // op xmm, [base + disp32]  (MOVSD_STORE: [base + disp32] = xmm)
+    void sseMem(SseOp op, int xmm, Reg base, int32_t disp) { byte(0xF2); byte(0x0F); byte(op); modrmMem(xmm, base, disp); }
+    // op xmm, [rip + target]; target is an offset in code. Returns where the
+    // disp32 goes so it can be patched once the constant pool is placed.
+    size_t sseRip(SseOp op, int xmm) { byte(0xF2); byte(0x0F); byte(op); return ripOperand(xmm); }
+    // xorpd xmm, [rip + target] (16-byte aligned)
+    size_t xorpdRip(int xmm) { byte(0x66); byte(0x0F); byte(0x57); return ripOperand(xmm); }
+
+    void subRsp(uint32_t n) { byte(0x48); byte(0x81); byte(0xEC); dword(n); }
+    void addRsp(uint32_t n) { byte(0x48); byte(0x81); byte(0xC4); dword(n); }
+    void ret() { byte(0xC3); }
+
+    // Fills in a RIP-relative operand emitted earlier so it points at code[target]
+    void patchRip(size_t at, size_t target) {
+        int32_t rel = (int32_t)((int64_t)target - (int64_t)(at + 4));
+        std::memcpy(&code[at], &rel, 4);
+    }
+
+private:
+    void modrmMem(int reg, Reg base, int32_t disp) {
+        byte((uint8_t)(0x80 | reg << 3 | base)); // mod=10: [base + disp32]
+        if (base == RSP) byte(0x24);              // SIB: no index, base rsp
+        dword((uint32_t)disp);
+    }
+    size_t ripOperand(int reg) {
+        byte((uint8_t)(reg << 3 | 5)); // mod=00 rm=101: [rip + disp32]
+        size_t at = code.size();
+        dword(0);
+        return at;
+    }
+};
+
+// Read+execute pages holding one compiled function. Move-only; the pages are
+// released when the owner goes away.
+class CodePages {
+    void *mem = nullptr;
+    size_t size = 0;
+public:
+    CodePages() = default;
+    CodePages(const CodePages &) = delete;
+    CodePages &operator=(const CodePages &) = delete;
+    CodePages(CodePages &&o) noexcept : mem(o.mem), size(o.size) { o.mem = nullptr; o.size = 0; }
+    CodePages &operator=(CodePages &&o) noexcept { std::swap(mem, o.mem); std::swap(size, o.size); return *this; }
+    ~CodePages() { release(); }
+
+    const void *data() const { return mem; }
+
+    // Copies code into fresh writable pages, then flips them to read+execute
+    bool load(const std::vector<uint8_t> &code) {
+        release();
+#ifdef RECALC_HAVE_JIT
+#ifdef _WIN32
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        size_t page = si.dwPageSize;
+#else
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+        size_t n = (code.size() + page - 1) / page * page;
+#ifdef _WIN32
+        void *p = VirtualAlloc(nullptr, n, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (!p) return false;
+        std::memcpy(p, code.data(), code.size());
+        DWORD old;
+        if (!VirtualProtect(p, n, PAGE_EXECUTE_READ, &old)) { VirtualFree(p, 0, MEM_RELEASE); return false; }
+        FlushInstructionCache(GetCurrentProcess(), p, n);
+#else
+        void *p = mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return false;
+        std::memcpy(p, code.data(), code.size());
+        if (mprotect(p, n, PROT_READ | PROT_EXEC) != 0) { munmap(p, n); return false; }
+#endif
+        mem = p;
+        size = n;
+        return true;
+#else
+        (void)code;
+        return false;
+#endif
+    }
+
+    void release() {
+        if (!mem) return;
+#ifdef RECALC_HAVE_JIT
+#ifdef _WIN32
+        VirtualFree(mem, 0, MEM_RELEASE);
+#else
+        munmap(mem, size);
+#endif
+#endif
+        mem = nullptr;
+        size = 0;
+    }
+};
+
+// Lowers bytecode to machine code; see the top of the file for the layout
+inline std::vector<uint8_t> lower(const Bytecode &bc) {
+    X64Emitter e;
+    const int REGS = 5; // slots living in xmm0-xmm4
+#ifdef _WIN32
+    const X64Emitter::Reg vars = X64Emitter::RCX;
+#else
+    const X64Emitter::Reg vars = X64Emitter::RDI;
+#endif
+    int spilled = bc.maxStack > REGS ? bc.maxStack - REGS : 0;
+    uint32_t frame = (uint32_t)(spilled * 8 + 15) / 16 * 16;
+    if (frame) e.subRsp(frame);
+    auto inReg = [&](int slot) { return slot < REGS; };
+    auto disp = [&](int slot) { return (int32_t)((slot - REGS) * 8); };
+
+    std::vector<std::pair<size_t, uint32_t>> constRefs; // (disp32 position, constant index)
+    std::vector<size_t> maskRefs;
+    int depth = 0;
+    for (const Instr &in : bc.code) {
+        switch (in.op) {
+            case Op::PUSH:
+            case Op::LOAD: {
+                int s = depth++;
+                int x = inReg(s) ? s : X64Emitter::SCRATCH;
+                if (in.op == Op::PUSH) constRefs.push_back({e.sseRip(X64Emitter::MOVSD_LOAD, x), in.arg});
+                else e.sseMem(X64Emitter::MOVSD_LOAD, x, vars, (int32_t)(in.arg * 8));
+                if (!inReg(s)) e.sseMem(X64Emitter::MOVSD_STORE, x, X64Emitter::RSP, disp(s));
+                break;
+            }
+            case Op::NEG: {
+                int s = depth - 1;
+                if (inReg(s)) { maskRefs.push_back(e.xorpdRip(s)); break; }
+                e.sseMem(X64Emitter::MOVSD_LOAD, X64Emitter::SCRATCH, X64Emitter::RSP, disp(s));
+                maskRefs.push_back(e.xorpdRip(X64Emitter::SCRATCH));
+                e.sseMem(X64Emitter::MOVSD_STORE, X64Emitter::SCRATCH, X64Emitter::RSP, disp(s));
+                break;
+            }
+            default: {
+                X64Emitter::SseOp op = in.op == Op::ADD ? X64Emitter::ADDSD : in.op == Op::SUB ? X64Emitter::SUBSD
+                                     : in.op == Op::MUL ? X64Emitter::MULSD : X64Emitter::DIVSD;
+                int a = depth - 2, b = depth - 1;
+                int x = inReg(a) ? a : X64Emitter::SCRATCH;
+                if (!inReg(a)) e.sseMem(X64Emitter::MOVSD_LOAD, x, X64Emitter::RSP, disp(a));
+                if (inReg(b)) e.sseRegReg(op, x, b);
+                else e.sseMem(op, x, X64Emitter::RSP, disp(b));
+                if (!inReg(a)) e.sseMem(X64Emitter::MOVSD_STORE, x, X64Emitter::RSP, disp(a));
+                depth--;
+                break;
+            }
+        }
+    }
+    if (frame) e.addRsp(frame);
+    e.ret();
+
+    // constant pool after the code: the sign mask (16-byte aligned for xorpd), then the constants
+    while (e.code.size() % 16) e.byte(0xCC);
+    size_t mask = e.code.size();
+    for (int i = 0; i < 7; ++i) e.byte(0);
+    e.byte(0x80);
+    for (int i = 0; i < 8; ++i) e.byte(0);
+    size_t pool = e.code.size();
+    for (double k : bc.constants) {
+        uint64_t bits;
+        std::memcpy(&bits, &k, 8);
+        for (int i = 0; i < 8; ++i) e.byte((uint8_t)(bits >> (8 * i)));
+    }
+    for (auto &r : constRefs) e.patchRip(r.first, pool + 8 * r.second);
+    for (size_t at : maskRefs) e.patchRip(at, mask);
+    return e.code;
+}
+
+} // namespace jit
+
+// A formula compiled to native code where possible. fn() is the native entry
+// point (nullptr when running on the interpreter fallback); eval() works either
+// way. vars[i] is the value of bytecode().variables[i]; formulas without
+// variables may pass nullptr.
+class JitFunction {
+public:
+    using Fn = double (*)(const double *vars);
+
+    explicit JitFunction(const ASTNode *root, bool allowNative = true) : bc(compileBytecode(root)) {
+#ifdef RECALC_HAVE_JIT
+        // frames over a page would need stack probes on Windows; such deep formulas stay interpreted
+        bool small = bc.maxStack <= 5 + 4096 / 8;
+        if (allowNative && small && pages.load(jit::lower(bc))) entry = reinterpret_cast<Fn>(const_cast<void *>(pages.data()));
+#else
+        (void)allowNative;
+#endif
+    }
+
+    Fn fn() const { return entry; }
+    bool native() const { return entry != nullptr; }
+    const Bytecode &bytecode() const { return bc; }
+
+    double eval(const double *vars = nullptr) {
+        if (!vars && !bc.variables.empty()) throw std::runtime_error("Unknown variable: " + bc.variables[0]);
+        if (entry) return entry(vars);
+        return vm.run(bc, vars);
+    }
+
+private:
+    Bytecode bc;
+    jit::CodePages pages;
+    Fn entry = nullptr;
+    StackVM vm;
+};
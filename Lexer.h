@@ -2,8 +2,14 @@
 #include <string>
 #include <vector>
 #include <cctype>
+#include <string_view>
+#include <charconv>
+#include <stdexcept>
+#include "Trace.h"
+#include "Stats.h"
+#include "TraceLog.h"
 
-enum TokenType { TOK_NUMBER, TOK_PLUS, TOK_MINUS, TOK_TIMES, TOK_DIVIDE, TOK_LPAREN, TOK_RPAREN, TOK_END, TOK_INVALID };
+enum TokenType { TOK_NUMBER, TOK_IDENT, TOK_PLUS, TOK_MINUS, TOK_TIMES, TOK_DIVIDE, TOK_LPAREN, TOK_RPAREN, TOK_END, TOK_INVALID };
 
 struct Token {
     TokenType type;
@@ -11,15 +17,32 @@ struct Token {
     int pos;
 };
 
-class Lexer {
+inline const char *tokenTypeName(TokenType t) {
+    switch (t) {
+        case TOK_NUMBER: return "NUMBER";
+        case TOK_IDENT: return "IDENT";
+        case TOK_PLUS: return "PLUS";
+        case TOK_MINUS: return "MINUS";
+        case TOK_TIMES: return "TIMES";
+        case TOK_DIVIDE: return "DIVIDE";
+        case TOK_LPAREN: return "LPAREN";
+        case TOK_RPAREN: return "RPAREN";
+        case TOK_END: return "END";
+        default: return "INVALID";
+    }
+}
+
+// BasicLexer<NoTrace> produces the same tokens without filling steps
+template <class Trace = FullTrace>
+class BasicLexer {
     std::string input;
     size_t pos = 0;
 public:
     std::vector<std::string> steps;
     std::vector<Token> tokens; // full token stream
 
-    Lexer() = default;
-    explicit Lexer(const std::string &text) { setInput(text); }
+    BasicLexer() = default;
+    explicit BasicLexer(const std::string &text) { setInput(text); }
 
     void setInput(const std::string &text) {
         input = text;
@@ -30,6 +53,7 @@ public:
     }
 
     void tokenizeAll() {
+        StageTimer timer(EngineStats::LEX);
         while (true) {
             Token t = nextTokenInternal();
             tokens.push_back(t);
@@ -42,26 +66,103 @@ public:
         if (pos >= input.size()) return {TOK_END, "", (int)pos};
         char current = input[pos];
         if (std::isdigit(static_cast<unsigned char>(current)) || current == '.') {
-            std::string num;
             int start = (int)pos;
             bool seenDot = false;
             while (pos < input.size() && (std::isdigit(static_cast<unsigned char>(input[pos])) || (!seenDot && input[pos] == '.'))) {
                 if (input[pos] == '.') seenDot = true;
-                num += input[pos++];
+                pos++;
             }
-            steps.push_back("[LEXER] NUMBER -> " + num);
+            std::string num = input.substr(start, pos - start);
+            if constexpr (Trace::enabled) steps.push_back("[LEXER] NUMBER -> " + num);
+            if constexpr (Trace::events) record(TOK_NUMBER, num);
             return {TOK_NUMBER, num, start};
         }
+        if (std::isalpha(static_cast<unsigned char>(current)) || current == '_') {
+            int start = (int)pos;
+            while (pos < input.size() && (std::isalnum(static_cast<unsigned char>(input[pos])) || input[pos] == '_')) pos++;
+            std::string name = input.substr(start, pos - start);
+            if constexpr (Trace::enabled) steps.push_back("[LEXER] IDENT -> " + name);
+            if constexpr (Trace::events) record(TOK_IDENT, name);
+            return {TOK_IDENT, name, start};
+        }
         pos++;
         std::string sym(1, current);
+        TokenType type;
         switch (current) {
-            case '+': steps.push_back("[LEXER] PLUS -> +"); return {TOK_PLUS, sym, (int)pos-1};
-            case '-': steps.push_back("[LEXER] MINUS -> -"); return {TOK_MINUS, sym, (int)pos-1};
-            case '*': steps.push_back("[LEXER] TIMES -> *"); return {TOK_TIMES, sym, (int)pos-1};
-            case '/': steps.push_back("[LEXER] DIVIDE -> /"); return {TOK_DIVIDE, sym, (int)pos-1};
-            case '(' : steps.push_back("[LEXER] LPAREN -> ("); return {TOK_LPAREN, sym, (int)pos-1};
-            case ')' : steps.push_back("[LEXER] RPAREN -> )"); return {TOK_RPAREN, sym, (int)pos-1};
-            default: steps.push_back("[LEXER] INVALID -> " + sym); return {TOK_INVALID, sym, (int)pos-1};
+            case '+': type = TOK_PLUS; break;
+            case '-': type = TOK_MINUS; break;
+            case '*': type = TOK_TIMES; break;
+            case '/': type = TOK_DIVIDE; break;
+            case '(': type = TOK_LPAREN; break;
+            case ')': type = TOK_RPAREN; break;
+            default: type = TOK_INVALID; break;
+        }
+        if constexpr (Trace::enabled) steps.push_back(std::string("[LEXER] ") + tokenTypeName(type) + " -> " + sym);
+        if constexpr (Trace::events) record(type, sym);
+        return {type, sym, (int)pos-1};
+    }
+
+private:
+    static void record(TokenType type, const std::string &text) {
+        if (TraceLog *log = activeTraceLog()) log->push(TraceEvent{TraceEvent::LEX, TraceEvent::TOKEN, 0, log->intern(text), type});
+    }
+};
+
+using Lexer = BasicLexer<FullTrace>;
+
+// Token of the allocation-free front end: text points into the caller's
+// buffer, and numbers are converted once, when they are scanned.
+struct TokenView {
+    TokenType type;
+    std::string_view text;
+    int pos;
+    double number = 0; // TOK_NUMBER only
+};
+
+// Same token rules as Lexer, scanned one token at a time over a string_view.
+// Keeps no copy of the input and records no steps, so it never allocates.
+class ExprScanner {
+    std::string_view input;
+    size_t pos = 0;
+
+    static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+    static bool isIdentStart(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+    TokenView symbol(TokenType type) { pos++; return {type, input.substr(pos - 1, 1), (int)pos - 1}; }
+
+public:
+    ExprScanner() = default;
+    explicit ExprScanner(std::string_view text) : input(text) {}
+
+    void reset(std::string_view text) { input = text; pos = 0; }
+
+    TokenView next() {
+        while (pos < input.size() && std::isspace(static_cast<unsigned char>(input[pos]))) pos++;
+        if (pos >= input.size()) return {TOK_END, std::string_view(), (int)pos};
+        char c = input[pos];
+        size_t start = pos;
+        if (isDigit(c) || c == '.') {
+            bool seenDot = false;
+            while (pos < input.size() && (isDigit(input[pos]) || (!seenDot && input[pos] == '.'))) {
+                if (input[pos] == '.') seenDot = true;
+                pos++;
+            }
+            TokenView t{TOK_NUMBER, input.substr(start, pos - start), (int)start};
+            auto r = std::from_chars(t.text.data(), t.text.data() + t.text.size(), t.number);
+            if (r.ec != std::errc() || r.ptr != t.text.data() + t.text.size()) throw std::runtime_error("Invalid number: " + std::string(t.text));
+            return t;
+        }
+        if (isIdentStart(c)) {
+            while (pos < input.size() && (isIdentStart(input[pos]) || isDigit(input[pos]))) pos++;
+            return {TOK_IDENT, input.substr(start, pos - start), (int)start};
+        }
+        switch (c) {
+            case '+': return symbol(TOK_PLUS);
+            case '-': return symbol(TOK_MINUS);
+            case '*': return symbol(TOK_TIMES);
+            case '/': return symbol(TOK_DIVIDE);
+            case '(': return symbol(TOK_LPAREN);
+            case ')': return symbol(TOK_RPAREN);
+            default: return symbol(TOK_INVALID);
         }
     }
 };
@@ -5,17 +5,111 @@
 #include <stack>
 #include <set>
 #include <memory>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include "Trace.h"
+#include "Stats.h"
+#include "TraceLog.h"
+#include "CharClass.h"
+#include "RegexAST.h"
+
+struct NState;
+
+// Edge taken on any byte in [lo, hi]
+struct RangeEdge {
+    unsigned char lo, hi;
+    NState *to;
+};
 
 struct NState {
     int id;
     std::map<char, std::vector<NState*>> trans; // char '\0' used for epsilon
+    std::vector<RangeEdge> ranges;              // class atoms ([a-z], ., escaped operators)
     bool accept = false;
+    int pattern = -1; // which pattern an accept state belongs to (see buildFromRegexSet)
+    int counter = -1; // the RepeatCounter whose body holds this state, if any
     NState(int i) : id(i) {}
 };
 
 struct NFAFragment {
     NState* start;
     NState* accept;
+    int first; // lowest state id; the fragment's states are ids first.. up to the newest
+};
+
+// Counted repetition e{min,max} (max -1: unbounded) over a single copy of
+// e's states. A thread inside the body carries the number of the iteration
+// it is in; loop is entered from the body's accept state with the number of
+// iterations done, and continues to bodyStart (one more, if below max) and to
+// exit (if at least min). Bodies never nest: a repetition around one is
+// unrolled instead.
+struct RepeatCounter {
+    int min, max;
+    NState *bodyStart, *loop, *exit;
+};
+
+// The iteration numbers a thread may be at in one state, as sorted disjoint
+// runs [lo, hi]. Threads entering a repetition one byte apart differ by one,
+// so the values usually form a single run however large the bounds are.
+struct CounterValues {
+    std::vector<std::pair<int, int>> runs;
+
+    bool empty() const { return runs.empty(); }
+    int max() const { return runs.back().second; }
+    void clear() { runs.clear(); }
+
+    // Adds o's values, keeping only the ones that matter for c (see prune).
+    // True if that changed anything.
+    bool unite(const CounterValues &o, const RepeatCounter &c) {
+        if (o.runs.empty()) return false;
+        if (runs.empty()) { runs = o.runs; prune(c); return true; }
+        if (c.min == 0 || c.max < 0) {
+            int v = c.min == 0 ? std::min(runs[0].first, o.runs.front().first) : std::max(runs[0].first, o.max());
+            if (v == runs[0].first) return false;
+            runs[0] = {v, v};
+            return true;
+        }
+        // nothing to do if every run of o lies inside one of ours
+        size_t j = 0;
+        bool inside = true;
+        for (auto &r : o.runs) {
+            while (j < runs.size() && runs[j].second < r.second) ++j;
+            if (j == runs.size() || runs[j].first > r.first) { inside = false; break; }
+        }
+        if (inside) return false;
+        std::vector<std::pair<int, int>> all;
+        std::merge(runs.begin(), runs.end(), o.runs.begin(), o.runs.end(), std::back_inserter(all));
+        runs.clear();
+        for (auto &r : all) {
+            if (!runs.empty() && r.first <= runs.back().second + 1) runs.back().second = std::max(runs.back().second, r.second);
+            else runs.push_back(r);
+        }
+        return true;
+    }
+
+    // The values after one more iteration of c, from the numbers of iterations
+    // done: those below max, plus one. Unbounded counts stop at min, beyond
+    // which they all behave alike.
+    void assignNext(const CounterValues &done, const RepeatCounter &c) {
+        runs.clear();
+        for (auto r : done.runs) {
+            if (c.max >= 0) { if (r.first >= c.max) break; r.second = std::min(r.second, c.max - 1); }
+            r.first++; r.second++;
+            if (c.max < 0) { r.first = std::min(r.first, c.min); r.second = std::min(r.second, c.min); }
+            if (!runs.empty() && r.first <= runs.back().second + 1) runs.back().second = std::max(runs.back().second, r.second);
+            else runs.push_back(r);
+        }
+    }
+
+    // Drops values another one makes redundant: with min 0 every count may
+    // exit, so the smallest (most iterations left) covers the rest; without
+    // max every count may go on, so the largest does
+    void prune(const RepeatCounter &c) {
+        if (runs.empty()) return;
+        if (c.min == 0) runs = {{runs.front().first, runs.front().first}};
+        else if (c.max < 0) runs = {{max(), max()}};
+    }
 };
 
 class ThompsonNFA {
@@ -23,8 +117,12 @@ class ThompsonNFA {
     int nextId = 0;
 public:
     NState* start = nullptr;
-    NState* accept = nullptr;
+    NState* accept = nullptr; // the single accept state; nullptr for a pattern set
     std::vector<std::string> trace;
+    std::vector<RepeatCounter> counters; // counted repetitions; see simulateCounted
+
+    // Unrolling limit for buildExpanded and for repetitions around counters
+    static constexpr size_t MAX_EXPANDED_STATES = 1 << 21;
 
     ThompsonNFA() = default;
 
@@ -34,138 +132,524 @@ public:
         return owned.back().get();
     }
 
-    // Insert explicit concatenation operator '.' into regex
-    static std::string insertConcat(const std::string &in) {
-        std::string out;
-        auto isSymbol = [](char c){ return c!='|' && c!='*' && c!=')' && c!='('; };
-        for (size_t i=0;i<in.size();++i) {
-            char c = in[i];
-            out.push_back(c);
-            if (i+1<in.size()) {
-                char d = in[i+1];
-                if ((isSymbol(c) || c==')' || c=='*') && (isSymbol(d) || d=='(')) out.push_back('.');
-            }
+    // States are numbered densely in creation order, so id doubles as an index
+    size_t stateCount() const { return owned.size(); }
+    const NState* state(int id) const { return owned[id].get(); }
+
+    // Postfix spelling of a regex, '.' being concatenation. Atoms come out in
+    // their postfix spelling (CharClass::spelling): . and [...] and escapes
+    // become canonical classes. Repetitions are *, + (one or more),
+    // ? (optional) and {n}, {n,}, {n,m}, which come out as {n,m} or {n,}.
+    // Malformed patterns throw (see parseRegex).
+    static std::string toPostfix(const std::string &in) { return parseRegex(in).postfix(); }
+
+    // buildFromRegex<NoTrace> skips the transition listing in trace
+    template <class Trace = FullTrace>
+    void buildFromRegex(const std::string &regex) {
+        StageTimer timer(EngineStats::NFA_BUILD);
+        reset();
+        NFAFragment f;
+        if (buildFragment(parseRegex(regex), f)) {
+            start = f.start; accept = f.accept; accept->accept = true; accept->pattern = 0;
+            if constexpr (Trace::enabled || Trace::events) traceTransitions<Trace>();
         }
-        return out;
-    }
-
-    // shunting-yard for regex to postfix
-    static std::string toPostfix(const std::string &in) {
-        std::string input = insertConcat(in);
-        std::string out;
-        std::stack<char> ops;
-        auto prec = [](char o){ if (o=='*') return 3; if (o=='.') return 2; if (o=='|') return 1; return 0; };
-        for (char c : input) {
-            if (c=='(') { ops.push(c); }
-            else if (c==')') { while(!ops.empty() && ops.top()!='(') { out.push_back(ops.top()); ops.pop(); } if(!ops.empty()) ops.pop(); }
-            else if (c=='*' || c=='|' || c=='.') {
-                while(!ops.empty() && prec(ops.top())>=prec(c)) { out.push_back(ops.top()); ops.pop(); }
-                ops.push(c);
-            } else {
-                out.push_back(c);
-            }
+        if (EngineStats *st = activeStats()) countTransitions(*st);
+    }
+
+    // One NFA for many patterns: a new start state with an epsilon edge to
+    // each pattern's fragment, and every fragment's accept state tagged with
+    // the pattern's index. Empty patterns never match.
+    template <class Trace = FullTrace>
+    void buildFromRegexSet(const std::vector<std::string> &regexes) {
+        StageTimer timer(EngineStats::NFA_BUILD);
+        reset();
+        start = makeState();
+        for (size_t i = 0; i < regexes.size(); ++i) {
+            NFAFragment f;
+            if (!buildFragment(parseRegex(regexes[i]), f)) continue;
+            start->trans[0].push_back(f.start);
+            f.accept->accept = true;
+            f.accept->pattern = (int)i;
         }
-        while(!ops.empty()) { out.push_back(ops.top()); ops.pop(); }
-        return out;
+        if constexpr (Trace::enabled || Trace::events) traceTransitions<Trace>();
+        if (EngineStats *st = activeStats()) countTransitions(*st);
     }
 
-    void buildFromRegex(const std::string &regex) {
+    // The reverse of fwd: every edge flipped, started from a new state with an
+    // epsilon edge to each of fwd's accept states, accepting at fwd's start.
+    // It accepts exactly the reversed strings of fwd's language.
+    void buildReverse(const ThompsonNFA &fwd) {
+        if (fwd.hasCounters()) {
+            ThompsonNFA plain;
+            plain.buildExpanded(fwd);
+            buildReverse(plain);
+            return;
+        }
+        reset();
+        if (!fwd.start) return;
+        std::vector<NState*> map;
+        for (size_t i = 0; i < fwd.stateCount(); ++i) map.push_back(makeState());
+        start = makeState();
+        for (size_t i = 0; i < fwd.stateCount(); ++i) {
+            const NState *st = fwd.state((int)i);
+            if (st->accept) start->trans[0].push_back(map[i]);
+            for (auto &kv : st->trans)
+                for (auto *t : kv.second) map[t->id]->trans[kv.first].push_back(map[i]);
+            for (auto &r : st->ranges) map[r.to->id]->ranges.push_back({r.lo, r.hi, map[i]});
+        }
+        accept = map[fwd.start->id];
+        accept->accept = true;
+        accept->pattern = 0;
+    }
+
+    void reset() {
         trace.clear();
         owned.clear();
         nextId = 0;
-        std::string postfix = toPostfix(regex);
-        std::stack<NFAFragment> st;
-        for (char c : postfix) {
-            if (c=='.') {
-                auto b = st.top(); st.pop();
-                auto a = st.top(); st.pop();
-                // connect a.accept -> epsilon -> b.start
-                a.accept->trans[0].push_back(b.start);
-                NFAFragment f{a.start, b.accept};
-                st.push(f);
-            } else if (c=='|') {
-                auto b = st.top(); st.pop();
-                auto a = st.top(); st.pop();
+        start = accept = nullptr;
+        counters.clear();
+    }
+
+    bool hasCounters() const { return !counters.empty(); }
+
+    // src with every counted repetition unrolled into one copy of its body
+    // per iteration, for the engines that can't count (the DFA builders, the
+    // flat NFA). Throws rather than build more than maxStates states.
+    void buildExpanded(const ThompsonNFA &src, size_t maxStates = MAX_EXPANDED_STATES) {
+        reset();
+        if (!src.start) return;
+        // copies[k]: body copies for counter k; the last one loops if unbounded
+        std::vector<size_t> copies;
+        for (auto &c : src.counters) copies.push_back(c.max >= 0 ? (size_t)c.max : (size_t)std::max(c.min, 1));
+        size_t total = 0;
+        for (auto &p : src.owned) total += p->counter >= 0 ? copies[p->counter] : 1;
+        if (total > maxStates)
+            throw std::runtime_error("Counted repetition expands to more than " + std::to_string(maxStates) + " states");
+        // copy i of state q is base[q] + i
+        std::vector<int> base;
+        for (auto &p : src.owned) {
+            base.push_back(nextId);
+            for (size_t i = 0, n = p->counter >= 0 ? copies[p->counter] : 1; i < n; ++i) makeState();
+        }
+        auto copy = [&](const NState *q, size_t i) { return owned[base[q->id] + i].get(); };
+        for (auto &p : src.owned) {
+            const NState *q = p.get();
+            for (size_t i = 0, n = q->counter >= 0 ? copies[q->counter] : 1; i < n; ++i) {
+                NState *ns = copy(q, i);
+                ns->accept = q->accept;
+                ns->pattern = q->pattern;
+                if (q->counter >= 0 && src.counters[q->counter].loop == q) {
+                    // i + 1 iterations done
+                    const RepeatCounter &c = src.counters[q->counter];
+                    if (i + 1 < n) ns->trans[0].push_back(copy(c.bodyStart, i + 1));
+                    else if (c.max < 0) ns->trans[0].push_back(copy(c.bodyStart, i));
+                    if (i + 1 >= (size_t)c.min) ns->trans[0].push_back(copy(c.exit, 0));
+                    continue;
+                }
+                // edges stay in the same iteration; entering a body starts at the first
+                auto target = [&](const NState *t) { return copy(t, t->counter >= 0 && t->counter == q->counter ? i : 0); };
+                for (auto &kv : q->trans)
+                    for (auto *t : kv.second) ns->trans[kv.first].push_back(target(t));
+                for (auto &r : q->ranges) ns->ranges.push_back({r.lo, r.hi, target(r.to)});
+            }
+        }
+        start = copy(src.start, 0);
+        accept = src.accept ? copy(src.accept, 0) : nullptr;
+    }
+
+    // Thompson's construction of one postfix regex; false if it is empty.
+    // Malformed postfix throws (see parsePostfix).
+    bool buildFragment(const std::string &postfix, NFAFragment &out) { return buildFragment(parsePostfix(postfix), out); }
+
+    // Same from a parsed regex, bottom-up over its postorder nodes
+    bool buildFragment(const RegexAST &ast, NFAFragment &out) {
+        if (ast.empty()) return false;
+        std::vector<NFAFragment> st;
+        for (const RegexNode &n : ast.nodes) {
+            if (n.kind == RegexNode::CONCAT) {
+                auto b = st.back(); st.pop_back();
+                st.back() = concat(st.back(), b);
+            } else if (n.kind == RegexNode::ALTERNATE) {
+                auto b = st.back(); st.pop_back();
+                auto a = st.back();
                 NState* s = makeState();
                 NState* e = makeState();
                 s->trans[0].push_back(a.start);
                 s->trans[0].push_back(b.start);
                 a.accept->trans[0].push_back(e);
                 b.accept->trans[0].push_back(e);
-                NFAFragment f{s,e};
-                st.push(f);
-            } else if (c=='*') {
-                auto a = st.top(); st.pop();
-                NState* s = makeState();
-                NState* e = makeState();
-                s->trans[0].push_back(a.start);
-                s->trans[0].push_back(e);
-                a.accept->trans[0].push_back(a.start);
-                a.accept->trans[0].push_back(e);
-                NFAFragment f{s,e};
-                st.push(f);
+                st.back() = NFAFragment{s, e, a.first};
+            } else if (n.kind == RegexNode::REPEAT) {
+                auto a = st.back();
+                if (n.op=='*') st.back() = star(a);
+                else if (n.op=='+') st.back() = plus(a);
+                else if (n.op=='?') st.back() = optional(a);
+                else st.back() = repeat(a, n.min, n.max);
             } else {
                 NState* s = makeState();
                 NState* e = makeState();
-                s->trans[c].push_back(e);
-                NFAFragment f{s,e};
-                st.push(f);
+                const CharClass::Range *r = &ast.ranges[n.lhs], *end = &ast.ranges[0] + n.rhs;
+                // literals keep their map edge; '\0' there would read as epsilon
+                if (end - r == 1 && r->lo == r->hi && r->lo != 0) s->trans[(char)r->lo].push_back(e);
+                else for (; r != end; ++r) s->ranges.push_back({r->lo, r->hi, e});
+                st.push_back(NFAFragment{s, e, s->id});
             }
         }
-        if (st.empty()) { start = accept = nullptr; return; }
-        auto top = st.top(); st.pop();
-        start = top.start; accept = top.accept; accept->accept = true;
-        // produce human-readable transitions
+        out = st.back();
+        return true;
+    }
+
+private:
+    NFAFragment concat(NFAFragment a, NFAFragment b) {
+        // connect a.accept -> epsilon -> b.start
+        a.accept->trans[0].push_back(b.start);
+        return NFAFragment{a.start, b.accept, a.first};
+    }
+
+    NFAFragment star(NFAFragment a) {
+        NState* s = makeState();
+        NState* e = makeState();
+        s->trans[0].push_back(a.start);
+        s->trans[0].push_back(e);
+        a.accept->trans[0].push_back(a.start);
+        a.accept->trans[0].push_back(e);
+        return NFAFragment{s, e, a.first};
+    }
+
+    NFAFragment plus(NFAFragment a) {
+        NState* e = makeState();
+        a.accept->trans[0].push_back(a.start);
+        a.accept->trans[0].push_back(e);
+        return NFAFragment{a.start, e, a.first};
+    }
+
+    NFAFragment optional(NFAFragment a) {
+        NState* s = makeState();
+        NState* e = makeState();
+        s->trans[0].push_back(a.start);
+        s->trans[0].push_back(e);
+        a.accept->trans[0].push_back(e);
+        return NFAFragment{s, e, a.first};
+    }
+
+    // a{min,max}. Shapes the plain operators cover use them; otherwise the
+    // body is built once and a RepeatCounter counts its iterations, so the
+    // state count doesn't depend on the bounds. A body that holds a counter
+    // is unrolled instead, keeping counters unnested.
+    NFAFragment repeat(NFAFragment a, int min, int max) {
+        if (min == 0 && max < 0) return star(a);
+        if (min == 1 && max < 0) return plus(a);
+        if (min == 0 && max == 1) return optional(a);
+        if (min == 1 && max == 1) return a;
+        bool nested = false;
+        for (int q = a.first; q < nextId; ++q) nested = nested || owned[q]->counter >= 0;
+        if (nested) return unroll(a, min, max);
+        // empty iterations can make up the minimum
+        if (canBeEmpty(a)) {
+            min = 0;
+            if (max < 0) return star(a);
+        }
+        int id = (int)counters.size();
+        for (int q = a.first; q < nextId; ++q) owned[q]->counter = id;
+        NState* enter = makeState();
+        NState* loop = makeState();
+        NState* exit = makeState();
+        loop->counter = id;
+        enter->trans[0].push_back(a.start);
+        if (min == 0) enter->trans[0].push_back(exit);
+        a.accept->trans[0].push_back(loop);
+        loop->trans[0].push_back(a.start);
+        loop->trans[0].push_back(exit);
+        counters.push_back(RepeatCounter{min, max, a.start, loop, exit});
+        return NFAFragment{enter, exit, a.first};
+    }
+
+    // true if a's accept state is reachable from its start by epsilon edges
+    bool canBeEmpty(const NFAFragment &a) const {
+        std::vector<bool> seen(owned.size(), false);
+        std::stack<const NState*> work;
+        work.push(a.start);
+        seen[a.start->id] = true;
+        while (!work.empty()) {
+            const NState *q = work.top(); work.pop();
+            if (q == a.accept) return true;
+            auto it = q->trans.find(0);
+            if (it == q->trans.end()) continue;
+            for (auto *t : it->second) if (!seen[t->id]) { seen[t->id] = true; work.push(t); }
+        }
+        return false;
+    }
+
+    // a copy of fragment a, whose states are ids a.first to end - 1, counters included
+    NFAFragment clone(const NFAFragment &a, int end) {
+        int first = a.first, base = nextId;
+        auto map = [&](const NState *q) { return owned[q->id - first + base].get(); };
+        for (int q = first; q < end; ++q) makeState();
+        std::map<int, int> counterOf; // a's counters -> the copies'
+        for (int q = first; q < end; ++q) {
+            const NState *from = owned[q].get();
+            NState *to = map(from);
+            for (auto &kv : from->trans)
+                for (auto *t : kv.second) to->trans[kv.first].push_back(map(t));
+            for (auto &r : from->ranges) to->ranges.push_back({r.lo, r.hi, map(r.to)});
+            if (from->counter >= 0) {
+                auto it = counterOf.find(from->counter);
+                if (it == counterOf.end()) {
+                    const RepeatCounter &c = counters[from->counter];
+                    it = counterOf.emplace(from->counter, (int)counters.size()).first;
+                    counters.push_back(RepeatCounter{c.min, c.max, map(c.bodyStart), map(c.loop), map(c.exit)});
+                }
+                to->counter = it->second;
+            }
+        }
+        return NFAFragment{map(a.start), map(a.accept), base};
+    }
+
+    // a{min,max} as min copies of a followed by max - min optional ones
+    // (a*, without max), nested so the NFA stays linear: a a (a (a)?)?
+    NFAFragment unroll(NFAFragment a, int min, int max) {
+        size_t copies = max >= 0 ? (size_t)max : (size_t)min + 1;
+        int end = nextId;
+        if (copies * (size_t)(end - a.first) > MAX_EXPANDED_STATES)
+            throw std::runtime_error("Counted repetition expands to more than " + std::to_string(MAX_EXPANDED_STATES) + " states");
+        std::vector<NFAFragment> parts{a};
+        for (size_t i = 1; i < copies; ++i) parts.push_back(clone(a, end));
+        NFAFragment tail{nullptr, nullptr, 0};
+        if (max < 0) tail = star(parts.back());
+        else
+            for (int i = max - 1; i >= min; --i) tail = optional(tail.start ? concat(parts[i], tail) : parts[i]);
+        NFAFragment r = min > 0 ? parts[0] : tail;
+        for (int i = 1; i < min; ++i) r = concat(r, parts[i]);
+        if (min > 0 && tail.start) r = concat(r, tail);
+        r.first = a.first;
+        return r;
+    }
+
+public:
+    void countTransitions(EngineStats &st) const {
+        st.nfaStates = owned.size();
+        st.nfaTransitions = st.nfaEpsilonTransitions = 0;
+        for (auto &p : owned)
+            for (auto &kv : p->trans) {
+                st.nfaTransitions += kv.second.size();
+                if (kv.first == 0) st.nfaEpsilonTransitions += kv.second.size();
+            }
+        for (auto &p : owned) st.nfaTransitions += p->ranges.size();
+    }
+
+    // The byte classes of this NFA: bytes split wherever some state sends
+    // them to different targets
+    ByteClasses byteClasses() const {
+        ByteClasses bc;
+        std::set<std::vector<std::pair<int, int>>> seen;
+        for (auto &p : owned) {
+            std::map<NState*, CharClass> labels; // target -> bytes that lead there
+            for (auto &kv : p->trans)
+                if (kv.first != 0) for (auto *t : kv.second) labels[t].add((unsigned char)kv.first, (unsigned char)kv.first);
+            for (auto &r : p->ranges) labels[r.to].add(r.lo, r.hi);
+            for (auto &kv : labels) {
+                kv.second.normalize();
+                std::vector<std::pair<int, int>> key;
+                for (auto &r : kv.second.ranges) key.push_back({r.lo, r.hi});
+                if (seen.insert(key).second) bc.split(kv.second);
+            }
+        }
+        return bc;
+    }
+
+    // produce human-readable transitions (EventTrace: TRANSITION events in the active TraceLog)
+    template <class Trace = FullTrace>
+    void traceTransitions() {
+        TraceLog *log = activeTraceLog();
         for (auto &p : owned) {
             for (auto &kv : p->trans) {
                 char sym = kv.first;
                 for (auto *t : kv.second) {
-                    std::string s = "q" + std::to_string(p->id) + " -" + (sym==0?std::string("eps"):std::string(1,sym)) + "-> q" + std::to_string(t->id);
-                    trace.push_back(s);
+                    if constexpr (Trace::enabled) {
+                        std::string s = "q" + std::to_string(p->id) + " -" + (sym==0?std::string("eps"):std::string(1,sym)) + "-> q" + std::to_string(t->id);
+                        trace.push_back(s);
+                    }
+                    if constexpr (Trace::events) if (log) log->push(TraceEvent{TraceEvent::NFA, TraceEvent::TRANSITION, sym, p->id, t->id});
                 }
             }
+            for (auto &r : p->ranges) {
+                if constexpr (Trace::enabled) trace.push_back("q" + std::to_string(p->id) + " -" + rangeLabel(r.lo, r.hi) + "-> q" + std::to_string(r.to->id));
+                if constexpr (Trace::events) if (log) log->push(TraceEvent{TraceEvent::NFA, TraceEvent::RANGE, (char)r.lo, p->id, r.to->id, (double)r.hi});
+            }
         }
     }
 
     // epsilon-closure
-    void epsilonClosure(const std::set<NState*> &input, std::set<NState*> &out, std::vector<std::string> *traceSteps=nullptr) {
+    template <class Trace = FullTrace>
+    void epsilonClosure(const std::set<NState*> &input, std::set<NState*> &out, std::vector<std::string> *traceSteps=nullptr) const {
         std::stack<NState*> st;
+        uint64_t edges = 0;
+        size_t before = out.size();
         for (auto *s : input) { if (!out.count(s)) { out.insert(s); st.push(s); } }
         while(!st.empty()) {
             NState* cur = st.top(); st.pop();
             auto it = cur->trans.find(0);
             if (it==cur->trans.end()) continue;
+                edges += it->second.size();
                 for (auto *nxt : it->second) {
-                if (!out.count(nxt)) { out.insert(nxt); st.push(nxt); if (traceSteps) traceSteps->push_back("eps-closure add q"+std::to_string(nxt->id)); }
+                if (out.insert(nxt).second) {
+                    st.push(nxt);
+                    if constexpr (Trace::enabled) if (traceSteps) traceSteps->push_back("eps-closure add q"+std::to_string(nxt->id));
+                    if constexpr (Trace::events) simEvent(TraceEvent::CLOSURE_ADD, 0, nxt->id);
+                }
             }
         }
+        if (EngineStats *stats = activeStats()) {
+            stats->closureCalls++;
+            stats->closureStates += out.size() - before;
+            stats->closureEdges += edges;
+        }
+    }
+
+    static std::string rangeLabel(unsigned char lo, unsigned char hi) { return CharClass{{{lo, hi}}}.spelling(); }
+
+    static void simEvent(TraceEvent::Op op, char ch, int32_t a) {
+        if (TraceLog *log = activeTraceLog()) log->push(TraceEvent{TraceEvent::SIM, op, ch, a});
     }
 
-    bool simulate(const std::string &s, std::vector<std::string> &outSteps) {
+    // Only reads the NFA; every step goes to the caller's outSteps, so threads
+    // may simulate one built NFA concurrently with their own outSteps.
+    // simulate<NoTrace> leaves outSteps empty.
+    template <class Trace = FullTrace>
+    bool simulate(const std::string &s, std::vector<std::string> &outSteps) const {
+        if (hasCounters()) return simulateCounted<Trace>(s.data(), s.size(), outSteps);
+        StageTimer timer(EngineStats::SIMULATE);
+        EngineStats *stats = activeStats();
         outSteps.clear();
         if (!start) return false;
         std::set<NState*> current;
         std::set<NState*> startSet;
         startSet.insert(start);
-        epsilonClosure(startSet, current, &outSteps);
-        outSteps.push_back("Start closure size=" + std::to_string(current.size()));
+        epsilonClosure<Trace>(startSet, current, &outSteps);
+        if (stats) stats->noteActive(current.size());
+        if constexpr (Trace::enabled) outSteps.push_back("Start closure size=" + std::to_string(current.size()));
+        if constexpr (Trace::events) simEvent(TraceEvent::START_CLOSURE, 0, (int32_t)current.size());
         for (size_t i=0;i<s.size();++i) {
             char c = s[i];
-            outSteps.push_back(std::string("Read '") + c + "'");
+            if constexpr (Trace::enabled) outSteps.push_back(std::string("Read '") + c + "'");
+            if constexpr (Trace::events) simEvent(TraceEvent::READ, c, 0);
             std::set<NState*> nexts;
             for (auto *stt : current) {
                 auto it = stt->trans.find(c);
                 if (it!=stt->trans.end()) {
                     for (auto *t : it->second) nexts.insert(t);
                 }
+                for (auto &r : stt->ranges)
+                    if ((unsigned char)c >= r.lo && (unsigned char)c <= r.hi) nexts.insert(r.to);
             }
             std::set<NState*> nextsClosure;
-            epsilonClosure(nexts, nextsClosure, &outSteps);
-            current = nextsClosure;
-            outSteps.push_back("Active states: " + std::to_string(current.size()));
+            epsilonClosure<Trace>(nexts, nextsClosure, &outSteps);
+            current.swap(nextsClosure);
+            if (stats) stats->noteActive(current.size());
+            if constexpr (Trace::enabled) outSteps.push_back("Active states: " + std::to_string(current.size()));
+            if constexpr (Trace::events) simEvent(TraceEvent::ACTIVE, 0, (int32_t)current.size());
+        }
+        for (auto *sstate : current) if (sstate->accept) {
+            if constexpr (Trace::enabled) outSteps.push_back("Accepted");
+            if constexpr (Trace::events) simEvent(TraceEvent::RESULT, 0, 1);
+            return true;
+        }
+        if constexpr (Trace::enabled) outSteps.push_back("Rejected");
+        if constexpr (Trace::events) simEvent(TraceEvent::RESULT, 0, 0);
+        return false;
+    }
+    // simulate for NFAs with counted repetitions: each active state also
+    // holds the iteration numbers its threads are at (CounterValues) for the
+    // repetition whose body it is in. A step costs O(active states x runs),
+    // independent of the repetition bounds. Same trace output as simulate.
+    template <class Trace = FullTrace>
+    bool simulateCounted(const char *p, size_t n, std::vector<std::string> &outSteps) const {
+        StageTimer timer(EngineStats::SIMULATE);
+        EngineStats *stats = activeStats();
+        outSteps.clear();
+        if (!start) return false;
+        struct Active {
+            std::vector<int> list;
+            std::vector<char> on;
+            std::vector<CounterValues> values;
+        };
+        Active cur{{}, std::vector<char>(owned.size(), 0), std::vector<CounterValues>(owned.size())}, nxt = cur;
+        const CounterValues first{{{1, 1}}};
+        CounterValues next;
+        std::vector<int> work;
+        // Adds the thread at state t arriving from state from (nullptr: the
+        // start) with values v. True if t is new or gained values.
+        auto offer = [&](Active &a, const NState *from, const NState *t, const CounterValues &v) {
+            bool fresh = !a.on[t->id];
+            if (fresh) { a.on[t->id] = 1; a.list.push_back(t->id); }
+            if (t->counter < 0) return fresh;
+            bool grew = a.values[t->id].unite(from && from->counter == t->counter ? v : first, counters[t->counter]);
+            return fresh || grew;
+        };
+        auto closure = [&](Active &a) {
+            size_t before = a.list.size();
+            uint64_t edges = 0;
+            work = a.list;
+            while (!work.empty()) {
+                const NState *q = owned[work.back()].get();
+                work.pop_back();
+                auto it = q->trans.find(0);
+                if (it == q->trans.end()) continue;
+                edges += it->second.size();
+                const CounterValues &v = a.values[q->id];
+                bool loop = q->counter >= 0 && counters[q->counter].loop == q;
+                for (auto *t : it->second) {
+                    const CounterValues *give = &v;
+                    if (loop) {
+                        const RepeatCounter &c = counters[q->counter];
+                        if (t == c.exit) { if (v.empty() || v.max() < c.min) continue; }
+                        else { next.assignNext(v, c); if (next.empty()) continue; give = &next; }
+                    }
+                    bool fresh = !a.on[t->id];
+                    if (!offer(a, q, t, *give)) continue;
+                    work.push_back(t->id);
+                    if (!fresh) continue;
+                    if constexpr (Trace::enabled) outSteps.push_back("eps-closure add q" + std::to_string(t->id));
+                    if constexpr (Trace::events) simEvent(TraceEvent::CLOSURE_ADD, 0, t->id);
+                }
+            }
+            if (stats) {
+                stats->closureCalls++;
+                stats->closureStates += a.list.size() - before;
+                stats->closureEdges += edges;
+            }
+        };
+        offer(cur, nullptr, start, first);
+        closure(cur);
+        if (stats) stats->noteActive(cur.list.size());
+        if constexpr (Trace::enabled) outSteps.push_back("Start closure size=" + std::to_string(cur.list.size()));
+        if constexpr (Trace::events) simEvent(TraceEvent::START_CLOSURE, 0, (int32_t)cur.list.size());
+        for (size_t i = 0; i < n; ++i) {
+            char c = p[i];
+            if constexpr (Trace::enabled) outSteps.push_back(std::string("Read '") + c + "'");
+            if constexpr (Trace::events) simEvent(TraceEvent::READ, c, 0);
+            for (int id : cur.list) {
+                const NState *q = owned[id].get();
+                auto it = q->trans.find(c);
+                if (it != q->trans.end()) for (auto *t : it->second) offer(nxt, q, t, cur.values[id]);
+                for (auto &r : q->ranges)
+                    if ((unsigned char)c >= r.lo && (unsigned char)c <= r.hi) offer(nxt, q, r.to, cur.values[id]);
+            }
+            closure(nxt);
+            for (int id : cur.list) { cur.on[id] = 0; cur.values[id].clear(); }
+            cur.list.clear();
+            std::swap(cur, nxt);
+            if (stats) stats->noteActive(cur.list.size());
+            if constexpr (Trace::enabled) outSteps.push_back("Active states: " + std::to_string(cur.list.size()));
+            if constexpr (Trace::events) simEvent(TraceEvent::ACTIVE, 0, (int32_t)cur.list.size());
+        }
+        for (int id : cur.list) if (owned[id]->accept) {
+            if constexpr (Trace::enabled) outSteps.push_back("Accepted");
+            if constexpr (Trace::events) simEvent(TraceEvent::RESULT, 0, 1);
+            return true;
         }
-        for (auto *sstate : current) if (sstate->accept) { outSteps.push_back("Accepted"); return true; }
-        outSteps.push_back("Rejected");
+        if constexpr (Trace::enabled) outSteps.push_back("Rejected");
+        if constexpr (Trace::events) simEvent(TraceEvent::RESULT, 0, 0);
         return false;
     }
 };
@@ -0,0 +1,228 @@
+#pragma once
+#include "Parser.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <tuple>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+// Optimized form of an arithmetic AST: a DAG in which identical subtrees are
+// stored once (hash-consing), built bottom-up while folding constants and
+// dropping identities. Only rewrites that give the same IEEE result bit for
+// bit are applied, for every input including -0, infinities and NaN:
+//   c1 op c2 -> folded      -(c) -> -c      --x -> x      +x -> x
+//   x*1, 1*x, x/1 -> x      x-0 -> x        x+(-0), (-0)+x -> x
+// Not applied: 0+x (gives +0 for x = -0), x*0, x-x, x/x, reassociation and
+// commutation (they change rounding, signed zeros or NaN propagation).
+// A NaN result stays NaN; which NaN payload survives an operation on two NaNs
+// is up to the compiler's operand order, as for any C++ arithmetic.
+struct ExprDAG {
+    enum Kind : uint8_t { CONST, VAR, NEG, ADD, SUB, MUL, DIV };
+    struct Node {
+        Kind kind;
+        int a = -1, b = -1;  // operands (node ids, always smaller than this node's)
+        double value = 0;    // CONST
+        int var = -1;        // VAR: index into variables
+    };
+
+    std::vector<Node> nodes; // topological order: operands come first
+    std::vector<std::string> variables;
+    int root = -1;
+
+    // Evaluates every node once, in order. vars[i] is the value of variables[i];
+    // values is scratch space (resized as needed, so it can be reused).
+    double eval(const double *vars, std::vector<double> &values) const {
+        values.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const Node &n = nodes[i];
+            switch (n.kind) {
+                case CONST: values[i] = n.value; break;
+                case VAR: values[i] = vars[n.var]; break;
+                case NEG: values[i] = -values[n.a]; break;
+                case ADD: values[i] = values[n.a] + values[n.b]; break;
+                case SUB: values[i] = values[n.a] - values[n.b]; break;
+                case MUL: values[i] = values[n.a] * values[n.b]; break;
+                case DIV: values[i] = values[n.a] / values[n.b]; break;
+            }
+        }
+        return values[root];
+    }
+
+    // Same, with the variables looked up by name
+    double eval(const Variables &vars) const {
+        std::vector<double> slots(variables.size()), values;
+        for (size_t i = 0; i < variables.size(); ++i) {
+            auto it = vars.find(variables[i]);
+            if (it == vars.end()) throw std::runtime_error("Unknown variable: " + variables[i]);
+            slots[i] = it->second;
+        }
+        return eval(slots.data(), values);
+    }
+
+    // Expands the DAG back into a tree (shared nodes are copied), e.g. for
+    // renderAST or compileBytecode
+    std::unique_ptr<ASTNode> toAST() const { return toAST(root); }
+
+    // Number of nodes the DAG has when expanded into a tree
+    double treeSize() const {
+        std::vector<double> size(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const Node &n = nodes[i];
+            size[i] = 1 + (n.a >= 0 ? size[n.a] : 0) + (n.b >= 0 ? size[n.b] : 0);
+        }
+        return root >= 0 ? size[root] : 0;
+    }
+
+private:
+    std::unique_ptr<ASTNode> toAST(int id) const {
+        const Node &n = nodes[id];
+        static const char ops[] = {0, 0, '-', '+', '-', '*', '/'};
+        switch (n.kind) {
+            case CONST: return std::make_unique<NumberNode>(n.value);
+            case VAR: return std::make_unique<VariableNode>(std::string(variables[n.var]));
+            case NEG: return std::make_unique<UnaryNode>('-', toAST(n.a));
+            default: return std::make_unique<BinaryNode>(ops[n.kind], toAST(n.a), toAST(n.b));
+        }
+    }
+};
+
+// Node counts of one optimization
+struct OptimizeStats {
+    size_t astNodes = 0;        // nodes in the parsed tree
+    double simplifiedNodes = 0; // tree size after folding and identities, before sharing
+    size_t dagNodes = 0;        // distinct nodes after hash-consing
+};
+
+class ExprOptimizer {
+    ExprDAG dag;
+    std::map<std::tuple<int, int, int, uint64_t>, int> interned; // (kind, a, b, constant bits / var) -> node
+    size_t visited = 0;
+
+    static uint64_t bitsOf(double v) { uint64_t u; std::memcpy(&u, &v, sizeof u); return u; }
+    bool isConst(int id) const { return dag.nodes[id].kind == ExprDAG::CONST; }
+    bool isConst(int id, double v) const { return isConst(id) && bitsOf(dag.nodes[id].value) == bitsOf(v); }
+
+    int intern(const ExprDAG::Node &n) {
+        uint64_t extra = n.kind == ExprDAG::CONST ? bitsOf(n.value) : (uint64_t)(int64_t)n.var;
+        auto key = std::make_tuple((int)n.kind, n.a, n.b, extra);
+        auto it = interned.find(key);
+        if (it != interned.end()) return it->second;
+        dag.nodes.push_back(n);
+        int id = (int)dag.nodes.size() - 1;
+        interned.emplace(key, id);
+        return id;
+    }
+
+    int constant(double v) { ExprDAG::Node n{ExprDAG::CONST}; n.value = v; return intern(n); }
+
+    int negate(int a) {
+        const ExprDAG::Node &n = dag.nodes[a];
+        if (n.kind == ExprDAG::CONST) return constant(-n.value);
+        if (n.kind == ExprDAG::NEG) return n.a;
+        ExprDAG::Node neg{ExprDAG::NEG};
+        neg.a = a;
+        return intern(neg);
+    }
+
+    int binary(ExprDAG::Kind kind, int a, int b) {
+        if (isConst(a) && isConst(b)) {
+            double x = dag.nodes[a].value, y = dag.nodes[b].value;
+            switch (kind) {
+                case ExprDAG::ADD: return constant(x + y);
+                case ExprDAG::SUB: return constant(x - y);
+                case ExprDAG::MUL: return constant(x * y);
+                default: return constant(x / y);
+            }
+        }
+        switch (kind) {
+            case ExprDAG::ADD: if (isConst(b, -0.0)) return a; if (isConst(a, -0.0)) return b; break;
+            case ExprDAG::SUB: if (isConst(b, 0.0)) return a; break;
+            case ExprDAG::MUL: if (isConst(b, 1.0)) return a; if (isConst(a, 1.0)) return b; break;
+            default: if (isConst(b, 1.0)) return a; break;
+        }
+        ExprDAG::Node n{kind};
+        n.a = a;
+        n.b = b;
+        return intern(n);
+    }
+
+    // DAG id of one node from its operands' ids; walkPostorder has built those
+    int build(const ASTNode *node, const int *operands) {
+        visited++;
+        if (const NumberNode *n = dynamic_cast<const NumberNode*>(node)) return constant(n->value);
+        if (const VariableNode *v = dynamic_cast<const VariableNode*>(node)) {
+            int slot = -1;
+            for (size_t i = 0; i < dag.variables.size(); ++i) if (dag.variables[i] == v->name) slot = (int)i;
+            if (slot < 0) { slot = (int)dag.variables.size(); dag.variables.push_back(v->name); }
+            ExprDAG::Node n{ExprDAG::VAR};
+            n.var = slot;
+            return intern(n);
+        }
+        if (const UnaryNode *u = dynamic_cast<const UnaryNode*>(node)) return u->op == '-' ? negate(operands[0]) : operands[0];
+        if (const BinaryNode *b = dynamic_cast<const BinaryNode*>(node)) {
+            int l = operands[0], r = operands[1];
+            switch (b->op) {
+                case '+': return binary(ExprDAG::ADD, l, r);
+                case '-': return binary(ExprDAG::SUB, l, r);
+                case '*': return binary(ExprDAG::MUL, l, r);
+                case '/': return binary(ExprDAG::DIV, l, r);
+            }
+        }
+        throw std::runtime_error("Unknown AST node");
+    }
+
+    int build(const ASTNode *root) {
+        WalkStack<int> ids;
+        walkPostorder(root, [&](const ASTNode *n, int arity) {
+            int operands[2] = {-1, -1};
+            while (arity-- > 0) operands[arity] = ids.pop();
+            ids.push(build(n, operands));
+        });
+        return ids.pop();
+    }
+
+public:
+    ExprDAG optimize(const ASTNode *root, OptimizeStats *stats = nullptr) {
+        dag = ExprDAG{};
+        interned.clear();
+        visited = 0;
+        dag.root = build(root);
+        // folding leaves constants and subtrees nothing refers to any more
+        ExprDAG live = compact();
+        if (stats) {
+            stats->astNodes = visited;
+            stats->simplifiedNodes = live.treeSize();
+            stats->dagNodes = live.nodes.size();
+        }
+        return live;
+    }
+
+private:
+    // Keeps only the nodes reachable from the root, in the same order
+    ExprDAG compact() const {
+        std::vector<char> used(dag.nodes.size(), 0);
+        used[dag.root] = 1;
+        for (size_t i = dag.nodes.size(); i-- > 0;) {
+            if (!used[i]) continue;
+            if (dag.nodes[i].a >= 0) used[dag.nodes[i].a] = 1;
+            if (dag.nodes[i].b >= 0) used[dag.nodes[i].b] = 1;
+        }
+        ExprDAG out;
+        out.variables = dag.variables;
+        std::vector<int> newId(dag.nodes.size(), -1);
+        for (size_t i = 0; i < dag.nodes.size(); ++i) {
+            if (!used[i]) continue;
+            ExprDAG::Node n = dag.nodes[i];
+            if (n.a >= 0) n.a = newId[n.a];
+            if (n.b >= 0) n.b = newId[n.b];
+            newId[i] = (int)out.nodes.size();
+            out.nodes.push_back(n);
+        }
+        out.root = newId[dag.root];
+        return out;
+    }
+};
+
+inline ExprDAG optimizeAST(const ASTNode *root, OptimizeStats *stats = nullptr) { return ExprOptimizer().optimize(root, stats); }
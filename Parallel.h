@@ -0,0 +1,114 @@
+#pragma once
+#include "DFA.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <string>
+#include <istream>
+#include <cstdint>
+
+// Multi-core matching on top of the immutable engines. Any matcher with a
+// const matches(const char*, size_t) works: DFA, BitParallelMatcher, Regex.
+// They are only read while matching, so one instance serves every worker.
+
+// Matches every subject; result[i] is 1 if subjects[i] matched
+template <class Matcher>
+std::vector<char> matchBatch(const Matcher &m, const std::vector<std::string> &subjects, ThreadPool &pool, size_t grain = 1024) {
+    std::vector<char> result(subjects.size(), 0);
+    pool.parallelFor(0, subjects.size(), grain, [&](size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) result[i] = m.matches(subjects[i].data(), subjects[i].size()) ? 1 : 0;
+    });
+    return result;
+}
+
+// Newline-separated subjects from a stream, matched batchSize lines at a time.
+// onResult(lineNumber, line, matched) is called in input order.
+template <class Matcher, class OnResult>
+void matchStream(const Matcher &m, std::istream &in, ThreadPool &pool, OnResult &&onResult, size_t batchSize = 1 << 16) {
+    std::vector<std::string> batch;
+    uint64_t lineNumber = 1;
+    std::string line;
+    auto flush = [&] {
+        std::vector<char> r = matchBatch(m, batch, pool);
+        for (size_t i = 0; i < batch.size(); ++i) onResult(lineNumber++, batch[i], r[i] != 0);
+        batch.clear();
+    };
+    while (std::getline(in, line)) {
+        batch.push_back(std::move(line));
+        if (batch.size() == batchSize) flush();
+    }
+    if (!batch.empty()) flush();
+}
+
+// Where every DFA state ends up after reading p[0, n): map[q] is the state
+// reached from q. Starting from all states at once would cost numStates
+// lookups per byte, but runs that reach the same state stay together, so the
+// runs are merged every few bytes and usually collapse to a handful.
+inline std::vector<int32_t> dfaStateMap(const DFA &dfa, const char *p, size_t n) {
+    const int32_t *t = dfa.table.data();
+    const uint8_t *cls = dfa.byteClass.data();
+    const size_t width = (size_t)dfa.numClasses;
+    size_t numStates = (size_t)dfa.numStates;
+    // the dead state never leaves itself, so only the live states are run
+    std::vector<int32_t> runs(numStates - 1);   // current state of each distinct run
+    std::vector<int32_t> runOf(numStates - 1);  // run that live start state q + 1 follows
+    for (size_t q = 0; q + 1 < numStates; ++q) runs[q] = (int32_t)(q + 1), runOf[q] = (int32_t)q;
+    if (runs.empty()) return std::vector<int32_t>(numStates, DFA::DEAD);
+    std::vector<int32_t> slot(numStates, -1);
+    std::vector<int32_t> remap;
+    const size_t MERGE_EVERY = 16;
+    for (size_t i = 0; i < n; ) {
+        size_t stop = std::min(n, i + MERGE_EVERY);
+        for (; i < stop; ++i) {
+            size_t c = cls[(unsigned char)p[i]];
+            for (auto &s : runs) s = t[(size_t)s * width + c];
+        }
+        // merge runs that are in the same state
+        remap.resize(runs.size());
+        size_t k = 0;
+        for (size_t r = 0; r < runs.size(); ++r) {
+            int32_t s = runs[r];
+            if (slot[s] < 0) { slot[s] = (int32_t)k; runs[k++] = s; }
+            remap[r] = slot[s];
+        }
+        for (size_t r = 0; r < k; ++r) slot[runs[r]] = -1;
+        runs.resize(k);
+        for (auto &r : runOf) r = remap[r];
+        if (k == 1) {
+            // every start state converged: finish with a single run
+            int32_t s = runs[0];
+            for (; i < n; ++i) s = t[(size_t)s * width + cls[(unsigned char)p[i]]];
+            runs[0] = s;
+            break;
+        }
+    }
+    std::vector<int32_t> map(numStates, DFA::DEAD);
+    for (size_t q = 0; q + 1 < numStates; ++q) map[q + 1] = runs[runOf[q]];
+    return map;
+}
+
+// Data-parallel match of one large input. The first chunk runs from the start
+// state as usual; every other chunk is run from all states at once
+// (dfaStateMap), and the per-chunk maps are composed in order at the end.
+inline bool matchParallel(const DFA &dfa, const char *p, size_t n, ThreadPool &pool, size_t minChunk = 1 << 16) {
+    // speculation costs extra work, so it only pays with more than one thread
+    size_t chunks = pool.size() > 1 ? std::max<size_t>(1, std::min(pool.size() * 4, n / minChunk)) : 1;
+    if (chunks == 1) return dfa.matches(p, n);
+    size_t step = (n + chunks - 1) / chunks;
+    int32_t first = DFA::DEAD;
+    std::vector<std::vector<int32_t>> maps(chunks);
+    pool.parallelFor(0, chunks, 1, [&](size_t from, size_t to) {
+        for (size_t c = from; c < to; ++c) {
+            size_t lo = c * step, hi = std::min(n, lo + step);
+            if (c == 0) {
+                int32_t s = dfa.start;
+                for (size_t i = lo; i < hi; ++i) s = dfa.next(s, (unsigned char)p[i]);
+                first = s;
+            } else {
+                maps[c] = dfaStateMap(dfa, p + lo, hi > lo ? hi - lo : 0);
+            }
+        }
+    });
+    int32_t s = first;
+    for (size_t c = 1; c < chunks; ++c) s = maps[c][s];
+    return dfa.accept[s] != 0;
+}
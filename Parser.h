@@ -1,14 +1,40 @@
 #pragma once
 #include "Lexer.h"
+#include "Arena.h"
+#include "Stats.h"
 #include <vector>
 #include <string>
 #include <memory>
 #include <stdexcept>
 #include <iostream>
+#include <map>
+#include <utility>
 
-// AST for arithmetic expressions
+// AST for arithmetic expressions. Nodes come from the heap or from an Arena
+// (new (arena) NumberNode(...)). A small header in front of every node says
+// which, so the same unique_ptr<ASTNode> tree works for both: deleting an
+// arena node only runs its destructor and leaves the memory to the arena.
 struct ASTNode {
     virtual ~ASTNode() = default;
+
+    // The node's children, left to right, into out; returns how many (0-2).
+    // Tree walks use these instead of recursing into the node types.
+    virtual int operands(const ASTNode *out[2]) const { (void)out; return 0; }
+    // Same, handing over ownership: the node is left without children
+    virtual int detach(ASTNode *out[2]) { (void)out; return 0; }
+
+    static void *operator new(size_t size) { return place(::operator new(size + HEADER), false); }
+    static void *operator new(size_t size, Arena &arena) { return place(arena.allocate(size + HEADER), true); }
+    static void operator delete(void *p) {
+        if (!p) return;
+        char *base = (char *)p - HEADER;
+        if (!*(bool *)base) ::operator delete(base);
+    }
+    static void operator delete(void *, Arena &) {} // constructor threw: the arena keeps the memory
+
+private:
+    static constexpr size_t HEADER = alignof(std::max_align_t);
+    static void *place(void *mem, bool inArena) { *(bool *)mem = inArena; return (char *)mem + HEADER; }
 };
 
 struct NumberNode : ASTNode {
@@ -16,19 +42,167 @@ struct NumberNode : ASTNode {
     explicit NumberNode(double v) : value(v) {}
 };
 
+struct VariableNode : ASTNode {
+    std::string name;
+    explicit VariableNode(std::string n) : name(std::move(n)) {}
+};
+
+// Stack for walking trees without recursion: the first N entries live in
+// the walker's own frame, deeper trees spill to the heap
+template <class T, size_t N = 64>
+class WalkStack {
+    T local[N];
+    std::vector<T> heap;
+    T *data = local;
+    size_t n = 0, cap = N;
+public:
+    WalkStack() = default;
+    WalkStack(const WalkStack&) = delete; // data points into this object's own local
+    WalkStack &operator=(const WalkStack&) = delete;
+    bool empty() const { return n == 0; }
+    size_t size() const { return n; }
+    T &top() { return data[n - 1]; }
+    T pop() { return data[--n]; }
+    void push(const T &v) {
+        if (n == cap) {
+            std::vector<T> bigger(cap * 2);
+            std::copy(data, data + n, bigger.begin());
+            heap.swap(bigger);
+            data = heap.data();
+            cap *= 2;
+        }
+        data[n++] = v;
+    }
+};
+
+// Deletes the trees under a node one node at a time, detaching each node's
+// children first, so a million-deep tree doesn't mean a million nested
+// destructor calls
+inline void destroySubtrees(ASTNode *a, ASTNode *b);
+
+// Node destructors delete shallow subtrees the usual way, recursively, and
+// hand whatever lies deeper than MAX_RECURSIVE_DESTROY to destroySubtrees
+constexpr int MAX_RECURSIVE_DESTROY = 256;
+inline void destroyChildren(ASTNode *a, ASTNode *b) {
+    static thread_local int depth = 0;
+    if (depth >= MAX_RECURSIVE_DESTROY) { destroySubtrees(a, b); return; }
+    ++depth;
+    delete a;
+    delete b;
+    --depth;
+}
+
 struct UnaryNode : ASTNode {
     char op;
     std::unique_ptr<ASTNode> child;
     UnaryNode(char o, std::unique_ptr<ASTNode> c) : op(o), child(std::move(c)) {}
+    ~UnaryNode() override { if (child) destroyChildren(child.release(), nullptr); }
+    int operands(const ASTNode *out[2]) const override { out[0] = child.get(); return 1; }
+    int detach(ASTNode *out[2]) override { out[0] = child.release(); return 1; }
 };
 
 struct BinaryNode : ASTNode {
     char op;
     std::unique_ptr<ASTNode> left, right;
     BinaryNode(char o, std::unique_ptr<ASTNode> l, std::unique_ptr<ASTNode> r) : op(o), left(std::move(l)), right(std::move(r)) {}
+    ~BinaryNode() override { if (left || right) destroyChildren(left.release(), right.release()); }
+    int operands(const ASTNode *out[2]) const override { out[0] = left.get(); out[1] = right.get(); return 2; }
+    int detach(ASTNode *out[2]) override { out[0] = left.release(); out[1] = right.release(); return 2; }
+};
+
+inline void destroySubtrees(ASTNode *a, ASTNode *b) {
+    WalkStack<ASTNode *> pending;
+    if (a) pending.push(a);
+    if (b) pending.push(b);
+    while (!pending.empty()) {
+        ASTNode *node = pending.pop();
+        ASTNode *children[2];
+        for (int i = 0, n = node->detach(children); i < n; ++i) if (children[i]) pending.push(children[i]);
+        delete node; // childless now
+    }
+}
+
+// Visits every node after its children, left before right, with an explicit
+// stack: machine-generated expressions can nest deeper than the call stack.
+// visit(node, arity) gets the node and its number of children.
+template <class Visit>
+void walkPostorder(const ASTNode *root, Visit &&visit) {
+    struct Frame { const ASTNode *node; int arity; }; // arity -1: children not pushed yet
+    WalkStack<Frame> stack;
+    stack.push(Frame{root, -1});
+    while (!stack.empty()) {
+        Frame &f = stack.top();
+        if (f.arity >= 0) { visit(f.node, f.arity); stack.pop(); continue; }
+        const ASTNode *children[2];
+        int n = f.arity = f.node ? f.node->operands(children) : 0;
+        while (n-- > 0) stack.push(Frame{children[n], -1});
+    }
+}
+
+// Operand and operator stacks of parseOperatorPrecedence, kept by a parser
+// so their capacity carries over from one parse to the next
+struct ParseStacks {
+    struct PendingOp { char op; int prec; }; // '(' 0, + - 1, * / 2, unary + - 3
+    std::vector<std::unique_ptr<ASTNode>> operands;
+    std::vector<PendingOp> ops;
 };
 
-class Parser {
+// The arithmetic grammar
+//   expr    := unary (('+' | '-' | '*' | '/') unary)*   (* / bind tighter; all left-associative)
+//   unary   := ('+' | '-')* primary
+//   primary := number | name | '(' expr ')'
+// parsed by operator precedence with explicit stacks, so neither nesting
+// depth nor a run of unary operators uses the call stack. Nodes are built in
+// the order a recursive descent builds them. front supplies tokens and nodes:
+//   type(), op() (the operator character), advance(),
+//   leaf() (a number or name node, or throws), unary(op, child), binary(op, left, right)
+// Stops at the first token that can't continue the expression.
+template <class Front>
+std::unique_ptr<ASTNode> parseOperatorPrecedence(Front &front, ParseStacks &st) {
+    st.operands.clear();
+    st.ops.clear();
+    size_t open = 0;                 // unclosed '('
+    std::unique_ptr<ASTNode> operand; // the newest; older ones wait in st.operands for their operator
+    auto reduce = [&] {
+        ParseStacks::PendingOp p = st.ops.back();
+        st.ops.pop_back();
+        if (p.prec == 3) { operand = front.unary(p.op, std::move(operand)); return; }
+        operand = front.binary(p.op, std::move(st.operands.back()), std::move(operand));
+        st.operands.pop_back();
+    };
+    for (;;) {
+        // operand: prefix operators and '(' up to a number or name
+        for (TokenType t = front.type(); t == TOK_PLUS || t == TOK_MINUS || t == TOK_LPAREN; t = front.type()) {
+            if (t == TOK_LPAREN) { st.ops.push_back({'(', 0}); open++; }
+            else st.ops.push_back({front.op(), 3});
+            front.advance();
+        }
+        operand = front.leaf();
+        // then any ')' closing groups, and a binary operator or the end
+        while (front.type() == TOK_RPAREN && open > 0) {
+            while (st.ops.back().prec != 0) reduce();
+            st.ops.pop_back();
+            open--;
+            front.advance();
+        }
+        TokenType t = front.type();
+        int prec = t == TOK_PLUS || t == TOK_MINUS ? 1 : t == TOK_TIMES || t == TOK_DIVIDE ? 2 : 0;
+        if (prec == 0) {
+            if (open > 0) throw std::runtime_error("Expected )");
+            break;
+        }
+        while (!st.ops.empty() && st.ops.back().prec >= prec) reduce();
+        st.ops.push_back({front.op(), prec});
+        st.operands.push_back(std::move(operand));
+        front.advance();
+    }
+    while (!st.ops.empty()) reduce();
+    return operand;
+}
+
+// BasicParser<NoTrace> builds the same tree without filling trace
+template <class Trace = FullTrace>
+class BasicParser {
     const std::vector<Token> *tokens = nullptr;
     size_t pos = 0;
 public:
@@ -37,100 +211,228 @@ public:
     void setTokens(const std::vector<Token> &toks) { tokens = &toks; pos = 0; trace.clear(); }
 
     const Token &peek() const { static Token e={TOK_END,"",0}; if (!tokens) return e; if (pos < tokens->size()) return (*tokens)[pos]; return (*tokens).back(); }
-    Token next() { if (!tokens) return {TOK_END, "", 0}; return (*tokens)[pos++]; }
-
-    std::unique_ptr<ASTNode> parseExpression() { return parseAddSub(); }
-
-    std::unique_ptr<ASTNode> parseAddSub() {
-        auto node = parseMulDiv();
-        while (true) {
-            Token t = peek();
-            if (t.type == TOK_PLUS || t.type == TOK_MINUS) {
-                next();
-                auto rhs = parseMulDiv();
-                node = std::make_unique<BinaryNode>(t.value[0], std::move(node), std::move(rhs));
-                trace.push_back(std::string("Binary ") + t.value);
-            } else break;
+    const Token &next() { const Token &t = peek(); if (tokens && pos < tokens->size()) pos++; return t; }
+
+    std::unique_ptr<ASTNode> parseExpression() {
+        StageTimer timer(EngineStats::PARSE);
+        Front front{*this};
+        return parseOperatorPrecedence(front, stacks);
+    }
+
+private:
+    ParseStacks stacks;
+
+    // parseOperatorPrecedence's view of the token vector, recording the trace
+    struct Front {
+        BasicParser &p;
+        TokenType type() const { return p.peek().type; }
+        char op() const { return p.peek().value[0]; }
+        void advance() { p.next(); }
+
+        std::unique_ptr<ASTNode> leaf() {
+            const Token &t = p.peek();
+            if (t.type == TOK_NUMBER) {
+                p.next();
+                double v = std::stod(t.value);
+                if constexpr (Trace::enabled) p.trace.push_back(std::string("Number ") + t.value);
+                if constexpr (Trace::events) record(TraceEvent::NUMBER, 0, &t.value);
+                return std::make_unique<NumberNode>(v);
+            }
+            if (t.type == TOK_IDENT) {
+                p.next();
+                if constexpr (Trace::enabled) p.trace.push_back(std::string("Variable ") + t.value);
+                if constexpr (Trace::events) record(TraceEvent::VARIABLE, 0, &t.value);
+                return std::make_unique<VariableNode>(std::string(t.value));
+            }
+            throw std::runtime_error("Unexpected token in primary: " + t.value);
         }
-        return node;
-    }
-
-    std::unique_ptr<ASTNode> parseMulDiv() {
-        auto node = parseUnary();
-        while (true) {
-            Token t = peek();
-            if (t.type == TOK_TIMES || t.type == TOK_DIVIDE) {
-                next();
-                auto rhs = parseUnary();
-                node = std::make_unique<BinaryNode>(t.value[0], std::move(node), std::move(rhs));
-                trace.push_back(std::string("Binary ") + t.value);
-            } else break;
+
+        std::unique_ptr<ASTNode> unary(char op, std::unique_ptr<ASTNode> child) {
+            if constexpr (Trace::enabled) p.trace.push_back(std::string("Unary ") + op);
+            if constexpr (Trace::events) record(TraceEvent::UNARY, op);
+            return std::make_unique<UnaryNode>(op, std::move(child));
         }
-        return node;
-    }
 
-    std::unique_ptr<ASTNode> parseUnary() {
-        Token t = peek();
-        if (t.type == TOK_PLUS || t.type == TOK_MINUS) {
-            next();
-            auto child = parseUnary();
-            trace.push_back(std::string("Unary ") + t.value);
-            return std::make_unique<UnaryNode>(t.value[0], std::move(child));
+        std::unique_ptr<ASTNode> binary(char op, std::unique_ptr<ASTNode> l, std::unique_ptr<ASTNode> r) {
+            auto node = std::make_unique<BinaryNode>(op, std::move(l), std::move(r));
+            if constexpr (Trace::enabled) p.trace.push_back(std::string("Binary ") + op);
+            if constexpr (Trace::events) record(TraceEvent::BINARY, op);
+            return node;
         }
-        return parsePrimary();
+    };
+
+    static void record(TraceEvent::Op op, char ch, const std::string *text = nullptr) {
+        if (TraceLog *log = activeTraceLog()) log->push(TraceEvent{TraceEvent::PARSE, op, ch, text ? log->intern(*text) : 0});
     }
+};
+
+using Parser = BasicParser<FullTrace>;
 
-    std::unique_ptr<ASTNode> parsePrimary() {
-        Token t = peek();
-        if (t.type == TOK_NUMBER) {
-            next();
-            double v = std::stod(t.value);
-            trace.push_back(std::string("Number ") + t.value);
-            return std::make_unique<NumberNode>(v);
+// Allocation-free front end for evaluating many expressions: tokens are
+// scanned on demand from the caller's text, numbers go through from_chars,
+// and nodes live in an arena that is rewound before every parse. Same grammar
+// and the same tree as Parser, without the trace.
+class ArenaParser {
+    Arena arena;
+    std::unique_ptr<ASTNode> root;
+    ExprScanner scanner;
+    const TokenView *scanned = nullptr, *scannedEnd = nullptr; // pre-scanned tokens, if parsing those
+    TokenView tok{TOK_END, std::string_view(), 0};
+
+    void advance() {
+        if (!scanned) tok = scanner.next();
+        else if (scanned < scannedEnd) tok = *scanned++;
+        else tok = TokenView{TOK_END, std::string_view(), tok.pos};
+    }
+    template <class Node, class... Args>
+    std::unique_ptr<ASTNode> make(Args &&...args) { return std::unique_ptr<ASTNode>(new (arena) Node(std::forward<Args>(args)...)); }
+
+    ParseStacks stacks;
+
+    // parseOperatorPrecedence's view of the scanner
+    struct Front {
+        ArenaParser &p;
+        TokenType type() const { return p.tok.type; }
+        char op() const { return p.tok.text[0]; }
+        void advance() { p.advance(); }
+
+        std::unique_ptr<ASTNode> leaf() {
+            if (p.tok.type == TOK_NUMBER) {
+                double v = p.tok.number;
+                p.advance();
+                return p.make<NumberNode>(v);
+            }
+            if (p.tok.type == TOK_IDENT) {
+                std::string name(p.tok.text); // short names fit the small-string buffer
+                p.advance();
+                return p.make<VariableNode>(std::move(name));
+            }
+            throw std::runtime_error("Unexpected token in primary: " + std::string(p.tok.text));
         }
-        if (t.type == TOK_LPAREN) {
-            next();
-            auto inside = parseExpression();
-            if (peek().type == TOK_RPAREN) next();
-            else throw std::runtime_error("Expected )");
-            return inside;
+        std::unique_ptr<ASTNode> unary(char op, std::unique_ptr<ASTNode> child) { return p.make<UnaryNode>(op, std::move(child)); }
+        std::unique_ptr<ASTNode> binary(char op, std::unique_ptr<ASTNode> l, std::unique_ptr<ASTNode> r) {
+            return p.make<BinaryNode>(op, std::move(l), std::move(r));
         }
-        throw std::runtime_error("Unexpected token in primary: " + t.value);
+    };
+
+    std::unique_ptr<ASTNode> parseTokens() {
+        Front front{*this};
+        return parseOperatorPrecedence(front, stacks);
     }
+
+public:
+    // The returned tree stays valid until the next parse() or reset()
+    const ASTNode *parse(std::string_view text) {
+        StageTimer timer(EngineStats::PARSE);
+        reset();
+        scanned = scannedEnd = nullptr;
+        scanner.reset(text);
+        advance();
+        root = parseTokens();
+        return root.get();
+    }
+
+    // Same, from tokens an ExprScanner produced earlier (without the TOK_END)
+    const ASTNode *parse(const TokenView *tokens, size_t count) {
+        StageTimer timer(EngineStats::PARSE);
+        reset();
+        scanned = tokens;
+        scannedEnd = tokens + count;
+        advance();
+        root = parseTokens();
+        return root.get();
+    }
+
+    // false if the last parse stopped before the end of its input ("1 2")
+    bool consumedAll() const { return tok.type == TOK_END; }
+
+    // Drops the current tree and rewinds the arena
+    void reset() {
+        root.reset();
+        stacks.operands.clear(); // nodes a failed parse left behind
+        arena.reset();
+    }
+
+    const Arena &memory() const { return arena; }
 };
 
-// Evaluate AST with trace
-inline double evalAST(const ASTNode *node, std::vector<std::string> &trace) {
-    if (const NumberNode *n = dynamic_cast<const NumberNode*>(node)) return n->value;
-    if (const UnaryNode *u = dynamic_cast<const UnaryNode*>(node)) {
-        double v = evalAST(u->child.get(), trace);
-        if (u->op == '-') { trace.push_back("Unary -: " + std::to_string(v)); return -v; }
-        trace.push_back(std::string("Unary ") + u->op + ": " + std::to_string(v));
-        return v;
-    }
-    if (const BinaryNode *b = dynamic_cast<const BinaryNode*>(node)) {
-        double l = evalAST(b->left.get(), trace);
-        double r = evalAST(b->right.get(), trace);
+// Values of the variables an expression refers to
+using Variables = std::map<std::string, double>;
+
+// One node's value from its operands' (the values of its arity children).
+// Only UnaryNode and BinaryNode have children, so arity tells them apart
+// without a dynamic_cast.
+template <class Trace>
+double evalNode(const ASTNode *node, int arity, const double *operands, std::vector<std::string> &trace, const Variables *vars) {
+    if (const NumberNode *n = arity == 0 ? dynamic_cast<const NumberNode*>(node) : nullptr) return n->value;
+    if (const VariableNode *v = arity == 0 ? dynamic_cast<const VariableNode*>(node) : nullptr) {
+        auto it = vars ? vars->find(v->name) : Variables::const_iterator();
+        if (!vars || it == vars->end()) throw std::runtime_error("Unknown variable: " + v->name);
+        if constexpr (Trace::enabled) trace.push_back("Variable " + v->name + ": " + std::to_string(it->second));
+        if constexpr (Trace::events) if (TraceLog *log = activeTraceLog())
+            log->push(TraceEvent{TraceEvent::EVAL, TraceEvent::VARIABLE, 0, log->intern(v->name), 0, it->second});
+        return it->second;
+    }
+    if (arity == 1) {
+        const UnaryNode *u = static_cast<const UnaryNode*>(node);
+        double v = operands[0];
+        if constexpr (Trace::enabled) trace.push_back(std::string("Unary ") + u->op + ": " + std::to_string(v));
+        if constexpr (Trace::events) if (TraceLog *log = activeTraceLog()) log->push(TraceEvent{TraceEvent::EVAL, TraceEvent::UNARY, u->op, 0, 0, v});
+        return u->op == '-' ? -v : v;
+    }
+    if (arity == 2) {
+        const BinaryNode *b = static_cast<const BinaryNode*>(node);
+        double l = operands[0], r = operands[1];
+        static const char *const names[] = {"Add", "Sub", "Mul", "Div"};
+        int k;
+        double result;
         switch (b->op) {
-            case '+': trace.push_back("Add: " + std::to_string(l) + " + " + std::to_string(r)); return l + r;
-            case '-': trace.push_back("Sub: " + std::to_string(l) + " - " + std::to_string(r)); return l - r;
-            case '*': trace.push_back("Mul: " + std::to_string(l) + " * " + std::to_string(r)); return l * r;
-            case '/': trace.push_back("Div: " + std::to_string(l) + " / " + std::to_string(r)); return l / r;
+            case '+': k = 0; result = l + r; break;
+            case '-': k = 1; result = l - r; break;
+            case '*': k = 2; result = l * r; break;
+            case '/': k = 3; result = l / r; break;
+            default: throw std::runtime_error("Unknown AST node");
         }
+        if constexpr (Trace::events) if (TraceLog *log = activeTraceLog()) log->push(TraceEvent{TraceEvent::EVAL, TraceEvent::BINARY, b->op, 0, 0, l, r});
+        if constexpr (Trace::enabled) trace.push_back(std::string(names[k]) + ": " + std::to_string(l) + " " + b->op + " " + std::to_string(r));
+        else (void)k;
+        return result;
     }
     throw std::runtime_error("Unknown AST node");
 }
 
-// Render AST as indented text
+// Evaluate AST with trace; evalAST<NoTrace> leaves trace untouched
+template <class Trace = FullTrace>
+double evalAST(const ASTNode *node, std::vector<std::string> &trace, const Variables *vars = nullptr) {
+    StageTimer timer(EngineStats::EVAL);
+    // postorder: a node's operands are the top values when it is visited
+    WalkStack<double> values;
+    walkPostorder(node, [&](const ASTNode *n, int arity) {
+        double operands[2] = {0, 0};
+        for (int i = arity; i-- > 0;) operands[i] = values.pop();
+        values.push(evalNode<Trace>(n, arity, operands, trace, vars));
+    });
+    return values.pop();
+}
+
+// Render AST as indented text, preorder from an explicit stack
 inline void renderAST(const ASTNode *node, std::ostream &os, int indent=0) {
-    std::string pad(indent, ' ');
-    if (const NumberNode *n = dynamic_cast<const NumberNode*>(node)) os << pad << "Number(" << n->value << ")\n";
-    else if (const UnaryNode *u = dynamic_cast<const UnaryNode*>(node)) {
-        os << pad << "Unary(" << u->op << ")\n";
-        renderAST(u->child.get(), os, indent+2);
-    } else if (const BinaryNode *b = dynamic_cast<const BinaryNode*>(node)) {
-        os << pad << "Binary(" << b->op << ")\n";
-        renderAST(b->left.get(), os, indent+2);
-        renderAST(b->right.get(), os, indent+2);
+    WalkStack<std::pair<const ASTNode *, int>> stack;
+    stack.push({node, indent});
+    std::string spaces; // the deepest indent so far; each line writes a prefix of it
+    while (!stack.empty()) {
+        auto [n, depth] = stack.pop();
+        if ((size_t)depth > spaces.size()) spaces.resize(depth, ' ');
+        os.write(spaces.data(), depth);
+        if (const NumberNode *num = dynamic_cast<const NumberNode*>(n)) os << "Number(" << num->value << ")\n";
+        else if (const VariableNode *v = dynamic_cast<const VariableNode*>(n)) os << "Variable(" << v->name << ")\n";
+        else if (const UnaryNode *u = dynamic_cast<const UnaryNode*>(n)) {
+            os << "Unary(" << u->op << ")\n";
+            stack.push({u->child.get(), depth + 2});
+        } else if (const BinaryNode *b = dynamic_cast<const BinaryNode*>(n)) {
+            os << "Binary(" << b->op << ")\n";
+            stack.push({b->right.get(), depth + 2});
+            stack.push({b->left.get(), depth + 2});
+        }
     }
 }
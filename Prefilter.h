@@ -0,0 +1,167 @@
+#pragma once
+#include "NFA.h"
+#include "Simd.h"
+#include <string>
+#include <vector>
+#include <stack>
+#include <cstring>
+#include <cstdint>
+
+// Literals every match of a regex must contain, read off the postfix form.
+// prefix/suffix: every match starts/ends with them. required: some string
+// every match contains (the longest one found). exact: the regex matches
+// exactly one string, held in prefix.
+struct RegexLiterals {
+    std::string prefix, suffix, required;
+    bool exact = false;
+};
+
+inline RegexLiterals extractLiterals(const std::string &postfix) {
+    auto longest = [](const std::string &a, const std::string &b) -> const std::string & { return a.size() >= b.size() ? a : b; };
+    auto commonPrefix = [](const std::string &a, const std::string &b) {
+        size_t i = 0;
+        while (i < a.size() && i < b.size() && a[i] == b[i]) ++i;
+        return a.substr(0, i);
+    };
+    auto commonSuffix = [](const std::string &a, const std::string &b) {
+        size_t i = 0;
+        while (i < a.size() && i < b.size() && a[a.size() - 1 - i] == b[b.size() - 1 - i]) ++i;
+        return a.substr(a.size() - i);
+    };
+    std::stack<RegexLiterals> st;
+    PostfixReader reader(postfix);
+    char c;
+    CharClass atom;
+    while (reader.next(c, atom)) {
+        if (c == '.') {
+            RegexLiterals b = st.top(); st.pop();
+            RegexLiterals a = st.top(); st.pop();
+            RegexLiterals r;
+            r.exact = a.exact && b.exact;
+            r.prefix = a.exact ? a.prefix + b.prefix : a.prefix;
+            r.suffix = b.exact ? a.suffix + b.suffix : b.suffix;
+            r.required = longest(longest(a.required, b.required), a.suffix + b.prefix);
+            if (r.exact) r.required = r.suffix = r.prefix;
+            st.push(r);
+        } else if (c == '|') {
+            RegexLiterals b = st.top(); st.pop();
+            RegexLiterals a = st.top(); st.pop();
+            RegexLiterals r;
+            r.exact = a.exact && b.exact && a.prefix == b.prefix;
+            r.prefix = commonPrefix(a.prefix, b.prefix);
+            r.suffix = commonSuffix(a.suffix, b.suffix);
+            r.required = r.exact ? a.prefix : longest(r.prefix, r.suffix);
+            st.push(r);
+        } else if (c == '*' || c == '?' || (c == '{' && reader.repeatMin == 0)) {
+            st.top() = RegexLiterals{}; // may occur zero times: nothing is required
+        } else if (c == '+' || c == '{') {
+            st.top().exact = false; // at least once: starts, ends with and contains it
+        } else if (atom.isByte()) {
+            RegexLiterals r;
+            r.exact = true;
+            r.prefix = r.suffix = r.required = std::string(1, (char)atom.ranges[0].lo);
+            st.push(r);
+        } else {
+            st.push(RegexLiterals{}); // a class: no one byte is certain
+        }
+    }
+    return st.empty() ? RegexLiterals{} : st.top();
+}
+
+// How often the prefilter let the automaton skip work
+struct PrefilterStats {
+    uint64_t searches = 0;       // literal searches run
+    uint64_t bytesSkipped = 0;   // bytes never fed to the automaton
+    uint64_t linesSkipped = 0;   // lines rejected without the automaton
+    uint64_t linesVerified = 0;  // lines that contained the literal and were run
+    uint64_t linesMatched = 0;   // ... of which really matched
+    // share of lines the automaton never saw
+    double skipRate() const { uint64_t n = linesSkipped + linesVerified; return n ? double(linesSkipped) / n : 0.0; }
+    // share of verified candidates that matched (low means the literal is too common)
+    double hitRate() const { return linesVerified ? double(linesMatched) / linesVerified : 0.0; }
+};
+
+// memmem-style search for one literal. Candidate positions are found by
+// comparing the first and last byte of the needle against 16 (SSE2) or 32
+// (AVX2) positions at once; only candidates are checked with memcmp.
+class LiteralSearcher {
+    std::string needle;
+    bool avx2 = false;
+public:
+    LiteralSearcher() = default;
+    explicit LiteralSearcher(const std::string &lit) : needle(lit), avx2(cpuHasAVX2()) {}
+
+    bool empty() const { return needle.empty(); }
+    size_t size() const { return needle.size(); }
+    const std::string &literal() const { return needle; }
+
+    // first occurrence of the needle in [p, p+n), or nullptr
+    const char *find(const char *p, size_t n) const {
+        size_t m = needle.size();
+        if (m == 0) return p;
+        if (n < m) return nullptr;
+#ifdef RECALC_HAVE_AVX2
+        if (avx2) return findAVX2(p, n);
+#endif
+#ifdef RECALC_HAVE_SSE2
+        return findSSE2(p, n);
+#else
+        return findScalar(p, n, 0);
+#endif
+    }
+
+private:
+    const char *findScalar(const char *p, size_t n, size_t from) const {
+        size_t m = needle.size();
+        const char first = needle[0];
+        while (from + m <= n) {
+            const void *hit = std::memchr(p + from, first, n - m + 1 - from);
+            if (!hit) return nullptr;
+            size_t i = (size_t)((const char *)hit - p);
+            if (std::memcmp(p + i, needle.data(), m) == 0) return p + i;
+            from = i + 1;
+        }
+        return nullptr;
+    }
+
+#ifdef RECALC_HAVE_SSE2
+    const char *findSSE2(const char *p, size_t n) const {
+        size_t m = needle.size(), i = 0;
+        const __m128i first = _mm_set1_epi8(needle[0]), last = _mm_set1_epi8(needle[m - 1]);
+        for (; i + m - 1 + 16 <= n; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(p + i + m - 1));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+            while (mask) {
+                int bit = lowestBit(mask);
+                if (std::memcmp(p + i + bit, needle.data(), m) == 0) return p + i + bit;
+                mask &= mask - 1;
+            }
+        }
+        return findScalar(p, n, i);
+    }
+#endif
+
+#ifdef RECALC_HAVE_AVX2
+    RECALC_TARGET_AVX2 const char *findAVX2(const char *p, size_t n) const {
+        size_t m = needle.size(), i = 0;
+        const __m256i first = _mm256_set1_epi8(needle[0]), last = _mm256_set1_epi8(needle[m - 1]);
+        for (; i + m - 1 + 32 <= n; i += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + m - 1));
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+            while (mask) {
+                int bit = lowestBit(mask);
+                if (std::memcmp(p + i + bit, needle.data(), m) == 0) return p + i + bit;
+                mask &= mask - 1;
+            }
+        }
+        return findScalar(p, n, i);
+    }
+#endif
+};
+
+// The literal worth searching for before running the automaton on a regex
+inline std::string prefilterLiteral(const std::string &regex) {
+    return extractLiterals(ThompsonNFA::toPostfix(regex)).required;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "NFA.h"
+#include "FlatNFA.h"
+#include "Glushkov.h"
+#include <string>
+#include <memory>
+
+enum class RegexEngine {
+    BitParallel, // Glushkov automaton in 1, 2 or 4 machine words
+    Thompson,    // Pike VM over the flat Thompson NFA, for larger patterns
+    Counting     // counter-augmented Thompson NFA, for larger counted repetitions
+};
+
+// Compiled regex that picks its matching engine from the pattern size:
+// patterns with at most 255 symbol positions run on the bit-parallel
+// Glushkov matcher, anything bigger falls back to the Thompson NFA. Counted
+// repetitions count as their unrolled size; past the bit-parallel limit they
+// keep one copy of their body and count (ThompsonNFA::simulateCounted).
+// Immutable once built: matches() is const and safe to call from many threads.
+class Regex {
+    std::string source;
+    int numPositions = 0;
+    RegexEngine used = RegexEngine::Thompson;
+    std::unique_ptr<BitParallelMatcher<1>> bp1;
+    std::unique_ptr<BitParallelMatcher<2>> bp2;
+    std::unique_ptr<BitParallelMatcher<4>> bp4;
+    ThompsonNFA nfa;
+    FlatNFA flat;
+public:
+    explicit Regex(const std::string &pattern) : source(pattern) {
+        std::string postfix = ThompsonNFA::toPostfix(pattern);
+        numPositions = GlushkovAutomaton::countPositions(postfix);
+        if (numPositions <= BitParallelMatcher<4>::MAX_POSITIONS) {
+            GlushkovAutomaton g(postfix);
+            used = RegexEngine::BitParallel;
+            if (numPositions <= BitParallelMatcher<1>::MAX_POSITIONS) bp1 = std::make_unique<BitParallelMatcher<1>>(g);
+            else if (numPositions <= BitParallelMatcher<2>::MAX_POSITIONS) bp2 = std::make_unique<BitParallelMatcher<2>>(g);
+            else bp4 = std::make_unique<BitParallelMatcher<4>>(g);
+            return;
+        }
+        nfa.buildFromRegex<NoTrace>(pattern);
+        if (nfa.hasCounters()) { used = RegexEngine::Counting; return; }
+        flat.compile(nfa);
+    }
+
+    RegexEngine engine() const { return used; }
+    int positions() const { return numPositions; }
+    const std::string &pattern() const { return source; }
+
+    bool matches(const std::string &s) const { return matches(s.data(), s.size()); }
+
+    bool matches(const char *p, size_t n) const {
+        if (bp1) return bp1->matches(p, n);
+        if (bp2) return bp2->matches(p, n);
+        if (bp4) return bp4->matches(p, n);
+        if (used == RegexEngine::Counting) {
+            std::vector<std::string> steps; // stays empty with NoTrace
+            return nfa.simulateCounted<NoTrace>(p, n, steps);
+        }
+        // scratch per thread keeps the shared Regex read-only; it only grows, so
+        // after the first call of a thread matching allocates nothing
+        thread_local PikeVM vm;
+        vm.reset(flat);
+        return vm.matches(p, n);
+    }
+};
@@ -0,0 +1,175 @@
+#pragma once
+#include "CharClass.h"
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+
+// A parsed regex as a flat tree. Nodes are stored in postorder: operands come
+// before the operator that joins them, which is also the order of the postfix
+// spelling, so walking the array front to back builds bottom-up with no
+// recursion however deep the pattern nests.
+struct RegexNode {
+    enum Kind : uint8_t { ATOM, CONCAT, ALTERNATE, REPEAT };
+    Kind kind;
+    char op;                // REPEAT: '*', '+', '?' or '{'
+    uint32_t offset;        // where it was written (CONCAT: its right operand)
+    int lhs = -1, rhs = -1; // operands (node indices; REPEAT uses lhs); ATOM: RegexAST::ranges[lhs, rhs)
+    int min = 0, max = -1;  // '{': the bounds, max -1 unbounded
+};
+
+struct RegexAST {
+    std::vector<RegexNode> nodes;
+    std::vector<CharClass::Range> ranges; // the atoms' bytes
+    int root = -1;                        // -1 for the empty pattern
+
+    bool empty() const { return root < 0; }
+
+    CharClass atom(const RegexNode &n) const {
+        CharClass cc;
+        cc.ranges.assign(ranges.begin() + n.lhs, ranges.begin() + n.rhs);
+        return cc;
+    }
+
+    // The postfix spelling ThompsonNFA::toPostfix returns
+    std::string postfix() const {
+        std::string out;
+        for (const RegexNode &n : nodes) {
+            switch (n.kind) {
+                case RegexNode::ATOM:
+                    if (n.rhs - n.lhs == 1 && ranges[n.lhs].lo == ranges[n.lhs].hi && !CharClass::isSpecial(ranges[n.lhs].lo))
+                        out.push_back((char)ranges[n.lhs].lo);
+                    else out += atom(n).spelling();
+                    break;
+                case RegexNode::CONCAT: out.push_back('.'); break;
+                case RegexNode::ALTERNATE: out.push_back('|'); break;
+                case RegexNode::REPEAT:
+                    if (n.op == '{') out += repeatSpelling(n.min, n.max);
+                    else out.push_back(n.op);
+                    break;
+            }
+        }
+        return out;
+    }
+};
+
+// Parses an infix pattern (atoms as in CharClass.h; | alternation, ( ) groups,
+// repetitions * + ? {n} {n,} {n,m}) in one pass: shunting-yard with explicit
+// operand and operator stacks, so time is linear in the pattern and nesting
+// depth costs heap, not call stack. The empty pattern gives an empty AST.
+// Errors throw std::runtime_error "<what> at offset N", with the messages
+// StaticRegex reports: Nothing to repeat, Empty alternative, Empty group,
+// Unmatched ( and Unmatched ), besides the atom and repetition errors.
+inline RegexAST parseRegex(const std::string &re) {
+    RegexAST ast;
+    struct Pending { char op; uint32_t offset; }; // '(', '|' or '.' waiting for its right operand
+    std::vector<Pending> ops;
+    std::vector<int> operands; // nodes not joined to anything yet
+    auto fail = [](const char *why, size_t at) { return std::runtime_error(std::string(why) + " at offset " + std::to_string(at)); };
+    auto push = [&](RegexNode n) {
+        ast.nodes.push_back(n);
+        return (int)ast.nodes.size() - 1;
+    };
+    auto reduce = [&] {
+        Pending p = ops.back();
+        ops.pop_back();
+        int b = operands.back();
+        operands.pop_back();
+        operands.back() = push(RegexNode{p.op == '.' ? RegexNode::CONCAT : RegexNode::ALTERNATE, p.op, p.offset, operands.back(), b});
+    };
+    auto prec = [](char o) { return o == '.' ? 2 : o == '|' ? 1 : 0; };
+    auto binary = [&](char o, size_t at) {
+        while (!ops.empty() && prec(ops.back().op) >= prec(o)) reduce();
+        ops.push_back(Pending{o, (uint32_t)at});
+    };
+    bool operandBefore = false; // an atom, ')' or a repetition ends the text so far
+    char prev = 0;
+    for (size_t i = 0; i < re.size();) {
+        char c = re[i];
+        size_t at = i;
+        if (c == '*' || c == '+' || c == '?' || c == '{') {
+            if (!operandBefore) throw fail("Nothing to repeat", i);
+            RegexNode n{RegexNode::REPEAT, c, (uint32_t)at, operands.back()};
+            if (c == '{') parseRepeat(re, i, n.min, n.max);
+            else i++;
+            operands.back() = push(n);
+        } else if (c == '|') {
+            if (!operandBefore) throw fail("Empty alternative", i);
+            binary('|', at);
+            operandBefore = false;
+            i++;
+        } else if (c == '(') {
+            if (operandBefore) binary('.', at);
+            ops.push_back(Pending{'(', (uint32_t)at});
+            operandBefore = false;
+            i++;
+        } else if (c == ')') {
+            if (!operandBefore) throw fail(prev == '(' ? "Empty group" : "Empty alternative", i);
+            while (!ops.empty() && ops.back().op != '(') reduce();
+            if (ops.empty()) throw fail("Unmatched )", i);
+            ops.pop_back();
+            i++;
+        } else {
+            // literal bytes and escapes skip building a CharClass
+            int first = (int)ast.ranges.size();
+            if (c == '[') {
+                CharClass cc = parseBracket(re, i);
+                ast.ranges.insert(ast.ranges.end(), cc.ranges.begin(), cc.ranges.end());
+            } else if (c == '\\') {
+                unsigned char b = parseEscape(re, i);
+                ast.ranges.push_back({b, b});
+            } else {
+                ast.ranges.push_back(c == '.' ? CharClass::Range{0, 255} : CharClass::Range{(unsigned char)c, (unsigned char)c});
+                i++;
+            }
+            if (operandBefore) binary('.', at);
+            operands.push_back(push(RegexNode{RegexNode::ATOM, 0, (uint32_t)at, first, (int)ast.ranges.size()}));
+            operandBefore = true;
+        }
+        prev = c;
+    }
+    // the innermost unclosed group is reported before a missing last operand
+    for (size_t k = ops.size(); k-- > 0;) if (ops[k].op == '(') throw fail("Unmatched (", ops[k].offset);
+    if (!re.empty() && !operandBefore) throw fail("Empty alternative", re.size());
+    while (!ops.empty()) reduce();
+    ast.root = operands.empty() ? -1 : operands.back();
+    return ast;
+}
+
+// The AST of a postfix regex (ThompsonNFA::toPostfix's spelling). Operators
+// short of operands and operands no operator joins throw, naming the offset.
+inline RegexAST parsePostfix(const std::string &postfix) {
+    RegexAST ast;
+    std::vector<int> operands;
+    PostfixReader reader(postfix);
+    char c;
+    CharClass atom;
+    for (size_t at = reader.offset(); reader.next(c, atom); at = reader.offset()) {
+        RegexNode n{RegexNode::ATOM, c, (uint32_t)at};
+        if (c == 0) {
+            n.lhs = (int)ast.ranges.size();
+            ast.ranges.insert(ast.ranges.end(), atom.ranges.begin(), atom.ranges.end());
+            n.rhs = (int)ast.ranges.size();
+            ast.nodes.push_back(n);
+            operands.push_back((int)ast.nodes.size() - 1);
+            continue;
+        }
+        size_t needed = c == '.' || c == '|' ? 2 : 1;
+        if (operands.size() < needed)
+            throw std::runtime_error(std::string("Operator ") + c + " is missing an operand at offset " + std::to_string(at));
+        if (needed == 2) {
+            n.kind = c == '.' ? RegexNode::CONCAT : RegexNode::ALTERNATE;
+            n.rhs = operands.back();
+            operands.pop_back();
+        } else {
+            n.kind = RegexNode::REPEAT;
+            if (c == '{') { n.min = reader.repeatMin; n.max = reader.repeatMax; }
+        }
+        n.lhs = operands.back();
+        ast.nodes.push_back(n);
+        operands.back() = (int)ast.nodes.size() - 1;
+    }
+    if (operands.size() > 1) throw std::runtime_error("Missing operator at offset " + std::to_string(postfix.size()));
+    ast.root = operands.empty() ? -1 : operands.back();
+    return ast;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "NFA.h"
+#include "FlatNFA.h"
+#include "DFA.h"
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+#include <memory>
+
+// Which automaton a RegexSet matches with
+enum class SetEngine {
+    Thompson, // Pike VM over the combined flat NFA: linear in the NFA size per byte
+    DFA,      // combined minimized DFA: one table load per byte, may hit the state limit
+    Auto      // DFA when it fits in the state limit, Thompson otherwise
+};
+
+// Many patterns compiled into one automaton. Each accept state is tagged with
+// its pattern's index, so a single pass over the input finds every pattern
+// that matches it, instead of one pass per pattern.
+class RegexSet {
+    std::vector<std::string> sources;
+    ThompsonNFA nfa;
+    FlatNFA flat;
+    DFA dfa;
+    SetEngine used = SetEngine::Thompson;
+    std::vector<int> ids; // scratch for matchMask
+    std::unique_ptr<PikeVM> vm;
+public:
+    explicit RegexSet(const std::vector<std::string> &patterns, SetEngine engine = SetEngine::Auto, size_t maxDfaStates = 10000)
+        : sources(patterns) {
+        nfa.buildFromRegexSet<NoTrace>(patterns);
+        if (engine != SetEngine::Thompson) {
+            try {
+                dfa = compileDFA(nfa, maxDfaStates);
+                used = SetEngine::DFA;
+            } catch (const std::runtime_error &) {
+                if (engine == SetEngine::DFA) throw;
+            }
+        }
+        if (used == SetEngine::Thompson) {
+            flat.compile(nfa);
+            vm = std::make_unique<PikeVM>(flat);
+        }
+    }
+
+    // the Pike VM keeps a reference to flat, so a set stays where it was built
+    RegexSet(const RegexSet &) = delete;
+    RegexSet &operator=(const RegexSet &) = delete;
+
+    size_t size() const { return sources.size(); }
+    const std::string &pattern(int id) const { return sources[id]; }
+    SetEngine engine() const { return used; }
+
+    // Sorted ids of the patterns that match the whole of p[0, n)
+    std::vector<int> matches(const char *p, size_t n) {
+        std::vector<int> out;
+        matches(p, n, out);
+        return out;
+    }
+    std::vector<int> matches(const std::string &s) { return matches(s.data(), s.size()); }
+
+    void matches(const char *p, size_t n, std::vector<int> &out) {
+        if (used == SetEngine::DFA) {
+            const int32_t *t = dfa.table.data();
+            const uint8_t *cls = dfa.byteClass.data();
+            const size_t k = (size_t)dfa.numClasses;
+            int32_t s = dfa.start;
+            for (size_t i = 0; i < n; ++i) s = t[(size_t)s * k + cls[(unsigned char)p[i]]];
+            out = dfa.patterns[s];
+        } else {
+            vm->matchSet(p, n, out);
+        }
+    }
+
+    // Same result as a bitmask: bit i of word i/64 is set when pattern i matched
+    void matchMask(const char *p, size_t n, std::vector<uint64_t> &mask) {
+        matches(p, n, ids);
+        mask.assign((sources.size() + 63) / 64, 0);
+        for (int id : ids) mask[id / 64] |= uint64_t(1) << (id % 64);
+    }
+};
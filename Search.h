@@ -0,0 +1,127 @@
+#pragma once
+#include "NFA.h"
+#include "FlatNFA.h"
+#include <vector>
+#include <string>
+#include <utility>
+
+// A match found in a larger text: bytes [start, end)
+struct MatchSpan {
+    size_t start, end;
+    bool operator==(const MatchSpan &o) const { return start == o.start && end == o.end; }
+};
+
+// Unanchored search with leftmost-longest spans: of all matches, the one
+// starting earliest, and of those the longest. Both searches are Pike VM
+// passes where every thread carries a tag (the offset its match started or
+// ended at) and a state reached by several threads keeps the oldest one, so
+// each pass costs O(states) per byte however many matches overlap.
+//   findFirst: one forward pass with the start state injected at every
+//              offset until a match is seen; tags are start offsets.
+//   findAll:   one backward pass over the reverse automaton, injected at
+//              every offset; tags are end offsets, giving the longest match
+//              from each offset. Walking those left to right yields the
+//              non-overlapping spans. O(n) extra memory for an n-byte text.
+// Empty matches are reported, except one directly after a previous match.
+// Only reads the NFAs; safe to share between threads.
+class NFASearcher {
+    FlatNFA fwd, rev;
+
+    static constexpr size_t NONE = ~(size_t)0;
+
+    // Per-call scratch, as in PikeVM
+    struct Pass {
+        const FlatNFA &prog;
+        SparseSet clist, nlist;
+        std::vector<size_t> ctag, ntag;
+        std::vector<int> stack;
+        explicit Pass(const FlatNFA &p)
+            : prog(p), clist(p.size()), nlist(p.size()), ctag(p.size()), ntag(p.size()), stack(2 * p.size() + 1) {}
+
+        // Threads are added oldest first and a state keeps the first thread to
+        // reach it, so clist is always in order of age
+        void addThread(SparseSet &set, std::vector<size_t> &tags, int pc, size_t tag) {
+            size_t sp = 0;
+            stack[sp++] = pc;
+            while (sp) {
+                int cur = stack[--sp];
+                if (set.contains(cur)) continue;
+                set.insert(cur);
+                tags[cur] = tag;
+                const NInst &in = prog.insts[cur];
+                if (in.op == OP_EPS) stack[sp++] = in.x;
+                else if (in.op == OP_SPLIT) { stack[sp++] = in.y; stack[sp++] = in.x; }
+            }
+        }
+
+        // Tag of the oldest thread at a MATCH, or NONE
+        size_t oldestMatch() const {
+            for (int pc : clist) if (prog.insts[pc].op == OP_MATCH) return ctag[pc];
+            return NONE;
+        }
+
+        // Consumes byte b; threads tagged past limit are dropped
+        void step(unsigned char b, size_t limit = NONE) {
+            nlist.clear();
+            for (int pc : clist) {
+                if (ctag[pc] > limit) break;
+                const NInst &in = prog.insts[pc];
+                if (in.consumes(b)) addThread(nlist, ntag, in.x, ctag[pc]);
+            }
+            std::swap(clist, nlist);
+            std::swap(ctag, ntag);
+        }
+    };
+
+public:
+    explicit NFASearcher(const ThompsonNFA &nfa) : fwd(nfa) {
+        ThompsonNFA r;
+        r.buildReverse(nfa);
+        rev.compile(r);
+    }
+
+    bool findFirst(const std::string &s, MatchSpan &out) const { return findFirst(s.data(), s.size(), out); }
+
+    bool findFirst(const char *p, size_t n, MatchSpan &out) const {
+        if (fwd.start < 0) return false;
+        Pass pass(fwd);
+        bool found = false;
+        for (size_t i = 0;; ++i) {
+            // a new start is younger than every live thread, so the oldest
+            // thread at a MATCH is the leftmost start ending here
+            if (!found) pass.addThread(pass.clist, pass.ctag, fwd.start, i);
+            size_t s = pass.oldestMatch();
+            if (s != NONE && (!found || s <= out.start)) { out = {s, i}; found = true; }
+            if (i == n) break;
+            // later starts can't beat the one found; earlier ones still can
+            pass.step((unsigned char)p[i], found ? out.start : NONE);
+            if (found && pass.clist.empty()) break;
+        }
+        return found;
+    }
+
+    std::vector<MatchSpan> findAll(const std::string &s) const { return findAll(s.data(), s.size()); }
+
+    std::vector<MatchSpan> findAll(const char *p, size_t n) const {
+        std::vector<MatchSpan> spans;
+        if (rev.start < 0) return spans;
+        // longest[i]: end of the longest match starting at i, or NONE
+        std::vector<size_t> longest(n + 1, NONE);
+        Pass pass(rev);
+        for (size_t i = n;; --i) {
+            pass.addThread(pass.clist, pass.ctag, rev.start, i);
+            longest[i] = pass.oldestMatch();
+            if (i == 0) break;
+            pass.step((unsigned char)p[i - 1]);
+        }
+        size_t lastEnd = NONE;
+        for (size_t i = 0; i <= n;) {
+            size_t e = longest[i];
+            if (e == NONE || (e == i && i == lastEnd)) { ++i; continue; }
+            spans.push_back({i, e});
+            lastEnd = e;
+            i = e > i ? e : i + 1;
+        }
+        return spans;
+    }
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Compile-time and run-time SIMD support shared by the vectorized paths.
+// SSE2 is baseline on x86-64, so it is used whenever the compiler targets it.
+// AVX2 code is compiled per function (RECALC_TARGET_AVX2) and only called
+// after cpuHasAVX2() says the machine supports it; everything else gets the
+// scalar fallback.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RECALC_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RECALC_HAVE_AVX2 1
+#define RECALC_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define RECALC_HAVE_AVX2 1
+#define RECALC_TARGET_AVX2
+#include <immintrin.h>
+#endif
+
+inline bool cpuHasAVX2() {
+#if defined(RECALC_HAVE_AVX2) && defined(__GNUC__)
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+#elif defined(RECALC_HAVE_AVX2) && defined(_MSC_VER)
+    static const bool has = [] {
+        int info[4];
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }();
+    return has;
+#else
+    return false;
+#endif
+}
+
+// index of the lowest set bit; x must not be 0
+inline int lowestBit(uint32_t x) {
+#if defined(__GNUC__)
+    return __builtin_ctz(x);
+#elif defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (int)i;
+#else
+    int i = 0;
+    while (!(x & 1)) { x >>= 1; i++; }
+    return i;
+#endif
+}
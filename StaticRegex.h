@@ -0,0 +1,614 @@
+#pragma once
+#include "DFA.h"
+#include <array>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// Regexes fixed at build time, compiled by the compiler. The pattern goes
+// through the same steps as at run time (concatenation made explicit,
+// shunting-yard to postfix, Thompson's construction, subset construction
+// over byte classes, minimization), only in constexpr functions, and the
+// DFA comes out as static constexpr arrays. Those are constant-initialized
+// into read-only data: no startup work, no heap, and matches() can run in a
+// static_assert.
+//
+//   static constexpr char kDate[] = "[0-9]{4}-[0-9][0-9]";
+//   using Date = StaticRegex<kDate>;
+//   static_assert(Date::matches("2024-06"));
+//
+// With C++20 the pattern can be the template argument itself:
+// StaticRegexLiteral<"[0-9]{4}-[0-9][0-9]">.
+//
+// The syntax is buildFromRegex's. An invalid pattern doesn't compile;
+// checkStaticRegex says why, as a message and offset like the runtime's
+// exceptions, and is a constant expression too. Counted repetitions are
+// unrolled, and a pattern has to fit in MAX_NFA_STATES NFA states and
+// MaxStates DFA states (before minimization). Big patterns may also need a
+// higher compiler limit (-fconstexpr-ops-limit, -fconstexpr-steps).
+struct StaticRegexStatus {
+    const char *error = nullptr; // nullptr if the pattern is valid
+    size_t offset = 0;           // where in the pattern
+    constexpr bool ok() const { return error == nullptr; }
+};
+
+namespace static_regex {
+
+constexpr int MAX_NFA_STATES = 4096;
+
+constexpr size_t length(const char *s) {
+    size_t n = 0;
+    while (s[n]) ++n;
+    return n;
+}
+
+constexpr bool isDigit(char c) { return c >= '0' && c <= '9'; }
+constexpr int hexValue(char c) {
+    return isDigit(c) ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+// Records the first error only; false so callers can return it
+constexpr bool fail(StaticRegexStatus &st, const char *why, size_t at) {
+    if (st.ok()) st = StaticRegexStatus{why, at};
+    return false;
+}
+
+struct ByteSet {
+    uint64_t w[4] = {0, 0, 0, 0};
+    constexpr void add(int lo, int hi) { for (int c = lo; c <= hi; ++c) w[c >> 6] |= uint64_t(1) << (c & 63); }
+    constexpr bool has(int c) const { return (w[c >> 6] >> (c & 63)) & 1; }
+    constexpr bool empty() const { return !(w[0] | w[1] | w[2] | w[3]); }
+};
+
+// parseEscape: the byte, or -1 after an error
+constexpr int escape(const char *re, size_t n, size_t &i, StaticRegexStatus &st) {
+    size_t at = i++; // re[at] == '\\'
+    if (i >= n) { fail(st, "Dangling \\", at); return -1; }
+    char c = re[i++];
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        case 'x': {
+            if (i + 1 >= n || hexValue(re[i]) < 0 || hexValue(re[i + 1]) < 0) { fail(st, "\\x needs two hex digits", at); return -1; }
+            int v = hexValue(re[i]) * 16 + hexValue(re[i + 1]);
+            i += 2;
+            return v;
+        }
+        default: return (unsigned char)c;
+    }
+}
+
+// parseBracket
+constexpr bool bracket(const char *re, size_t n, size_t &i, ByteSet &out, StaticRegexStatus &st) {
+    size_t at = i++; // re[at] == '['
+    bool negated = i < n && re[i] == '^';
+    if (negated) i++;
+    ByteSet in;
+    for (bool first = true;; first = false) {
+        if (i >= n) return fail(st, "Unterminated character class", at);
+        if (re[i] == ']' && !first) { i++; break; }
+        size_t itemAt = i;
+        int lo = re[i] == '\\' ? escape(re, n, i, st) : (unsigned char)re[i++];
+        if (lo < 0) return false;
+        int hi = lo;
+        if (i + 1 < n && re[i] == '-' && re[i + 1] != ']') {
+            i++;
+            hi = re[i] == '\\' ? escape(re, n, i, st) : (unsigned char)re[i++];
+            if (hi < 0) return false;
+            if (hi < lo) return fail(st, "Invalid range in character class", itemAt);
+        }
+        in.add(lo, hi);
+    }
+    for (int k = 0; k < 4; ++k) out.w[k] = negated ? ~in.w[k] : in.w[k];
+    if (out.empty()) return fail(st, "Character class matches nothing", at);
+    return true;
+}
+
+constexpr bool repeatCount(const char *re, size_t n, size_t &i, int &v, size_t at, StaticRegexStatus &st) {
+    if (i >= n || !isDigit(re[i])) return fail(st, "Invalid repetition", at);
+    long x = 0;
+    while (i < n && isDigit(re[i])) {
+        x = x * 10 + (re[i++] - '0');
+        if (x > MAX_REPEAT) return fail(st, "Repetition count too large", at);
+    }
+    v = (int)x;
+    return true;
+}
+
+// parseRepeat
+constexpr bool repeat(const char *re, size_t n, size_t &i, int &min, int &max, StaticRegexStatus &st) {
+    size_t at = i++; // re[at] == '{'
+    if (!repeatCount(re, n, i, min, at, st)) return false;
+    max = min;
+    if (i < n && re[i] == ',') {
+        i++;
+        if (i < n && re[i] == '}') max = -1;
+        else if (!repeatCount(re, n, i, max, at, st)) return false;
+    }
+    if (i >= n || re[i] != '}') return fail(st, "Invalid repetition", at);
+    i++;
+    if (max >= 0 && max < min) return fail(st, "Repetition {n,m} with m < n", at);
+    if (max == 0) return fail(st, "Repetition {0} matches only the empty string", at);
+    return true;
+}
+
+// Postfix token: an operator '.', '|', '*', '+', '?' or '{' (bounds in
+// min, max), or op 0 for atom number atom
+struct Token {
+    char op = 0;
+    int atom = -1;
+    int min = 0, max = -1;
+    size_t offset = 0;
+};
+
+// A pattern of L bytes in postfix: at most L atoms and L - 1 concatenations
+template <size_t L>
+struct Postfix {
+    Token tokens[2 * L + 1] {};
+    int count = 0;
+    ByteSet atoms[L + 1] {};
+    int numAtoms = 0;
+    int nfaStates = 0; // what buildNfa will make
+    StaticRegexStatus status;
+
+    constexpr void emit(const Token &t) { tokens[count++] = t; }
+};
+
+// NFA states for a{min,max} from a of size states (see repeat below)
+constexpr long repeatedSize(long size, int min, int max) {
+    if (min == 0 && max < 0) return size + 2;
+    if (min == 1 && max < 0) return size + 1;
+    if (min == 0 && max == 1) return size + 2;
+    if (min == 1 && max == 1) return size;
+    if (max < 0) return min * size + 1;
+    return max * size + 2L * (max - min);
+}
+
+// parseRegex's shunting-yard in one pass, rejecting the same patterns with the
+// same messages; unlike parseRegex it also rejects the empty pattern. Then
+// counts the NFA states.
+template <size_t L>
+constexpr Postfix<L> parse(const char *re) {
+    Postfix<L> out;
+    StaticRegexStatus &st = out.status;
+    Token ops[L + 1] {}; // '(', '|' and '.' waiting for their right operand
+    int sp = 0;
+    bool operandBefore = false; // an atom, ')' or a repetition ends the text so far
+    char prev = 0;
+    auto prec = [](char o) { return o == '.' ? 2 : o == '|' ? 1 : 0; };
+    auto binary = [&](char o, size_t at) {
+        while (sp > 0 && prec(ops[sp - 1].op) >= prec(o)) out.emit(ops[--sp]);
+        ops[sp++] = Token{o, -1, 0, -1, at};
+    };
+    for (size_t i = 0; i < L && st.ok();) {
+        char c = re[i];
+        size_t at = i;
+        if (c == '*' || c == '+' || c == '?' || c == '{') {
+            if (!operandBefore) { fail(st, "Nothing to repeat", i); break; }
+            Token t{c, -1, 0, -1, at};
+            if (c == '{') { if (!repeat(re, L, i, t.min, t.max, st)) break; }
+            else i++;
+            out.emit(t);
+        } else if (c == '|') {
+            if (!operandBefore) { fail(st, "Empty alternative", i); break; }
+            binary('|', at);
+            operandBefore = false;
+            i++;
+        } else if (c == '(') {
+            if (operandBefore) binary('.', at);
+            ops[sp++] = Token{'(', -1, 0, -1, at};
+            operandBefore = false;
+            i++;
+        } else if (c == ')') {
+            if (!operandBefore) { fail(st, prev == '(' ? "Empty group" : "Empty alternative", i); break; }
+            while (sp > 0 && ops[sp - 1].op != '(') out.emit(ops[--sp]);
+            if (sp == 0) { fail(st, "Unmatched )", i); break; }
+            sp--;
+            i++;
+        } else {
+            ByteSet &set = out.atoms[out.numAtoms];
+            if (c == '[') { if (!bracket(re, L, i, set, st)) break; }
+            else if (c == '\\') { int b = escape(re, L, i, st); if (b < 0) break; set.add(b, b); }
+            else if (c == '.') { set.add(0, 255); i++; }
+            else { set.add((unsigned char)c, (unsigned char)c); i++; }
+            if (operandBefore) binary('.', at);
+            out.emit(Token{0, out.numAtoms++, 0, -1, at});
+            operandBefore = true;
+        }
+        prev = c;
+    }
+    while (st.ok() && sp > 0) {
+        if (ops[sp - 1].op == '(') fail(st, "Unmatched (", ops[sp - 1].offset);
+        else out.emit(ops[--sp]);
+    }
+    if (st.ok() && !operandBefore) fail(st, L == 0 ? "Empty pattern" : "Empty alternative", L);
+    if (!st.ok()) return out;
+
+    // fragment sizes, as buildNfa will make them
+    long size[L + 1] {};
+    int n = 0;
+    for (int k = 0; k < out.count; ++k) {
+        const Token &t = out.tokens[k];
+        switch (t.op) {
+            case 0: size[n++] = 2; break;
+            case '.': n--; size[n - 1] += size[n]; break;
+            case '|': n--; size[n - 1] += size[n] + 2; break;
+            case '*': case '?': size[n - 1] += 2; break;
+            case '+': size[n - 1] += 1; break;
+            default: size[n - 1] = repeatedSize(size[n - 1], t.min, t.max); break;
+        }
+        if (size[n - 1] > MAX_NFA_STATES) { fail(st, "Pattern needs more than MAX_NFA_STATES NFA states", t.offset); return out; }
+    }
+    out.nfaStates = (int)size[0];
+    return out;
+}
+
+// Thompson NFA: a state has one atom edge or up to two epsilon edges
+template <int N>
+struct Nfa {
+    struct State {
+        int atom = -1, to = -1; // edge on the bytes of atom
+        int eps0 = -1, eps1 = -1;
+    };
+    State states[N] {};
+    int count = 0, start = -1, accept = -1;
+
+    constexpr int make() { return count++; }
+    constexpr void link(int q, int t) {
+        if (states[q].eps0 < 0) states[q].eps0 = t;
+        else states[q].eps1 = t;
+    }
+};
+
+// The fragment's states are ids first.. up to the newest (NFAFragment)
+struct Frag {
+    int start = -1, accept = -1, first = -1;
+};
+
+template <int N>
+constexpr Frag concat(Nfa<N> &m, Frag a, Frag b) {
+    m.link(a.accept, b.start);
+    return Frag{a.start, b.accept, a.first};
+}
+
+template <int N>
+constexpr Frag alternate(Nfa<N> &m, Frag a, Frag b) {
+    int s = m.make(), e = m.make();
+    m.link(s, a.start);
+    m.link(s, b.start);
+    m.link(a.accept, e);
+    m.link(b.accept, e);
+    return Frag{s, e, a.first};
+}
+
+template <int N>
+constexpr Frag star(Nfa<N> &m, Frag a) {
+    int s = m.make(), e = m.make();
+    m.link(s, a.start);
+    m.link(s, e);
+    m.link(a.accept, a.start);
+    m.link(a.accept, e);
+    return Frag{s, e, a.first};
+}
+
+template <int N>
+constexpr Frag plus(Nfa<N> &m, Frag a) {
+    int e = m.make();
+    m.link(a.accept, a.start);
+    m.link(a.accept, e);
+    return Frag{a.start, e, a.first};
+}
+
+template <int N>
+constexpr Frag optional(Nfa<N> &m, Frag a) {
+    int s = m.make(), e = m.make();
+    m.link(s, a.start);
+    m.link(s, e);
+    m.link(a.accept, e);
+    return Frag{s, e, a.first};
+}
+
+constexpr Frag shifted(Frag a, int d) { return Frag{a.start + d, a.accept + d, a.first + d}; }
+
+// a{min,max} unrolled: min copies of a, then max - min nested optional ones
+// (a a (a (a)?)?), or with no max the last of min copies repeated (a a a+).
+// Copies are appended one after another, so copy j is a shifted.
+template <int N>
+constexpr Frag repeat(Nfa<N> &m, Frag a, int min, int max) {
+    if (min == 0 && max < 0) return star(m, a);
+    if (min == 1 && max < 0) return plus(m, a);
+    if (min == 0 && max == 1) return optional(m, a);
+    if (min == 1 && max == 1) return a;
+    int end = m.count, size = end - a.first, copies = max < 0 ? min : max;
+    for (int j = 1; j < copies; ++j) {
+        int d = m.count - a.first;
+        for (int q = a.first; q < end; ++q) {
+            auto s = m.states[q];
+            if (s.to >= 0) s.to += d;
+            if (s.eps0 >= 0) s.eps0 += d;
+            if (s.eps1 >= 0) s.eps1 += d;
+            m.states[m.make()] = s;
+        }
+    }
+    auto copy = [&](int j) { return shifted(a, j == 0 ? 0 : end + (j - 1) * size - a.first); };
+    Frag tail = copy(copies - 1);
+    if (max < 0) tail = plus(m, tail);
+    else if (copies - 1 >= min) tail = optional(m, tail);
+    for (int j = copies - 2; j >= 0; --j) {
+        tail = concat(m, copy(j), tail);
+        if (max >= 0 && j >= min) tail = optional(m, tail);
+    }
+    return Frag{tail.start, tail.accept, a.first};
+}
+
+// Thompson's construction over the postfix tokens (buildFragment)
+template <int N, size_t L>
+constexpr Nfa<N> buildNfa(const Postfix<L> &p) {
+    Nfa<N> m;
+    if (!p.status.ok()) return m;
+    Frag st[L + 1] {};
+    int sp = 0;
+    for (int k = 0; k < p.count; ++k) {
+        const Token &t = p.tokens[k];
+        if (t.op == 0) {
+            int s = m.make(), e = m.make();
+            m.states[s].atom = t.atom;
+            m.states[s].to = e;
+            st[sp++] = Frag{s, e, s};
+        } else if (t.op == '.' || t.op == '|') {
+            Frag b = st[--sp], a = st[--sp];
+            st[sp++] = t.op == '.' ? concat(m, a, b) : alternate(m, a, b);
+        } else {
+            Frag a = st[--sp];
+            st[sp++] = t.op == '*' ? star(m, a) : t.op == '+' ? plus(m, a) : t.op == '?' ? optional(m, a) : repeat(m, a, t.min, t.max);
+        }
+    }
+    m.start = st[0].start;
+    m.accept = st[0].accept;
+    return m;
+}
+
+// ByteClasses: bytes no atom tells apart share a class
+struct Classes {
+    uint8_t classOf[256] {};
+    uint8_t representative[256] {}; // smallest byte of each class
+    int count = 1;
+};
+
+template <size_t L>
+constexpr Classes byteClasses(const Postfix<L> &p) {
+    Classes c;
+    for (int a = 0; a < p.numAtoms; ++a) {
+        int id[512] {};
+        for (int k = 0; k < 2 * c.count; ++k) id[k] = -1;
+        int n = 0;
+        for (int b = 0; b < 256; ++b) {
+            int &k = id[2 * c.classOf[b] + p.atoms[a].has(b)];
+            if (k < 0) { k = n; c.representative[n++] = (uint8_t)b; }
+            c.classOf[b] = (uint8_t)k;
+        }
+        c.count = n;
+    }
+    return c;
+}
+
+// D states of K columns at most; state 0 is dead as in DFA
+template <int D, int K>
+struct Dfa {
+    int32_t table[D * K] {}; // numStates rows of numClasses entries
+    uint8_t accept[D] {};
+    uint8_t byteClass[256] {};
+    int numStates = 1, numClasses = 1, start = 0, statesBeforeMinimization = 1;
+    StaticRegexStatus status;
+};
+
+constexpr int lowestBit(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    int n = 0;
+    for (; !(v & 1); v >>= 1) ++n;
+    return n;
+#endif
+}
+
+constexpr uint64_t mix(uint64_t h, uint64_t v) { return (h ^ v) * 0x100000001b3ULL; }
+
+// Subset construction (compileDFA), then Moore's partition refinement and,
+// as in minimizeDFA, one column per distinct column left
+template <int D, int K, int N>
+constexpr Dfa<D, K> buildDfa(const Nfa<N> &m, const ByteSet *atoms, const Classes &cls) {
+    Dfa<D, K> out;
+    if (m.start < 0) return out;
+    constexpr int W = (N + 63) / 64;
+    uint64_t sets[D * W] {}; // NFA states of each DFA state; state 0's is empty
+    int slots[2 * D] {};     // hash of the sets: DFA state + 1, 0 if free
+    int stack[N] {};
+    uint64_t next[W] {};
+    int numStates = 1;
+
+    // next := its epsilon closure (the stack holds next's states not yet
+    // followed); returns the DFA state with that set, added if new, or -1
+    // if there would be more than D
+    int sp = 0;
+    auto add = [&](int q) {
+        if ((next[q >> 6] >> (q & 63)) & 1) return;
+        next[q >> 6] |= uint64_t(1) << (q & 63);
+        stack[sp++] = q;
+    };
+    auto intern = [&]() {
+        while (sp > 0) {
+            const auto &s = m.states[stack[--sp]];
+            if (s.eps0 >= 0) add(s.eps0);
+            if (s.eps1 >= 0) add(s.eps1);
+        }
+        uint64_t h = 0xcbf29ce484222325ULL, any = 0;
+        for (int w = 0; w < W; ++w) { h = mix(h, next[w]); any |= next[w]; }
+        if (!any) return 0;
+        for (int slot = (int)(h % (2 * D));; slot = (slot + 1) % (2 * D)) {
+            int d = slots[slot] - 1;
+            if (d < 0) break;
+            bool same = true;
+            for (int w = 0; w < W && same; ++w) same = sets[d * W + w] == next[w];
+            if (same) return d;
+        }
+        if (numStates == D) return -1;
+        int d = numStates++;
+        for (int w = 0; w < W; ++w) sets[d * W + w] = next[w];
+        for (int slot = (int)(h % (2 * D));; slot = (slot + 1) % (2 * D))
+            if (!slots[slot]) { slots[slot] = d + 1; break; }
+        return d;
+    };
+
+    add(m.start);
+    int start = intern();
+    for (int d = 1; d < numStates; ++d) {
+        for (int k = 0; k < K; ++k) {
+            for (int w = 0; w < W; ++w) next[w] = 0;
+            for (int w = 0; w < W; ++w) {
+                for (uint64_t bits = sets[d * W + w]; bits; bits &= bits - 1) {
+                    const auto &s = m.states[w * 64 + lowestBit(bits)];
+                    if (s.atom >= 0 && atoms[s.atom].has(cls.representative[k])) add(s.to);
+                }
+            }
+            int t = intern();
+            if (t < 0) { fail(out.status, "Pattern needs more than MaxStates DFA states", 0); return out; }
+            out.table[d * K + k] = t;
+        }
+        out.accept[d] = (sets[d * W + (m.accept >> 6)] >> (m.accept & 63)) & 1;
+    }
+
+    // Blocks of equivalent states, numbered in order of their first state,
+    // so the dead state's block stays 0. Refine until no block splits.
+    int block[D] {}, refined[D] {}, first[D] {};
+    for (int d = 0; d < numStates; ++d) block[d] = out.accept[d];
+    int numBlocks = 0;
+    for (;;) {
+        for (int i = 0; i < 2 * D; ++i) slots[i] = 0;
+        int n = 0;
+        for (int d = 0; d < numStates; ++d) {
+            uint64_t h = mix(0xcbf29ce484222325ULL, (uint64_t)block[d]);
+            for (int k = 0; k < K; ++k) h = mix(h, (uint64_t)block[out.table[d * K + k]]);
+            int slot = (int)(h % (2 * D));
+            for (;; slot = (slot + 1) % (2 * D)) {
+                int r = slots[slot] - 1;
+                if (r < 0) break;
+                bool same = block[r] == block[d];
+                for (int k = 0; k < K && same; ++k) same = block[out.table[r * K + k]] == block[out.table[d * K + k]];
+                if (same) break;
+            }
+            if (slots[slot]) { refined[d] = refined[slots[slot] - 1]; continue; }
+            slots[slot] = d + 1;
+            first[n] = d;
+            refined[d] = n++;
+        }
+        for (int d = 0; d < numStates; ++d) block[d] = refined[d];
+        if (n == numBlocks) break;
+        numBlocks = n;
+    }
+    int colOf[K] {};
+    int numCols = 0;
+    for (int k = 0; k < K; ++k) {
+        colOf[k] = numCols;
+        for (int c = 0; c < k && colOf[k] == numCols; ++c) {
+            bool same = true;
+            for (int b = 0; b < numBlocks && same; ++b) same = block[out.table[first[b] * K + k]] == block[out.table[first[b] * K + c]];
+            if (same) colOf[k] = colOf[c];
+        }
+        if (colOf[k] == numCols) numCols++;
+    }
+    Dfa<D, K> min;
+    min.numStates = numBlocks;
+    min.numClasses = numCols;
+    min.statesBeforeMinimization = numStates;
+    min.start = block[start];
+    for (int b = 0; b < 256; ++b) min.byteClass[b] = (uint8_t)colOf[cls.classOf[b]];
+    for (int b = 0; b < numBlocks; ++b) {
+        for (int k = 0; k < K; ++k) min.table[b * numCols + colOf[k]] = block[out.table[first[b] * K + k]];
+        min.accept[b] = out.accept[first[b]];
+    }
+    return min;
+}
+
+template <class T, size_t M>
+constexpr std::array<T, M> prefix(const T *src) {
+    std::array<T, M> a {};
+    for (size_t i = 0; i < M; ++i) a[i] = src[i];
+    return a;
+}
+
+template <const char *Pattern>
+struct PatternSource {
+    static constexpr const char *text = Pattern;
+};
+
+#if __cplusplus >= 202002L
+template <size_t K>
+struct Literal {
+    char text[K] {};
+    constexpr Literal(const char (&s)[K]) { for (size_t i = 0; i < K; ++i) text[i] = s[i]; }
+};
+
+template <Literal P>
+struct LiteralSource {
+    static constexpr const char *text = P.text;
+};
+#endif
+
+} // namespace static_regex
+
+// The pattern Source::text compiled to a minimized DFA with the same
+// layout as DFA (state 0 dead, one column per byte class). Everything is
+// static; there is nothing to construct.
+template <class Source, int MaxStates = 1024>
+class BasicStaticRegex {
+    static constexpr size_t L = static_regex::length(Source::text);
+    static constexpr auto postfix = static_regex::parse<L>(Source::text);
+    static constexpr int N = postfix.status.ok() ? postfix.nfaStates : 1;
+    static constexpr auto nfa = static_regex::buildNfa<N>(postfix);
+    static constexpr auto classes = static_regex::byteClasses(postfix);
+    static constexpr auto dfa = static_regex::buildDfa<MaxStates, classes.count>(nfa, postfix.atoms, classes);
+
+public:
+    static constexpr StaticRegexStatus status = postfix.status.ok() ? dfa.status : postfix.status;
+    static_assert(status.ok(), "invalid StaticRegex pattern; checkStaticRegex(pattern) tells why");
+
+    static constexpr int nfaStates = N;
+    static constexpr int statesBeforeMinimization = dfa.statesBeforeMinimization;
+    static constexpr int numStates = dfa.numStates;
+    static constexpr int numClasses = dfa.numClasses;
+    static constexpr int32_t start = dfa.start;
+    static constexpr std::array<int32_t, (size_t)numStates * numClasses> table =
+        static_regex::prefix<int32_t, (size_t)numStates * numClasses>(dfa.table);
+    static constexpr std::array<uint8_t, 256> byteClass = static_regex::prefix<uint8_t, 256>(dfa.byteClass);
+    static constexpr std::array<uint8_t, (size_t)numStates> accept = static_regex::prefix<uint8_t, (size_t)numStates>(dfa.accept);
+
+    static constexpr bool matches(const char *p, size_t n) {
+        int32_t s = start;
+        for (size_t i = 0; i < n; ++i) s = table[(size_t)s * numClasses + byteClass[(unsigned char)p[i]]];
+        return accept[s] != 0;
+    }
+    static constexpr bool matches(const char *s) { return matches(s, static_regex::length(s)); }
+    static bool matches(const std::string &s) { return matches(s.data(), s.size()); }
+
+    // For code written against DFA tables, e.g. LineMatcher
+    static constexpr DFAView view() { return DFAView{table.data(), byteClass.data(), accept.data(), start, numStates, numClasses}; }
+};
+
+template <const char *Pattern, int MaxStates = 1024>
+using StaticRegex = BasicStaticRegex<static_regex::PatternSource<Pattern>, MaxStates>;
+
+#if __cplusplus >= 202002L
+template <static_regex::Literal Pattern, int MaxStates = 1024>
+using StaticRegexLiteral = BasicStaticRegex<static_regex::LiteralSource<Pattern>, MaxStates>;
+#endif
+
+// Why pattern is invalid, at compile time: static_assert(checkStaticRegex("a|").ok())
+// fails. The DFA state limit is only checked by StaticRegex itself.
+template <size_t K>
+constexpr StaticRegexStatus checkStaticRegex(const char (&pattern)[K]) {
+    return static_regex::parse<K - 1>(pattern).status;
+}
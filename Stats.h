@@ -0,0 +1,127 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <iomanip>
+
+// Run-time instrumentation for the teaching pipeline (Lexer, Parser,
+// evalAST, ArenaParser, ThompsonNFA). Always compiled in; it collects only
+// while a StatsScope is open on the calling thread, so a thread that isn't
+// collecting pays one thread-local load per stage, step or closure.
+//
+//   EngineStats st;
+//   { StatsScope scope(&st); nfa.simulate(text, steps); }
+//   writeStatsJSON(std::cout, st);
+
+// Process-wide heap allocation counter. It only moves in programs that
+// include CountingNew.h in one of their .cpp files.
+struct AllocCounter {
+    std::atomic<uint64_t> count{0}, bytes{0};
+};
+inline AllocCounter &allocationCounter() {
+    static AllocCounter c;
+    return c;
+}
+
+struct EngineStats {
+    enum Stage { LEX, PARSE, EVAL, NFA_BUILD, SIMULATE, STAGE_COUNT };
+    static const char *stageName(int s) {
+        static const char *const names[] = {"lex", "parse", "eval", "nfa_build", "simulate"};
+        return names[s];
+    }
+
+    // Allocations are counted process-wide while the stage runs, so other
+    // threads allocating at the same time are included
+    struct StageTotals {
+        uint64_t runs = 0;
+        double ns = 0;
+        uint64_t allocations = 0, allocatedBytes = 0;
+    };
+    StageTotals stages[STAGE_COUNT];
+
+    // the last NFA built
+    size_t nfaStates = 0, nfaTransitions = 0, nfaEpsilonTransitions = 0;
+
+    // simulate(): size of the active set after the start closure and after each character
+    uint64_t activeSets = 0, activeSum = 0;
+    size_t activeMax = 0;
+
+    // epsilonClosure(): calls, states it added and epsilon edges it followed
+    uint64_t closureCalls = 0, closureStates = 0, closureEdges = 0;
+
+    double activeMean() const { return activeSets ? (double)activeSum / (double)activeSets : 0; }
+
+    void noteActive(size_t n) {
+        activeSets++;
+        activeSum += n;
+        if (n > activeMax) activeMax = n;
+    }
+
+    void reset() { *this = EngineStats(); }
+};
+
+// Stats the calling thread is collecting into, or nullptr
+inline EngineStats *&activeStatsSlot() {
+    thread_local EngineStats *current = nullptr;
+    return current;
+}
+inline EngineStats *activeStats() { return activeStatsSlot(); }
+
+// Collects into *stats on this thread until the scope ends (nullptr: don't
+// collect). Scopes nest; the previous target is restored on exit.
+class StatsScope {
+    EngineStats *previous;
+public:
+    explicit StatsScope(EngineStats *stats) : previous(activeStatsSlot()) { activeStatsSlot() = stats; }
+    ~StatsScope() { activeStatsSlot() = previous; }
+    StatsScope(const StatsScope &) = delete;
+    StatsScope &operator=(const StatsScope &) = delete;
+};
+
+// Adds the time and allocations of one run of a stage to the active stats
+class StageTimer {
+    EngineStats *st;
+    EngineStats::Stage stage;
+    std::chrono::steady_clock::time_point t0;
+    uint64_t count0 = 0, bytes0 = 0;
+public:
+    explicit StageTimer(EngineStats::Stage s) : st(activeStats()), stage(s) {
+        if (!st) return;
+        count0 = allocationCounter().count.load(std::memory_order_relaxed);
+        bytes0 = allocationCounter().bytes.load(std::memory_order_relaxed);
+        t0 = std::chrono::steady_clock::now();
+    }
+    ~StageTimer() {
+        if (!st) return;
+        auto t1 = std::chrono::steady_clock::now();
+        EngineStats::StageTotals &s = st->stages[stage];
+        s.runs++;
+        s.ns += std::chrono::duration<double, std::nano>(t1 - t0).count();
+        s.allocations += allocationCounter().count.load(std::memory_order_relaxed) - count0;
+        s.allocatedBytes += allocationCounter().bytes.load(std::memory_order_relaxed) - bytes0;
+    }
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+};
+
+inline void writeStatsJSON(std::ostream &out, const EngineStats &st) {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::setprecision(17) << "{\n  \"stages\": {\n";
+    for (int i = 0; i < EngineStats::STAGE_COUNT; ++i) {
+        const EngineStats::StageTotals &s = st.stages[i];
+        out << "    \"" << EngineStats::stageName(i) << "\": {\"runs\": " << s.runs << ", \"ns\": " << s.ns
+            << ", \"allocations\": " << s.allocations << ", \"allocated_bytes\": " << s.allocatedBytes << "}"
+            << (i + 1 < EngineStats::STAGE_COUNT ? ",\n" : "\n");
+    }
+    out << "  },\n"
+        << "  \"nfa\": {\"states\": " << st.nfaStates << ", \"transitions\": " << st.nfaTransitions
+        << ", \"epsilon_transitions\": " << st.nfaEpsilonTransitions << "},\n"
+        << "  \"active_set\": {\"samples\": " << st.activeSets << ", \"max\": " << st.activeMax << ", \"mean\": " << st.activeMean() << "},\n"
+        << "  \"epsilon_closure\": {\"calls\": " << st.closureCalls << ", \"states_added\": " << st.closureStates
+        << ", \"edges_followed\": " << st.closureEdges << "}\n"
+        << "}\n";
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,146 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <exception>
+
+// Work-stealing thread pool. Every worker owns a deque: it pushes and pops
+// its own tasks at the back and, when it runs dry, steals from the front of
+// the others. Threads waiting in parallelFor run tasks too, so nested
+// parallel loops cannot deadlock.
+class ThreadPool {
+    struct Queue {
+        std::mutex m;
+        std::deque<std::function<void()>> tasks;
+    };
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> nextQueue{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+
+    struct WorkerId { const ThreadPool *pool = nullptr; int index = -1; };
+    static WorkerId &currentWorker() { static thread_local WorkerId id; return id; }
+    // index of the calling thread among this pool's workers, or -1
+    int workerIndex() const { const WorkerId &id = currentWorker(); return id.pool == this ? id.index : -1; }
+
+public:
+    explicit ThreadPool(size_t numThreads = std::thread::hardware_concurrency()) {
+        if (numThreads == 0) numThreads = 1;
+        for (size_t i = 0; i < numThreads; ++i) queues.push_back(std::make_unique<Queue>());
+        for (size_t i = 0; i < numThreads; ++i) threads.emplace_back([this, i] { workerLoop(i); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lk(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &t : threads) t.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const { return threads.size(); }
+
+    // Workers push onto their own queue; other threads spread tasks round-robin.
+    // A task must not throw: it would end the worker and the program.
+    void submit(std::function<void()> task) {
+        int self = workerIndex();
+        size_t q = self >= 0 ? (size_t)self : nextQueue++ % queues.size();
+        {
+            std::lock_guard<std::mutex> lk(sleepMutex);
+            queued++; // counted first so it never drops below the real number of tasks
+        }
+        {
+            std::lock_guard<std::mutex> lk(queues[q]->m);
+            queues[q]->tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    // Runs body(from, to) over [begin, end) in pieces of about grain items and
+    // returns when all pieces are done. If body throws, the pieces not yet
+    // started are skipped and the first exception is rethrown here once every
+    // piece has finished, so no task outlives this call.
+    void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)> &body) {
+        if (begin >= end) return;
+        if (grain == 0) grain = 1;
+        struct Loop {
+            std::mutex m;
+            std::condition_variable finished;
+            size_t remaining;
+            std::atomic<bool> failed{false};
+            std::exception_ptr error;
+        } loop;
+        loop.remaining = (end - begin + grain - 1) / grain;
+        for (size_t from = begin; from < end; from += grain) {
+            size_t to = std::min(end, from + grain);
+            submit([&body, &loop, from, to] {
+                try {
+                    if (!loop.failed) body(from, to);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lk(loop.m);
+                    if (!loop.error) loop.error = std::current_exception();
+                    loop.failed = true;
+                }
+                // notified under the lock, so the caller can't return and destroy loop first
+                std::lock_guard<std::mutex> lk(loop.m);
+                if (--loop.remaining == 0) loop.finished.notify_all();
+            });
+        }
+        // help until none of the pieces are queued, then sleep until the running ones finish
+        while (runOne()) {}
+        {
+            std::unique_lock<std::mutex> lk(loop.m);
+            loop.finished.wait(lk, [&loop] { return loop.remaining == 0; });
+        }
+        if (loop.error) std::rethrow_exception(loop.error);
+    }
+
+private:
+    bool takeTask(std::function<void()> &task) {
+        int self = workerIndex();
+        size_t n = queues.size();
+        if (self >= 0) {
+            Queue &own = *queues[self];
+            std::lock_guard<std::mutex> lk(own.m);
+            if (!own.tasks.empty()) { task = std::move(own.tasks.back()); own.tasks.pop_back(); return true; }
+        }
+        size_t startAt = self >= 0 ? (size_t)self + 1 : nextQueue.load();
+        for (size_t k = 0; k < n; ++k) {
+            Queue &victim = *queues[(startAt + k) % n];
+            std::lock_guard<std::mutex> lk(victim.m);
+            if (!victim.tasks.empty()) { task = std::move(victim.tasks.front()); victim.tasks.pop_front(); return true; }
+        }
+        return false;
+    }
+
+    bool runOne() {
+        std::function<void()> task;
+        if (!takeTask(task)) return false;
+        queued--;
+        task();
+        return true;
+    }
+
+    void workerLoop(size_t i) {
+        currentWorker() = WorkerId{this, (int)i};
+        while (true) {
+            if (runOne()) continue;
+            std::unique_lock<std::mutex> lk(sleepMutex);
+            wake.wait(lk, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0) return;
+        }
+    }
+};
@@ -0,0 +1,11 @@
+#pragma once
+
+// Trace policies for the teaching pipeline (Lexer, Parser, evalAST,
+// ThompsonNFA). Each stage is templated on one of these and guards its
+// trace code with if constexpr, so NoTrace removes the tracing from the
+// generated code instead of skipping it at run time.
+//   enabled: build the step-by-step strings (Lexer::steps, Parser::trace, ...)
+//   events:  record fixed-size TraceEvents into the thread's TraceLog (TraceLog.h)
+struct FullTrace { static constexpr bool enabled = true; static constexpr bool events = false; };   // step-by-step strings
+struct EventTrace { static constexpr bool enabled = false; static constexpr bool events = true; };  // compact events, formatted on demand
+struct NoTrace { static constexpr bool enabled = false; static constexpr bool events = false; };    // results only
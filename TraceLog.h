@@ -0,0 +1,129 @@
+#pragma once
+#include "Trace.h"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <cstdint>
+
+// Compact trace storage for EventTrace. Every step is one fixed-size record
+// instead of a formatted string; text (token spellings, variable names,
+// notes) is interned once. Records go into a ring buffer: past capacity()
+// the oldest are overwritten, so memory stays bounded however long the run.
+// Formatting is left to the viewer (TraceView.h), which only formats the
+// rows it shows.
+struct TraceEvent {
+    enum Stage : uint8_t { LEX, PARSE, EVAL, NFA, SIM, NOTE, STAGE_COUNT };
+    enum Op : uint8_t {
+        TOKEN,         // LEX:   a = text, b = TokenType
+        NUMBER,        // PARSE: a = text
+        VARIABLE,      // PARSE: a = name; EVAL: a = name, x = value
+        UNARY,         // PARSE: ch = op; EVAL: ch = op, x = operand
+        BINARY,        // PARSE: ch = op; EVAL: ch = op, x = left, y = right
+        TRANSITION,    // NFA:   state a -ch-> state b (ch 0: epsilon)
+        RANGE,         // NFA:   state a -[ch-x]-> state b (x holds the high byte)
+        CLOSURE_ADD,   // SIM:   state a joined an epsilon closure
+        START_CLOSURE, // SIM:   a = size of the start closure
+        READ,          // SIM:   ch read
+        ACTIVE,        // SIM:   a = active states after the step
+        RESULT,        // SIM:   a = 1 accepted, 0 rejected
+        TEXT           // NOTE:  a = text
+    };
+    uint8_t stage;
+    uint8_t op;
+    char ch = 0;
+    int32_t a = 0, b = 0;
+    double x = 0, y = 0;
+};
+
+class TraceLog {
+    std::vector<TraceEvent> ring;
+    size_t cap;
+    uint64_t total = 0; // events pushed since clear()
+    uint64_t gen = 0;   // bumped by clear()
+    std::vector<std::string> texts;
+    std::unordered_map<std::string, int32_t> textIds;
+public:
+    explicit TraceLog(size_t capacity = 1 << 20) : cap(capacity ? capacity : 1) {}
+
+    // e may name a text interned since the last push
+    void push(TraceEvent e) {
+        // each held event names at most one text, so most of them are unused by now
+        if (texts.size() > 2 * cap) compactTexts(e);
+        if (ring.size() < cap) ring.push_back(e);
+        else ring[total % cap] = e;
+        total++;
+    }
+
+    // Ids stay valid until the next push, which may renumber them
+    int32_t intern(std::string_view s) {
+        auto it = textIds.find(std::string(s));
+        if (it != textIds.end()) return it->second;
+        texts.emplace_back(s);
+        textIds.emplace(texts.back(), (int32_t)texts.size() - 1);
+        return (int32_t)texts.size() - 1;
+    }
+    const std::string &text(int32_t id) const { return texts[id]; }
+    size_t textCount() const { return texts.size(); }
+
+    // A free-form line (headings, results, errors)
+    void note(std::string_view s) { push(TraceEvent{TraceEvent::NOTE, TraceEvent::TEXT, 0, intern(s)}); }
+
+    // Events are numbered by sequence since clear(); [first(), end()) are still held
+    uint64_t first() const { return total - ring.size(); }
+    uint64_t end() const { return total; }
+    size_t size() const { return ring.size(); }
+    uint64_t dropped() const { return first(); }
+    const TraceEvent &at(uint64_t seq) const { return ring[seq % cap]; }
+
+    size_t capacity() const { return cap; }
+    uint64_t generation() const { return gen; }
+
+    void clear() {
+        ring.clear();
+        total = 0;
+        texts.clear();
+        textIds.clear();
+        gen++;
+    }
+
+private:
+    static bool namesText(const TraceEvent &e) {
+        return e.op == TraceEvent::TOKEN || e.op == TraceEvent::NUMBER || e.op == TraceEvent::VARIABLE || e.op == TraceEvent::TEXT;
+    }
+
+    // Keeps only the texts held events (and the incoming one) name,
+    // renumbering them in place
+    void compactTexts(TraceEvent &incoming) {
+        std::vector<int32_t> renumbered(texts.size(), -1);
+        std::vector<std::string> kept;
+        auto keep = [&](TraceEvent &e) {
+            if (!namesText(e)) return;
+            int32_t &id = renumbered[e.a];
+            if (id < 0) { id = (int32_t)kept.size(); kept.push_back(std::move(texts[e.a])); }
+            e.a = id;
+        };
+        for (TraceEvent &e : ring) keep(e);
+        keep(incoming);
+        texts = std::move(kept);
+        textIds.clear();
+        for (size_t i = 0; i < texts.size(); ++i) textIds.emplace(texts[i], (int32_t)i);
+    }
+};
+
+// Log the calling thread's EventTrace stages record into, or nullptr
+inline TraceLog *&activeTraceLogSlot() {
+    thread_local TraceLog *current = nullptr;
+    return current;
+}
+inline TraceLog *activeTraceLog() { return activeTraceLogSlot(); }
+
+// Records this thread's EventTrace events into *log until the scope ends
+class TraceLogScope {
+    TraceLog *previous;
+public:
+    explicit TraceLogScope(TraceLog *log) : previous(activeTraceLogSlot()) { activeTraceLogSlot() = log; }
+    ~TraceLogScope() { activeTraceLogSlot() = previous; }
+    TraceLogScope(const TraceLogScope &) = delete;
+    TraceLogScope &operator=(const TraceLogScope &) = delete;
+};
@@ -0,0 +1,94 @@
+#pragma once
+#include "TraceLog.h"
+#include "Lexer.h"
+#include "NFA.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Text of one event, the same line FullTrace would have produced for that step
+inline std::string formatTraceEvent(const TraceLog &log, const TraceEvent &e) {
+    switch (e.stage) {
+        case TraceEvent::LEX:
+            return std::string("[LEXER] ") + tokenTypeName((TokenType)e.b) + " -> " + log.text(e.a);
+        case TraceEvent::PARSE:
+            switch (e.op) {
+                case TraceEvent::NUMBER: return "Number " + log.text(e.a);
+                case TraceEvent::VARIABLE: return "Variable " + log.text(e.a);
+                case TraceEvent::UNARY: return std::string("Unary ") + e.ch;
+                default: return std::string("Binary ") + e.ch;
+            }
+        case TraceEvent::EVAL:
+            switch (e.op) {
+                case TraceEvent::VARIABLE: return "Variable " + log.text(e.a) + ": " + std::to_string(e.x);
+                case TraceEvent::UNARY: return std::string("Unary ") + e.ch + ": " + std::to_string(e.x);
+                default: {
+                    const char *name = e.ch == '+' ? "Add" : e.ch == '-' ? "Sub" : e.ch == '*' ? "Mul" : "Div";
+                    return std::string(name) + ": " + std::to_string(e.x) + " " + e.ch + " " + std::to_string(e.y);
+                }
+            }
+        case TraceEvent::NFA:
+            if (e.op == TraceEvent::RANGE)
+                return "q" + std::to_string(e.a) + " -" + ThompsonNFA::rangeLabel((unsigned char)e.ch, (unsigned char)e.x) + "-> q" + std::to_string(e.b);
+            return "q" + std::to_string(e.a) + " -" + (e.ch == 0 ? std::string("eps") : std::string(1, e.ch)) + "-> q" + std::to_string(e.b);
+        case TraceEvent::SIM:
+            switch (e.op) {
+                case TraceEvent::CLOSURE_ADD: return "eps-closure add q" + std::to_string(e.a);
+                case TraceEvent::START_CLOSURE: return "Start closure size=" + std::to_string(e.a);
+                case TraceEvent::READ: return std::string("Read '") + e.ch + "'";
+                case TraceEvent::ACTIVE: return "Active states: " + std::to_string(e.a);
+                default: return e.a ? "Accepted" : "Rejected";
+            }
+        default:
+            return log.text(e.a);
+    }
+}
+
+inline const char *traceStageName(int stage) {
+    static const char *const names[] = {"Lexer", "Parser", "Eval", "NFA", "Simulation", "Notes"};
+    return names[stage];
+}
+
+// The rows of a TraceLog a viewer shows: events whose stage is in stageMask
+// and, if search is set, whose text contains it. Kept up to date
+// incrementally: update() only looks at events pushed since the last call,
+// and at most budget of them per call, so a search over millions of events
+// is spread across frames instead of stalling one. Changing the mask or the
+// search, or clearing the log, starts the scan over.
+class TraceFilter {
+    std::vector<uint64_t> rows; // sequence numbers of the matching events, ascending
+    size_t skip = 0;            // leading rows that have left the log's ring buffer
+    uint64_t scanned = 0;       // events before this have been looked at
+    uint64_t generation = ~(uint64_t)0;
+    uint32_t mask = ~0u;
+    std::string search;
+
+    void restart() { rows.clear(); skip = 0; scanned = 0; }
+
+public:
+    void setStageMask(uint32_t m) { if (m != mask) { mask = m; restart(); } }
+    void setSearch(const std::string &s) { if (s != search) { search = s; restart(); } }
+    uint32_t stageMask() const { return mask; }
+    const std::string &searchText() const { return search; }
+
+    // Scans up to budget new events; returns true once every event is scanned
+    bool update(const TraceLog &log, uint64_t budget = ~(uint64_t)0) {
+        if (log.generation() != generation) { generation = log.generation(); restart(); }
+        if (scanned < log.first()) scanned = log.first();
+        while (skip < rows.size() && rows[skip] < log.first()) skip++;
+        if (skip > 4096 && skip * 2 > rows.size()) { rows.erase(rows.begin(), rows.begin() + (std::ptrdiff_t)skip); skip = 0; }
+        uint64_t stop = log.end() - scanned > budget ? scanned + budget : log.end();
+        for (; scanned < stop; ++scanned) {
+            const TraceEvent &e = log.at(scanned);
+            if (!(mask >> e.stage & 1)) continue;
+            if (!search.empty() && formatTraceEvent(log, e).find(search) == std::string::npos) continue;
+            rows.push_back(scanned);
+        }
+        return scanned == log.end();
+    }
+
+    size_t size() const { return rows.size() - skip; }
+    uint64_t row(size_t i) const { return rows[skip + i]; }
+    // Events scanned so far out of those held, for a progress display
+    uint64_t scannedCount(const TraceLog &log) const { return scanned > log.first() ? scanned - log.first() : 0; }
+};
@@ -0,0 +1,692 @@
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <random>
+#include <sstream>
+#include <cstdio>
+#include "Lexer.h"
+#include "Parser.h"
+#include "Bytecode.h"
+#include "Columnar.h"
+#include "Optimize.h"
+#include "Jit.h"
+#include "EvalPipeline.h"
+#include "NFA.h"
+#include "FlatNFA.h"
+#include "DFA.h"
+#include "RegexSet.h"
+#include "Grep.h"
+#include "Prefilter.h"
+#include "Regex.h"
+#include "Search.h"
+#include "Parallel.h"
+#include "AutomatonFile.h"
+#include "StaticRegex.h"
+#include "BenchSuite.h"
+#include "TraceLog.h"
+#include "CountingNew.h" // allocations per op
+#include <fstream>
+#include <cstdlib>
+
+// Results are written here so the optimizer can't drop the matcher calls
+volatile bool sink;
+
+// Times fn over iters runs and returns nanoseconds per run
+template <class F>
+double timeIt(int iters, F &&fn) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; ++i) fn();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / iters;
+}
+
+// (a|b)*a(a|b)^k: the classic "k-th symbol from the end" NFA, about 6k states
+std::string kthFromEnd(int k) {
+    std::string re = "(a|b)*a";
+    for (int i = 0; i < k; ++i) re += "(a|b)";
+    return re;
+}
+
+// w1|w2|...|wn over distinct 4-letter words
+std::string wordAlternation(int n) {
+    std::string re;
+    for (int i = 0; i < n; ++i) {
+        if (i) re += '|';
+        int v = i;
+        for (int j = 0; j < 4; ++j) { re += char('a' + v % 26); v /= 26; }
+    }
+    return "(" + re + ")*";
+}
+
+// Tree-walking evalAST vs the bytecode stack VM on one formula
+void benchBytecode(const std::string &expr, int iters) {
+    Lexer lexer(expr);
+    Parser parser;
+    parser.setTokens(lexer.tokens);
+    auto ast = parser.parseExpression();
+    Bytecode bc = compileBytecode(ast.get());
+    StackVM vm;
+    std::vector<std::string> trace;
+    volatile double out;
+    double tTree = timeIt(iters, [&]{ trace.clear(); out = evalAST(ast.get(), trace); });
+    double tVm = timeIt(iters, [&]{ out = vm.run(bc); });
+    (void)out;
+    std::cout << "arithmetic " << expr << " (" << bc.code.size() << " instructions)\n"
+              << "  evalAST   " << 1e9 / tTree << " evals/s\n"
+              << "  StackVM   " << 1e9 / tVm << " evals/s  (" << tTree / tVm << "x)\n";
+}
+
+// Row-at-a-time StackVM vs block-wise columnar evaluation (scalar and AVX2)
+void benchColumnar(const std::string &expr, size_t rows, int iters) {
+    Lexer lexer(expr);
+    Parser parser;
+    parser.setTokens(lexer.tokens);
+    Bytecode bc = compileBytecode(parser.parseExpression().get());
+    std::vector<std::vector<double>> data(bc.variables.size(), std::vector<double>(rows));
+    std::vector<const double*> columns;
+    for (size_t v = 0; v < data.size(); ++v) {
+        for (size_t r = 0; r < rows; ++r) data[v][r] = 1.0 + (double)((r * 31 + v * 17) % 1000);
+        columns.push_back(data[v].data());
+    }
+    std::vector<double> out(rows), row(data.size());
+    StackVM vm;
+    double tVm = timeIt(iters, [&]{
+        for (size_t r = 0; r < rows; ++r) {
+            for (size_t v = 0; v < data.size(); ++v) row[v] = data[v][r];
+            out[r] = vm.run(bc, row.data());
+        }
+    });
+    ColumnEvaluator scalar(bc, false), simd(bc);
+    double tScalar = timeIt(iters, [&]{ scalar.run(columns, rows, out.data()); });
+    double tSimd = timeIt(iters, [&]{ simd.run(columns, rows, out.data()); });
+    sink = out[rows / 2] > 0;
+    std::cout << "columnar " << expr << " over " << rows << " rows\n"
+              << "  StackVM per row     " << rows * 1e9 / tVm << " rows/s\n"
+              << "  columnar scalar     " << rows * 1e9 / tScalar << " rows/s  (" << tVm / tScalar << "x)\n"
+              << "  columnar " << (cpuHasAVX2() ? "AVX2 " : "(no AVX2)") << "     " << rows * 1e9 / tSimd << " rows/s  (" << tVm / tSimd << "x)\n";
+}
+
+// Parse + evaluate a batch of short formulas: Lexer/Parser/evalAST vs
+// ArenaParser/StackVM
+void benchFrontEnd(int count) {
+    std::mt19937 rng(7);
+    std::vector<std::string> exprs;
+    for (int i = 0; i < count; ++i)
+        exprs.push_back(std::to_string(rng() % 100) + " * (" + std::to_string(rng() % 1000) + ".5 - " + std::to_string(rng() % 10) + ") / 3");
+    Lexer lexer;
+    Parser parser;
+    ArenaParser fast;
+    StackVM vm;
+    double total = 0;
+    double tOld = timeIt(1, [&]{
+        for (const std::string &e : exprs) {
+            lexer.setInput(e);
+            parser.setTokens(lexer.tokens);
+            std::vector<std::string> trace;
+            total += evalAST(parser.parseExpression().get(), trace);
+        }
+    });
+    double tNew = timeIt(1, [&]{
+        for (const std::string &e : exprs) total += vm.run(compileBytecode(fast.parse(e)));
+    });
+    double tArena = timeIt(1, [&]{
+        for (const std::string &e : exprs) { std::vector<std::string> trace; total += evalAST(fast.parse(e), trace); }
+    });
+    sink = total > 0;
+    std::cout << "front end, " << count << " short formulas (arena: " << fast.memory().blockCount() << " block)\n"
+              << "  Lexer+Parser+evalAST       " << count * 1e9 / tOld << " exprs/s\n"
+              << "  ArenaParser+evalAST        " << count * 1e9 / tArena << " exprs/s  (" << tOld / tArena << "x)\n"
+              << "  ArenaParser+bytecode       " << count * 1e9 / tNew << " exprs/s  (" << tOld / tNew << "x)\n";
+}
+
+// Every traced stage with FullTrace vs NoTrace
+void benchTracePolicy(int iters) {
+    const std::string expr = "2 * (3 + 4 * (5 - 6 / (7 + 8))) - -9 / 3 + x * (y - 1)";
+    Variables vars{{"x", 2}, {"y", 3}};
+    auto report = [](const char *stage, double full, double none) {
+        std::cout << "  " << stage << " FullTrace " << full << " ns, NoTrace " << none << " ns  (" << full / none << "x)\n";
+    };
+    std::cout << "trace policy\n";
+    report("lex     ", timeIt(iters, [&]{ Lexer l(expr); sink = l.tokens.size() > 1; }),
+                      timeIt(iters, [&]{ BasicLexer<NoTrace> l(expr); sink = l.tokens.size() > 1; }));
+    Lexer lexer(expr);
+    report("parse   ", timeIt(iters, [&]{ Parser p; p.setTokens(lexer.tokens); sink = p.parseExpression() != nullptr; }),
+                      timeIt(iters, [&]{ BasicParser<NoTrace> p; p.setTokens(lexer.tokens); sink = p.parseExpression() != nullptr; }));
+    Parser parser;
+    parser.setTokens(lexer.tokens);
+    auto ast = parser.parseExpression();
+    std::vector<std::string> trace;
+    report("eval    ", timeIt(iters, [&]{ trace.clear(); sink = evalAST(ast.get(), trace, &vars) > 0; }),
+                      timeIt(iters, [&]{ sink = evalAST<NoTrace>(ast.get(), trace, &vars) > 0; }));
+    const std::string regex = kthFromEnd(10);
+    ThompsonNFA nfa;
+    report("NFA build", timeIt(iters / 10, [&]{ nfa.buildFromRegex(regex); }),
+                       timeIt(iters / 10, [&]{ nfa.buildFromRegex<NoTrace>(regex); }));
+    std::string input;
+    for (int i = 0; i < 200; ++i) input += "ab"[i * 7 % 3 % 2];
+    std::vector<std::string> steps;
+    report("simulate", timeIt(iters / 100, [&]{ sink = nfa.simulate(input, steps); }),
+                      timeIt(iters / 100, [&]{ sink = nfa.simulate<NoTrace>(input, steps); }));
+}
+
+// Redundant generated formula: tree evaluation vs the optimized DAG
+void benchOptimizer(int iters) {
+    std::string term = "(x*1 + --y) * (x - 0) / (2 * 3)";
+    std::string expr = term;
+    for (int i = 0; i < 6; ++i) expr = "(" + expr + ") + (" + expr + ")";
+    ArenaParser parser;
+    const ASTNode *ast = parser.parse(expr);
+    OptimizeStats st;
+    ExprDAG dag = optimizeAST(ast, &st);
+    Variables vars{{"x", 1.5}, {"y", -2}};
+    double xy[] = {1.5, -2};
+    std::vector<std::string> trace;
+    std::vector<double> scratch;
+    double tTree = timeIt(iters, [&]{ sink = evalAST<NoTrace>(ast, trace, &vars) > 0; });
+    double tDag = timeIt(iters, [&]{ sink = dag.eval(xy, scratch) > 0; });
+    std::cout << "optimizer: " << st.astNodes << " AST nodes -> " << st.simplifiedNodes << " after folding -> "
+              << st.dagNodes << " DAG nodes\n"
+              << "  evalAST<NoTrace>  " << 1e9 / tTree << " evals/s\n"
+              << "  ExprDAG::eval     " << 1e9 / tDag << " evals/s  (" << tTree / tDag << "x)\n";
+}
+
+// Bytecode interpreter vs native code for one formula
+void benchJit(const std::string &expr, int iters) {
+    ArenaParser parser;
+    const ASTNode *ast = parser.parse(expr);
+    JitFunction f(ast);
+    StackVM vm;
+    double xy[] = {1.5, -2};
+    volatile double out;
+    double tVm = timeIt(iters, [&]{ out = vm.run(f.bytecode(), xy); });
+    double tJit = timeIt(iters, [&]{ out = f.eval(xy); });
+    (void)out;
+    std::cout << "JIT " << expr << (f.native() ? "" : " (interpreter fallback)") << "\n"
+              << "  StackVM   " << 1e9 / tVm << " evals/s\n"
+              << "  native    " << 1e9 / tJit << " evals/s  (" << tVm / tJit << "x)\n";
+}
+
+// [a-z]*(ab){3,m} as m grows: the counter-augmented NFA keeps one copy of
+// the body, the unrolled one (what the Pike VM and DFAs run) has m copies
+void benchCountedRepetition(const std::string &input, int iters) {
+    std::cout << "[a-z]*(ab){3,m} on " << input.size() << " bytes\n";
+    for (int m : {10, 100, 1000, 10000, 100000}) {
+        std::string regex = "[a-z]*(ab){3," + std::to_string(m) + "}";
+        ThompsonNFA nfa;
+        nfa.buildFromRegex<NoTrace>(regex);
+        ThompsonNFA plain;
+        plain.buildExpanded(nfa);
+        FlatNFA flat(plain);
+        PikeVM vm(flat);
+        std::vector<std::string> steps;
+        bool a = nfa.simulate<NoTrace>(input, steps), b = vm.matches(input);
+        double tCount = timeIt(iters, [&]{ sink = nfa.simulate<NoTrace>(input, steps); });
+        double tVm = timeIt(iters, [&]{ sink = vm.matches(input); });
+        std::printf("  m=%-6d counted %2zu states %7.1f ns/byte | unrolled %7zu states, Pike VM %9.1f ns/byte%s\n", m,
+                    nfa.stateCount(), tCount / input.size(), plain.stateCount(), tVm / input.size(), a == b ? "" : " [MISMATCH]");
+    }
+}
+
+void benchSimulateVsPikeVM(const std::string &name, const std::string &regex, const std::string &input, int iters) {
+    ThompsonNFA nfa;
+    nfa.buildFromRegex(regex);
+    FlatNFA flat(nfa);
+    PikeVM vm(flat);
+    std::vector<std::string> steps;
+    bool a = nfa.simulate(input, steps), b = vm.matches(input);
+    double tSim = timeIt(iters, [&]{ sink = nfa.simulate(input, steps); });
+    double tVm = timeIt(iters, [&]{ sink = vm.matches(input); });
+    std::cout << name << ": " << nfa.stateCount() << " states, " << input.size() << " bytes"
+              << (a == b ? "" : " [MISMATCH]") << "\n"
+              << "  simulate  " << tSim / input.size() << " ns/byte\n"
+              << "  Pike VM   " << tVm / input.size() << " ns/byte  (" << tSim / tVm << "x)\n";
+}
+
+void benchFastEngines(const std::string &name, const std::string &regex, const std::string &input, int iters) {
+    ThompsonNFA nfa;
+    nfa.buildFromRegex(regex);
+    FlatNFA flat(nfa);
+    PikeVM vm(flat);
+    LazyDFA lazy(nfa);
+    DFA dfa = compileDFA(nfa);
+    double tVm = timeIt(iters, [&]{ sink = vm.matches(input); });
+    double tLazy = timeIt(iters, [&]{ sink = lazy.matches(input); });
+    double tDfa = timeIt(iters, [&]{ sink = dfa.matches(input); });
+    std::cout << name << ": " << input.size() << " bytes, DFA " << dfa.statesBeforeMinimization
+              << " -> " << dfa.numStates << " states after minimization, " << dfa.numClasses << " byte classes, "
+              << dfa.tableBytes() << " table bytes (" << (size_t)dfa.numStates * 256 * sizeof(int32_t) << " with 256 columns)\n"
+              << "  Pike VM   " << tVm / input.size() << " ns/byte\n"
+              << "  lazy DFA  " << tLazy / input.size() << " ns/byte\n"
+              << "  DFA       " << tDfa / input.size() << " ns/byte\n";
+}
+
+// P patterns as P separate DFAs vs one combined RegexSet
+void benchRegexSet(int numPatterns, const std::vector<std::string> &records, int iters) {
+    std::vector<std::string> patterns;
+    for (int i = 0; i < numPatterns; ++i) {
+        std::string w;
+        int v = i;
+        for (int j = 0; j < 3; ++j) { w += char('a' + v % 26); v /= 26; }
+        patterns.push_back("(a|b)*" + w + "(a|b)*");
+    }
+    std::vector<DFA> separate;
+    ThompsonNFA nfa;
+    for (auto &p : patterns) { nfa.buildFromRegex(p); separate.push_back(compileDFA(nfa)); }
+    RegexSet set(patterns, SetEngine::Auto, 200000);
+    std::vector<int> ids;
+    double tSep = timeIt(iters, [&]{
+        for (auto &r : records) for (auto &d : separate) sink = d.matches(r);
+    });
+    double tSet = timeIt(iters, [&]{
+        for (auto &r : records) { set.matches(r.data(), r.size(), ids); sink = !ids.empty(); }
+    });
+    std::cout << numPatterns << " patterns x " << records.size() << " records ("
+              << (set.engine() == SetEngine::DFA ? "DFA" : "Thompson") << " set)\n"
+              << "  one DFA per pattern  " << tSep / 1e6 << " ms\n"
+              << "  one RegexSet pass    " << tSet / 1e6 << " ms  (" << tSep / tSet << "x)\n";
+}
+
+// Service startup: building a pattern set's DFA vs mapping a compiled file
+void benchAutomatonStartup(int numPatterns, int iters) {
+    std::vector<std::string> patterns;
+    for (int i = 0; i < numPatterns; ++i) {
+        std::string w;
+        int v = i;
+        for (int j = 0; j < 3; ++j) { w += char('a' + v % 26); v /= 26; }
+        patterns.push_back("[a-z]*" + w + "[0-9][0-9]*");
+    }
+    auto build = [&] {
+        ThompsonNFA nfa;
+        nfa.buildFromRegexSet<NoTrace>(patterns);
+        return compileDFA(nfa, 1000000, true);
+    };
+    DFA dfa = build();
+    std::string image = serializeAutomaton(patterns, &dfa, nullptr, true);
+    const std::string path = "bench_automaton.bin";
+    { std::ofstream f(path, std::ios::binary); f.write(image.data(), (std::streamsize)image.size()); }
+    double tBuild = timeIt(iters, [&]{ sink = build().numStates > 0; });
+    double tLoad = timeIt(iters * 10, [&]{ CompiledAutomaton ca(path); sink = ca.dfa().numStates > 0; });
+    std::remove(path.c_str());
+    std::cout << "startup with " << numPatterns << " patterns: DFA " << dfa.numStates << " states, file " << image.size() << " bytes\n"
+              << "  build NFA + DFA   " << tBuild / 1e6 << " ms\n"
+              << "  map + validate    " << tLoad / 1e6 << " ms  (" << tBuild / tLoad << "x)\n";
+}
+
+// A pattern fixed at build time: StaticRegex vs building the same DFA at startup
+static constexpr char kBenchEmail[] = "[a-z0-9_.]+@[a-z0-9]+(\\.[a-z]{2,6})+";
+
+void benchStaticRegex(const std::vector<std::string> &records, int iters) {
+    using Email = StaticRegex<kBenchEmail>;
+    auto build = [] {
+        ThompsonNFA nfa;
+        nfa.buildFromRegex<NoTrace>(kBenchEmail);
+        return compileDFA(nfa);
+    };
+    DFA dfa = build();
+    size_t bytes = 0, agree = 0;
+    for (auto &r : records) { bytes += r.size(); agree += dfa.matches(r) == Email::matches(r); }
+    double tBuild = timeIt(iters * 100, [&]{ sink = build().numStates > 0; });
+    double tDfa = timeIt(iters, [&]{ for (auto &r : records) sink = dfa.matches(r); });
+    double tStatic = timeIt(iters, [&]{ for (auto &r : records) sink = Email::matches(r); });
+    std::cout << kBenchEmail << ": " << Email::numStates << " states x " << Email::numClasses << " classes"
+              << (agree == records.size() ? "" : " [MISMATCH]") << "\n"
+              << "  runtime build      " << tBuild / 1e3 << " us at startup, StaticRegex none\n"
+              << "  runtime DFA        " << tDfa / bytes << " ns/byte\n"
+              << "  StaticRegex        " << tStatic / bytes << " ns/byte\n";
+}
+
+// Line search with and without the literal prefilter
+void benchPrefilter(const std::string &regex, const std::string &text, int iters) {
+    ThompsonNFA nfa;
+    nfa.buildFromRegex(regex);
+    DFA dfa = compileDFA(nfa, 10000, true);
+    std::string lit = prefilterLiteral(regex);
+    LineMatcher plain(dfa, false), filtered(dfa, false, lit);
+    PrefilterStats stats;
+    auto run = [&](const LineMatcher &m) {
+        uint64_t count = 0;
+        LineMatcher::State st = m.begin();
+        auto onLine = [&](uint64_t, uint64_t, uint64_t, bool matched) { count += matched; };
+        m.feed(st, text.data(), text.size(), onLine);
+        m.finish(st, onLine);
+        stats = st.stats;
+        sink = count != 0;
+    };
+    double tPlain = timeIt(iters, [&]{ run(plain); });
+    double tFiltered = timeIt(iters, [&]{ run(filtered); });
+    std::cout << "line search " << regex << " (literal \"" << lit << "\"), " << text.size() << " bytes\n"
+              << "  DFA only        " << tPlain / text.size() << " ns/byte\n"
+              << "  with prefilter  " << tFiltered / text.size() << " ns/byte  (" << tPlain / tFiltered << "x, "
+              << 100.0 * stats.skipRate() << "% lines skipped, " << 100.0 * stats.hitRate() << "% candidates matched)\n";
+}
+
+// Automatic engine choice (bit-parallel for small patterns) vs the Pike VM
+void benchBitParallel(int k, const std::string &input, int iters) {
+    std::string regex = kthFromEnd(k);
+    ThompsonNFA nfa;
+    nfa.buildFromRegex(regex);
+    FlatNFA flat(nfa);
+    PikeVM vm(flat);
+    Regex re(regex);
+    double tVm = timeIt(iters, [&]{ sink = vm.matches(input); });
+    double tRe = timeIt(iters, [&]{ sink = re.matches(input); });
+    std::cout << "kth-from-end k=" << k << ": " << re.positions() << " positions, engine "
+              << (re.engine() == RegexEngine::BitParallel ? "bit-parallel" : "Thompson") << "\n"
+              << "  Pike VM   " << tVm / input.size() << " ns/byte\n"
+              << "  Regex     " << tRe / input.size() << " ns/byte  (" << tVm / tRe << "x)\n";
+}
+
+// Batch and single-input matching on 1 thread vs all hardware threads
+void benchParallel(const std::string &regex, const std::vector<std::string> &subjects, const std::string &big, int iters) {
+    ThompsonNFA nfa;
+    nfa.buildFromRegex(regex);
+    DFA dfa = compileDFA(nfa);
+    ThreadPool one(1), all;
+    double tBatch1 = timeIt(iters, [&]{ sink = matchBatch(dfa, subjects, one)[0]; });
+    double tBatchN = timeIt(iters, [&]{ sink = matchBatch(dfa, subjects, all)[0]; });
+    double tSeq = timeIt(iters, [&]{ sink = dfa.matches(big); });
+    double tPar = timeIt(iters, [&]{ sink = matchParallel(dfa, big.data(), big.size(), all); });
+    std::cout << "parallel " << regex << " (" << all.size() << " threads)\n"
+              << "  batch of " << subjects.size() << ": 1 thread " << tBatch1 / 1e6 << " ms, pool " << tBatchN / 1e6
+              << " ms  (" << tBatch1 / tBatchN << "x)\n"
+              << "  one " << big.size() / (1 << 20) << " MiB input: sequential " << tSeq / 1e6 << " ms, chunked " << tPar / 1e6
+              << " ms  (" << tSeq / tPar << "x)\n";
+}
+
+// recalc-eval's pipeline vs the same stages run one after another on one thread
+void benchEvalPipeline(int lines, int iters) {
+    std::mt19937 rng(7);
+    std::string text;
+    for (int i = 0; i < lines; ++i) {
+        text += std::to_string(rng() % 1000) + " * (" + std::to_string(rng() % 100) + ".5 - 3 / (";
+        text += std::to_string(rng() % 50 + 1) + " + 2)) - -" + std::to_string(rng() % 9) + "\n";
+    }
+    double tSeq = timeIt(iters, [&]{
+        ArenaParser parser;
+        StackVM vm;
+        std::string out;
+        char num[64];
+        size_t start = 0;
+        for (size_t end; (end = text.find('\n', start)) != std::string::npos; start = end + 1) {
+            Bytecode bc = compileBytecode(parser.parse(std::string_view(text).substr(start, end - start)));
+            out.append(num, (size_t)std::snprintf(num, sizeof num, "%.17g", vm.run(bc)));
+            out += '\n';
+        }
+        sink = !out.empty();
+    });
+    double tPipe = timeIt(iters, [&]{
+        std::istringstream in(text);
+        std::ostringstream out;
+        sink = EvalPipeline().run(in, out).lines > 0;
+    });
+    std::cout << "eval pipeline, " << lines << " lines (" << std::thread::hardware_concurrency() << " hardware threads)\n"
+              << "  one thread  " << lines / (tSeq / 1e9) / 1e6 << " M lines/s\n"
+              << "  pipelined   " << lines / (tPipe / 1e9) / 1e6 << " M lines/s  (" << tSeq / tPipe << "x)\n";
+}
+
+// Machine-sized inputs: ns per input byte should stay flat from 1 MB to 10 MB
+void benchDeepInputs(int iters) {
+    auto nested = [](size_t n, char leaf) { return std::string(n / 2, '(') + leaf + std::string(n / 2, ')'); };
+    auto negations = [](size_t n) { return std::string(n - 1, '-') + "1"; };
+    auto alternation = [](size_t n) { std::string s; while (s.size() + 2 < n) s += "a|"; return s + "b"; };
+    std::cout << "deep inputs (ns/byte)\n";
+    for (size_t n : {(size_t)1 << 20, (size_t)10 << 20}) {
+        std::string parens = nested(n, '1'), minus = negations(n), groups = nested(n, 'a'), alt = alternation(n);
+        ArenaParser fast;
+        std::vector<std::string> trace;
+        double tParens = timeIt(iters, [&]{ sink = evalAST<NoTrace>(fast.parse(parens), trace) != 0; });
+        double tMinus = timeIt(iters, [&]{ sink = evalAST<NoTrace>(fast.parse(minus), trace) != 0; });
+        double tGroups = timeIt(iters, [&]{ sink = parseRegex(groups).root >= 0; });
+        double tAlt = timeIt(iters, [&]{ sink = parseRegex(alt).root >= 0; });
+        std::cout << "  " << (n >> 20) << " MB  (((1))) parse+eval " << tParens / n << ", --...-1 parse+eval " << tMinus / n
+                  << ", regex (((a))) " << tGroups / n << ", regex a|...|b " << tAlt / n << "\n";
+    }
+}
+
+// --- Stage suite ------------------------------------------------------------
+// One benchmark per stage of both engines on synthetic inputs that scale
+// with n: long and deeply nested formulas, wide alternations, and regexes
+// that blow up backtracking matchers.
+
+// 1 + 2 * 3 - 4 / 5 + ... with n numbers
+std::string longFormula(int n) {
+    std::string e = "1";
+    for (int i = 1; i < n; ++i) e += std::string(" ") + "+-*/"[i % 4] + " " + std::to_string(i % 97 + 1);
+    return e;
+}
+
+// (1 + (2 + (3 + ... ))) nested depth deep
+std::string nestedFormula(int depth) {
+    std::string e = "1";
+    for (int i = 0; i < depth; ++i) e = "(" + std::to_string(i % 9 + 1) + " + " + e + ")";
+    return e;
+}
+
+// a?^n a^n. There is no '?' in the syntax, so a? is written (a|b*): against
+// a^n the b* branch can only match the empty string.
+std::string optionalThenRequired(int n) {
+    std::string re;
+    for (int i = 0; i < n; ++i) re += "(a|b*)";
+    return re + std::string(n, 'a');
+}
+
+void addArithmeticStages(BenchSuite &suite, const std::string &shape, const std::string &expr) {
+    double bytes = (double)expr.size();
+    suite.add("lex.tokenizeAll/" + shape, bytes, [=] { Lexer l(expr); sink = l.tokens.size() > 1; });
+    suite.add("lex.tokenizeAll<NoTrace>/" + shape, bytes, [=] { BasicLexer<NoTrace> l(expr); sink = l.tokens.size() > 1; });
+    auto tokens = std::make_shared<std::vector<Token>>(BasicLexer<NoTrace>(expr).tokens);
+    suite.add("parse.parseExpression/" + shape, bytes, [=] { Parser p; p.setTokens(*tokens); sink = p.parseExpression() != nullptr; });
+    suite.add("parse.parseExpression<NoTrace>/" + shape, bytes, [=] {
+        BasicParser<NoTrace> p; p.setTokens(*tokens); sink = p.parseExpression() != nullptr;
+    });
+    BasicParser<NoTrace> p;
+    p.setTokens(*tokens);
+    std::shared_ptr<ASTNode> ast(p.parseExpression().release());
+    suite.add("eval.evalAST/" + shape, bytes, [=] { std::vector<std::string> trace; sink = evalAST(ast.get(), trace) != 0; });
+    suite.add("eval.evalAST<NoTrace>/" + shape, bytes, [=] { std::vector<std::string> trace; sink = evalAST<NoTrace>(ast.get(), trace) != 0; });
+}
+
+void addRegexStages(BenchSuite &suite, const std::string &shape, const std::string &regex, const std::string &input) {
+    suite.add("regex.toPostfix/" + shape, (double)regex.size(), [=] { sink = !ThompsonNFA::toPostfix(regex).empty(); });
+    suite.add("regex.buildFromRegex/" + shape, (double)regex.size(), [=] { ThompsonNFA n; n.buildFromRegex(regex); sink = n.stateCount() > 0; });
+    suite.add("regex.buildFromRegex<NoTrace>/" + shape, (double)regex.size(), [=] {
+        ThompsonNFA n; n.buildFromRegex<NoTrace>(regex); sink = n.stateCount() > 0;
+    });
+    auto nfa = std::make_shared<ThompsonNFA>();
+    nfa->buildFromRegex<NoTrace>(regex);
+    suite.add("regex.simulate/" + shape, (double)input.size(), [=] { std::vector<std::string> steps; sink = nfa->simulate(input, steps); });
+    suite.add("regex.simulate<NoTrace>/" + shape, (double)input.size(), [=] {
+        std::vector<std::string> steps; sink = nfa->simulate<NoTrace>(input, steps);
+    });
+    suite.add("regex.simulate<EventTrace>/" + shape, (double)input.size(), [=] {
+        TraceLog log;
+        TraceLogScope scope(&log);
+        std::vector<std::string> steps; sink = nfa->simulate<EventTrace>(input, steps);
+    });
+    suite.add("regex.simulate<NoTrace>+stats/" + shape, (double)input.size(), [=] {
+        EngineStats st;
+        StatsScope scope(&st);
+        std::vector<std::string> steps; sink = nfa->simulate<NoTrace>(input, steps);
+    });
+}
+
+// Unanchored search over input: the first match, and every match
+void addSearchStages(BenchSuite &suite, const std::string &shape, const std::string &regex, const std::string &input) {
+    auto nfa = std::make_shared<ThompsonNFA>();
+    nfa->buildFromRegex<NoTrace>(regex);
+    auto search = std::make_shared<NFASearcher>(*nfa);
+    suite.add("search.findFirst/" + shape, (double)input.size(), [=] { MatchSpan m{0, 0}; sink = search->findFirst(input, m); });
+    suite.add("search.findAll/" + shape, (double)input.size(), [=] { sink = !search->findAll(input).empty(); });
+}
+
+// scale multiplies every input size
+void addStageSuite(BenchSuite &suite, int scale) {
+    addArithmeticStages(suite, "long-" + std::to_string(1000 * scale), longFormula(1000 * scale));
+    addArithmeticStages(suite, "nested-" + std::to_string(200 * scale), nestedFormula(200 * scale));
+
+    std::mt19937 rng(3);
+    int words = 50 * scale;
+    std::string text;
+    for (int i = 0; i < 200 * scale; ++i) {
+        int v = (int)(rng() % words);
+        for (int j = 0; j < 4; ++j) { text += char('a' + v % 26); v /= 26; }
+    }
+    addRegexStages(suite, "alternation-" + std::to_string(words), wordAlternation(words), text);
+    int n = 20 * scale;
+    addRegexStages(suite, "(a|aa)*-" + std::to_string(40 * n), "(a|aa)*", std::string(40 * n, 'a'));
+    addRegexStages(suite, "a?^n.a^n-" + std::to_string(n), optionalThenRequired(n), std::string(n, 'a'));
+    // counted repetition: the same cost for either bound
+    std::string abs;
+    for (int i = 0; i < 100 * n; ++i) abs += "ab";
+    for (int m : {10, 100000}) {
+        auto nfa = std::make_shared<ThompsonNFA>();
+        nfa->buildFromRegex<NoTrace>("[a-z]*(ab){3," + std::to_string(m) + "}");
+        suite.add("regex.simulateCounted/(ab){3," + std::to_string(m) + "}-" + std::to_string(abs.size()), (double)abs.size(), [=] {
+            std::vector<std::string> steps;
+            sink = nfa->simulate<NoTrace>(abs, steps);
+        });
+    }
+    addSearchStages(suite, "words-" + std::to_string(text.size()), "(abc|bcd|cde)(a|b)*", text);
+    // every a is a match, and a*b keeps a thread alive to the end of the run
+    addSearchStages(suite, "a*b|a-" + std::to_string(400 * n), "a*b|a", std::string(400 * n, 'a'));
+}
+
+static int usage() {
+    std::cerr << "usage: bench [--suite] [--filter TEXT] [--scale N] [--quick] [--json FILE] [--compare BASELINE.json] [--threshold PCT]\n"
+              << "  --suite        run only the stage suite (implied by --json and --compare)\n"
+              << "  --filter TEXT  run only suite benchmarks whose name contains TEXT\n"
+              << "  --scale N      multiply the suite's input sizes by N (default 1)\n"
+              << "  --quick        shorter measurements\n"
+              << "  --json FILE    write the suite results as JSON (- for stdout)\n"
+              << "  --compare FILE compare with an earlier --json run; exit 1 on a regression\n"
+              << "  --threshold P  slowdown in percent that counts as a regression (default 10)\n";
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    BenchSuite::Options opt;
+    bool suiteOnly = false;
+    int scale = 1;
+    double threshold = 10;
+    std::string jsonFile, baselineFile;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (a == "--suite") suiteOnly = true;
+        else if (a == "--quick") { opt.minSeconds = 0.05; opt.repetitions = 3; }
+        else if (a == "--filter" && hasValue) opt.filter = argv[++i];
+        else if (a == "--scale" && hasValue) { scale = std::atoi(argv[++i]); if (scale < 1) return usage(); }
+        else if (a == "--json" && hasValue) { jsonFile = argv[++i]; suiteOnly = true; }
+        else if (a == "--compare" && hasValue) { baselineFile = argv[++i]; suiteOnly = true; }
+        else if (a == "--threshold" && hasValue) threshold = std::atof(argv[++i]);
+        else return usage();
+    }
+
+    std::vector<BenchResult> baseline;
+    if (!baselineFile.empty()) {
+        std::ifstream in(baselineFile);
+        if (!in) { std::cerr << "bench: cannot open " << baselineFile << "\n"; return 2; }
+        baseline = readBenchJSON(in);
+    }
+
+    // with JSON on stdout the table goes to stderr
+    std::ostream &report = jsonFile == "-" ? std::cerr : std::cout;
+    BenchSuite suite(opt);
+    addStageSuite(suite, scale);
+    BenchSuite::printHeader(report);
+    std::vector<BenchResult> results = suite.run(report);
+
+    if (!jsonFile.empty()) {
+        if (jsonFile == "-") writeBenchJSON(std::cout, results);
+        else {
+            std::ofstream out(jsonFile);
+            writeBenchJSON(out, results);
+            if (!out) { std::cerr << "bench: cannot write " << jsonFile << "\n"; return 2; }
+        }
+    }
+    if (!baselineFile.empty()) {
+        report << "\ncompared with " << baselineFile << " (threshold " << threshold << "%)\n";
+        int regressions = printBenchComparison(report, compareBench(baseline, results, threshold));
+        report << regressions << " regression" << (regressions == 1 ? "" : "s") << "\n";
+        return regressions ? 1 : 0;
+    }
+    if (suiteOnly) return 0;
+
+    report << "\n";
+    benchBytecode("2 * (3 + 4 * (5 - 6 / (7 + 8))) - -9 / 3", 200000);
+    benchColumnar("(a + b) * 2 / c", 1 << 22, 5);
+    benchFrontEnd(1000000);
+    benchTracePolicy(20000);
+    benchOptimizer(20000);
+    benchJit("2 * (x + 4 * (5 - y / (7 + x))) - -9 / 3", 1000000);
+    benchEvalPipeline(500000, 3);
+    benchDeepInputs(3);
+
+    std::mt19937 rng(42);
+    std::string ab;
+    for (int i = 0; i < 4000; ++i) ab += "ab"[rng() % 2];
+    benchSimulateVsPikeVM("kth-from-end k=40", kthFromEnd(40), ab, 3);
+
+    std::string words;
+    for (int i = 0; i < 1000; ++i) {
+        int v = (int)(rng() % 60);
+        for (int j = 0; j < 4; ++j) { words += char('a' + v % 26); v /= 26; }
+    }
+    benchSimulateVsPikeVM("alternation of 60 words", wordAlternation(60), words, 3);
+
+    std::string big;
+    for (int i = 0; i < (1 << 20); ++i) big += "ab"[rng() % 2];
+    benchFastEngines("(a|b)*a(a|b)(a|b)(a|b)", "(a|b)*a(a|b)(a|b)(a|b)", big, 5);
+
+    // the same language as a 36-way alternation and as one class
+    const std::string alnum = "abcdefghijklmnopqrstuvwxyz0123456789";
+    std::string ident, alt36 = "(";
+    for (int i = 0; i < 4000; ++i) ident += alnum[rng() % alnum.size()];
+    for (char c : alnum) alt36 += std::string(alt36.size() > 1 ? "|" : "") + c;
+    alt36 += ")*";
+    benchSimulateVsPikeVM("36-way alternation (a|...|9)*", alt36, ident, 3);
+    benchSimulateVsPikeVM("class [a-z0-9]*", "[a-z0-9]*", ident, 3);
+    std::string abs;
+    for (int i = 0; i < 2000; ++i) abs += "ab";
+    benchCountedRepetition(abs, 3);
+    std::string email;
+    for (int i = 0; i < (1 << 18); ++i) email += alnum[rng() % alnum.size()];
+    email += "@example";
+    benchFastEngines("[a-z0-9]*@[a-z]*", "[a-z0-9]*@[a-z]*", email, 5);
+
+    std::vector<std::string> records;
+    for (int i = 0; i < 2000; ++i) {
+        std::string r;
+        for (int j = 0; j < 40; ++j) r += "abab"[rng() % 4];
+        records.push_back(r);
+    }
+    benchRegexSet(50, records, 3);
+    benchAutomatonStartup(100, 3);
+    std::vector<std::string> addresses;
+    for (int i = 0; i < 20000; ++i) {
+        std::string a;
+        for (int j = 0; j < 12; ++j) a += alnum[rng() % alnum.size()];
+        addresses.push_back(a + (i % 3 ? "@example.com" : ".example.com"));
+    }
+    benchStaticRegex(addresses, 5);
+
+    std::string ab64k = big.substr(0, 1 << 16);
+    benchBitParallel(20, ab64k, 5);
+    benchBitParallel(100, ab64k, 5);
+
+    std::string log;
+    for (int i = 0; i < 100000; ++i) {
+        for (int j = 0; j < 60; ++j) log += "abcdefgh "[rng() % 9];
+        if (i % 100 == 0) log += "timeout";
+        log += '\n';
+    }
+    benchPrefilter("(a|b)*timeout", log, 5);
+
+    std::vector<std::string> subjects;
+    for (int i = 0; i < 200000; ++i) subjects.push_back(big.substr(rng() % (big.size() - 64), 8 + rng() % 56));
+    std::string huge;
+    for (int i = 0; i < 16; ++i) huge += big;
+    benchParallel("(a|b)*a(a|b)(a|b)(a|b)", subjects, huge, 3);
+    return 0;
+}
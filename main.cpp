@@ -9,10 +9,15 @@
 #include <map>
 #include <memory>
 #include <sstream>
+#include <fstream>
 
 #include "Lexer.h"
 #include "Parser.h"
 #include "NFA.h"
+#include "Stats.h"
+#include "TraceLog.h"
+#include "TraceView.h"
+#include "CountingNew.h" // allocation counts in the stats panel
 
 // ---------- MAIN GUI ----------
 int main() {
@@ -30,13 +35,21 @@ int main() {
     char regexBuf[512] = "";          // regex pattern
     char regexTestBuf[512] = "";      // regex test string
 
-    std::vector<std::string> output;    // generic output area
+    // Output area: every step as a compact event, formatted only when its row
+    // is on screen. The log keeps the newest million events.
+    TraceLog output(1 << 20);
+    TraceFilter filter;
+    char searchBuf[128] = "";
+    bool showStage[TraceEvent::STAGE_COUNT] = {true, true, true, true, true, true};
 
-    Lexer lexer;
-    Parser parser;
+    BasicLexer<EventTrace> lexer;
+    BasicParser<EventTrace> parser;
     std::unique_ptr<ASTNode> ast;
     ThompsonNFA nfa;
 
+    EngineStats stats;         // filled while collectStats is on
+    bool collectStats = false;
+
     sf::Clock deltaClock;
 
     while (window.isOpen()) {
@@ -54,6 +67,9 @@ int main() {
 
         ImGui::SFML::Update(window, deltaClock.restart());
 
+        // every engine call made this frame reports into stats when collecting
+        StatsScope statsScope(collectStats ? &stats : nullptr);
+
         // ImGui window
         ImGui::Begin("RECalc");
 
@@ -68,42 +84,42 @@ int main() {
             ImGui::InputText("Expression", exprBuf, sizeof(exprBuf));
             ImGui::SameLine();
             if (ImGui::Button("Tokenize")) {
+                output.clear();
+                TraceLogScope record(&output);
                 lexer.setInput(std::string(exprBuf));
-                output = lexer.steps;
             }
             ImGui::SameLine();
             if (ImGui::Button("Parse")) {
+                output.clear();
+                TraceLogScope record(&output);
                 try {
                     lexer.setInput(std::string(exprBuf));
                     parser.setTokens(lexer.tokens);
                     ast = parser.parseExpression();
-                    output = lexer.steps;
-                    output.insert(output.end(), parser.trace.begin(), parser.trace.end());
                     std::ostringstream oss; renderAST(ast.get(), oss);
-                    output.push_back("-- AST --");
+                    output.note("-- AST --");
                     std::string s = oss.str();
                     std::istringstream iss(s);
                     std::string line;
-                    while (std::getline(iss, line)) output.push_back(line);
+                    while (std::getline(iss, line)) output.note(line);
                 } catch (std::exception &ex) {
-                    output.clear(); output.push_back(std::string("Parse error: ") + ex.what());
+                    output.clear(); output.note(std::string("Parse error: ") + ex.what());
                 }
             }
             ImGui::SameLine();
             if (ImGui::Button("Evaluate")) {
+                output.clear();
+                TraceLogScope record(&output);
                 try {
                     lexer.setInput(std::string(exprBuf));
                     parser.setTokens(lexer.tokens);
                     ast = parser.parseExpression();
                     std::vector<std::string> evalTrace;
-                    double result = evalAST(ast.get(), evalTrace);
-                    output = lexer.steps;
-                    output.insert(output.end(), parser.trace.begin(), parser.trace.end());
-                    output.push_back("-- Eval --");
-                    output.push_back("Result = " + std::to_string(result));
-                    output.insert(output.end(), evalTrace.begin(), evalTrace.end());
+                    output.note("-- Eval --");
+                    double result = evalAST<EventTrace>(ast.get(), evalTrace);
+                    output.note("Result = " + std::to_string(result));
                 } catch (std::exception &ex) {
-                    output.clear(); output.push_back(std::string("Eval error: ") + ex.what());
+                    output.clear(); output.note(std::string("Eval error: ") + ex.what());
                 }
             }
         } else if (mode == "Regex") {
@@ -111,34 +127,83 @@ int main() {
             ImGui::InputText("Test String", regexTestBuf, sizeof(regexTestBuf));
             ImGui::SameLine();
             if (ImGui::Button("Build NFA")) {
+                output.clear();
+                TraceLogScope record(&output);
                 try {
-                    nfa.buildFromRegex(std::string(regexBuf));
-                    output = nfa.trace;
+                    nfa.buildFromRegex<EventTrace>(std::string(regexBuf));
                 } catch (std::exception &ex) {
-                    output.clear(); output.push_back(std::string("NFA build error: ") + ex.what());
+                    output.clear(); output.note(std::string("NFA build error: ") + ex.what());
                 }
             }
             ImGui::SameLine();
             if (ImGui::Button("Simulate")) {
+                output.clear();
+                TraceLogScope record(&output);
                 try {
                     std::vector<std::string> sim;
-                    bool ok = nfa.simulate(std::string(regexTestBuf), sim);
-                    output = nfa.trace;
-                    output.push_back("-- Simulation --");
-                    output.insert(output.end(), sim.begin(), sim.end());
-                    output.push_back(ok?"Final: Accepted":"Final: Rejected");
+                    nfa.traceTransitions<EventTrace>();
+                    output.note("-- Simulation --");
+                    bool ok = nfa.simulate<EventTrace>(std::string(regexTestBuf), sim);
+                    output.note(ok?"Final: Accepted":"Final: Rejected");
                 } catch (std::exception &ex) {
-                    output.clear(); output.push_back(std::string("Simulation error: ") + ex.what());
+                    output.clear(); output.note(std::string("Simulation error: ") + ex.what());
                 }
             }
         }
 
         ImGui::Separator();
-        ImGui::BeginChild("Output", ImVec2(0,300), true);
-        for (const auto &line : output)
-            ImGui::TextWrapped("%s", line.c_str());
+        ImGui::InputText("Search", searchBuf, sizeof(searchBuf));
+        uint32_t stageMask = 0;
+        for (int s = 0; s < TraceEvent::STAGE_COUNT; ++s) {
+            if (s) ImGui::SameLine();
+            ImGui::Checkbox(traceStageName(s), &showStage[s]);
+            if (showStage[s]) stageMask |= 1u << s;
+        }
+        filter.setStageMask(stageMask);
+        filter.setSearch(searchBuf);
+        // a search formats events; cap the work per frame so it never stalls the UI
+        bool scanned = filter.update(output, 50000);
+        ImGui::Text("%zu of %zu events", filter.size(), output.size());
+        if (!scanned) { ImGui::SameLine(); ImGui::Text("(searching %llu%%)", (unsigned long long)(100 * filter.scannedCount(output) / output.size())); }
+        if (output.dropped()) { ImGui::SameLine(); ImGui::Text("- %llu oldest dropped", (unsigned long long)output.dropped()); }
+        ImGui::BeginChild("Output", ImVec2(0,300), true, ImGuiWindowFlags_HorizontalScrollbar);
+        // only the visible rows are formatted and submitted
+        ImGuiListClipper clipper;
+        clipper.Begin((int)filter.size());
+        while (clipper.Step()) {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+                std::string line = formatTraceEvent(output, output.at(filter.row(i)));
+                ImGui::TextUnformatted(line.c_str(), line.c_str() + line.size());
+            }
+        }
+        clipper.End();
         ImGui::EndChild();
 
+        if (ImGui::CollapsingHeader("Stats")) {
+            ImGui::Checkbox("Collect", &collectStats);
+            ImGui::SameLine();
+            if (ImGui::Button("Reset")) stats.reset();
+            ImGui::SameLine();
+            if (ImGui::Button("Copy JSON")) {
+                std::ostringstream oss; writeStatsJSON(oss, stats);
+                ImGui::SetClipboardText(oss.str().c_str());
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Save JSON")) {
+                std::ofstream f("recalc-stats.json");
+                writeStatsJSON(f, stats);
+            }
+            for (int i = 0; i < EngineStats::STAGE_COUNT; ++i) {
+                const EngineStats::StageTotals &s = stats.stages[i];
+                ImGui::Text("%-10s %6llu runs %10.3f ms %10llu allocs %12llu bytes", EngineStats::stageName(i),
+                            (unsigned long long)s.runs, s.ns / 1e6, (unsigned long long)s.allocations, (unsigned long long)s.allocatedBytes);
+            }
+            ImGui::Text("NFA: %zu states, %zu transitions (%zu epsilon)", stats.nfaStates, stats.nfaTransitions, stats.nfaEpsilonTransitions);
+            ImGui::Text("Active set: max %zu, mean %.2f over %llu steps", stats.activeMax, stats.activeMean(), (unsigned long long)stats.activeSets);
+            ImGui::Text("Epsilon closure: %llu calls, %llu states added, %llu edges followed", (unsigned long long)stats.closureCalls,
+                        (unsigned long long)stats.closureStates, (unsigned long long)stats.closureEdges);
+        }
+
         ImGui::End();
 
         window.clear(sf::Color(50, 50, 50));
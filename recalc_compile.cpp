@@ -0,0 +1,98 @@
+// recalc-compile: compile regexes ahead of time into a file that services
+// map at startup instead of building automata (see AutomatonFile.h).
+//
+//   recalc-compile [--engine auto|dfa|nfa|both] [--unanchored] [--max-states N] -o OUT [-f FILE] [PATTERN...]
+//
+//   --engine        dfa: minimized DFA; nfa: flat NFA for the Pike VM;
+//                   both: each; auto (default): the DFA if it fits in
+//                   --max-states, otherwise the NFA
+//   --unanchored    build the DFA in search mode (for recalc-grep without -x)
+//   --max-states N  DFA state limit (default 100000)
+//   -o OUT          file to write
+//   -f FILE         read more patterns from FILE, one per line
+//
+// Pattern i (command line first, then FILE) reports id i.
+// Exit status: 0 on success, 2 on error.
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "NFA.h"
+#include "DFA.h"
+#include "FlatNFA.h"
+#include "AutomatonFile.h"
+
+static int usage() {
+    std::fprintf(stderr, "usage: recalc-compile [--engine auto|dfa|nfa|both] [--unanchored] [--max-states N] -o OUT [-f FILE] [PATTERN...]\n");
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    std::string engine = "auto", out, patternFile;
+    bool unanchored = false;
+    size_t maxStates = 100000;
+    std::vector<std::string> patterns;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (a == "--engine" && hasValue) engine = argv[++i];
+        else if (a == "--unanchored") unanchored = true;
+        else if (a == "--max-states" && hasValue) maxStates = std::strtoull(argv[++i], nullptr, 10);
+        else if (a == "-o" && hasValue) out = argv[++i];
+        else if (a == "-f" && hasValue) patternFile = argv[++i];
+        else if (a.size() > 1 && a[0] == '-') return usage();
+        else patterns.push_back(a);
+    }
+    if (engine != "auto" && engine != "dfa" && engine != "nfa" && engine != "both") return usage();
+    if (out.empty() || maxStates == 0) return usage();
+    if (unanchored && engine == "nfa") {
+        std::fprintf(stderr, "recalc-compile: --unanchored needs a DFA\n");
+        return 2;
+    }
+    if (!patternFile.empty()) {
+        std::ifstream in(patternFile);
+        if (!in) { std::fprintf(stderr, "recalc-compile: cannot open %s\n", patternFile.c_str()); return 2; }
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            patterns.push_back(line);
+        }
+    }
+    if (patterns.empty()) return usage();
+
+    std::string image;
+    try {
+        ThompsonNFA nfa;
+        if (patterns.size() == 1) nfa.buildFromRegex<NoTrace>(patterns[0]);
+        else nfa.buildFromRegexSet<NoTrace>(patterns);
+        std::unique_ptr<DFA> dfa;
+        std::unique_ptr<FlatNFA> flat;
+        if (engine != "nfa") {
+            try {
+                dfa.reset(new DFA(compileDFA(nfa, maxStates, unanchored)));
+            } catch (std::exception &ex) {
+                if (engine != "auto" || unanchored) throw;
+                std::fprintf(stderr, "recalc-compile: %s; storing the NFA instead\n", ex.what());
+            }
+        }
+        if (engine == "nfa" || engine == "both" || !dfa) flat.reset(new FlatNFA(nfa));
+        image = serializeAutomaton(patterns, dfa.get(), flat.get(), unanchored);
+        std::fprintf(stderr, "%zu pattern(s)", patterns.size());
+        if (dfa) std::fprintf(stderr, ", DFA %d states x %d classes", dfa->numStates, dfa->numClasses);
+        if (flat) std::fprintf(stderr, ", NFA %zu instructions", flat->size());
+        std::fprintf(stderr, ", %zu bytes\n", image.size());
+    } catch (std::exception &ex) {
+        std::fprintf(stderr, "recalc-compile: %s\n", ex.what());
+        return 2;
+    }
+
+    std::ofstream file(out, std::ios::binary | std::ios::trunc);
+    file.write(image.data(), (std::streamsize)image.size());
+    file.close();
+    if (!file) { std::fprintf(stderr, "recalc-compile: cannot write %s\n", out.c_str()); return 2; }
+    return 0;
+}
@@ -0,0 +1,82 @@
+// recalc-eval: evaluate one arithmetic expression per line of a file (or stdin).
+// Headless: needs only the standard library and a thread library.
+//
+//   recalc-eval [--batch N] [--queue N] [--precision N] [--max-line BYTES] [--stats] [FILE]
+//
+//   --batch N      lines passed between pipeline stages at once (default 4096)
+//   --queue N      batches each stage may run ahead of the next (default 4)
+//   --precision N  significant digits printed (default 17, which round-trips)
+//   --max-line BYTES  longer lines give "error: Line too long" (default 16 MiB)
+//   --stats        print line and error counts to stderr
+//
+// Prints one line per input line, in input order: the value, an empty line
+// for an empty input line, or "error: <message>" if the line doesn't parse.
+// A bad line doesn't stop the run.
+//
+// Exit status: 0 if every line evaluated, 1 if any line failed, 2 on error.
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "EvalPipeline.h"
+
+static int usage() {
+    std::fprintf(stderr, "usage: recalc-eval [--batch N] [--queue N] [--precision N] [--max-line BYTES] [--stats] [FILE]\n");
+    return 2;
+}
+
+// Positive integer option value, or 0 if it isn't one
+static long count(const char *s) {
+    char *end;
+    long n = std::strtol(s, &end, 10);
+    return *s && !*end && n > 0 ? n : 0;
+}
+
+int main(int argc, char **argv) {
+    EvalOptions opt;
+    bool stats = false;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--stats") stats = true;
+        else if (a == "--batch" || a == "--queue" || a == "--precision" || a == "--max-line") {
+            long n = i + 1 < argc ? count(argv[++i]) : 0;
+            if (!n) return usage();
+            if (a == "--batch") opt.batchLines = (size_t)n;
+            else if (a == "--queue") opt.queueBatches = (size_t)n;
+            else if (a == "--max-line") opt.maxLineBytes = (size_t)n;
+            else opt.precision = n > 40 ? 40 : (int)n;
+        }
+        else if (a.size() > 1 && a[0] == '-') return usage();
+        else args.push_back(a);
+    }
+    if (args.size() > 1) return usage();
+
+    std::ios::sync_with_stdio(false);
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    EvalPipeline pipeline(opt);
+    EvalSummary sum;
+    if (args.empty() || args[0] == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        sum = pipeline.run(std::cin, std::cout);
+    } else {
+        std::ifstream in(args[0], std::ios::binary);
+        if (!in) { std::fprintf(stderr, "recalc-eval: cannot open %s\n", args[0].c_str()); return 2; }
+        sum = pipeline.run(in, std::cout);
+    }
+    if (!std::cout) { std::fprintf(stderr, "recalc-eval: write error\n"); return 2; }
+    if (stats) std::fprintf(stderr, "lines: %llu, errors: %llu\n", (unsigned long long)sum.lines, (unsigned long long)sum.errors);
+    return sum.errors ? 1 : 0;
+}
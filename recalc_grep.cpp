@@ -0,0 +1,215 @@
+// recalc-grep: print the lines of a file (or stdin) that match a regex.
+// Headless: needs only the standard library and the OS file-mapping API.
+//
+//   recalc-grep [-x] [-c] [-n] [--chunked] [--no-prefilter] [--stats] PATTERN [FILE]
+//   recalc-grep [options] --compiled AUTOMATON [FILE]
+//
+//   -x              the whole line must match (default: any substring)
+//   -c              print only the number of matching lines
+//   -n              prefix each line with its line number
+//   --chunked       read FILE in fixed-size chunks instead of mapping it
+//   --no-prefilter  run every line through the DFA, even without the pattern's literal
+//   --stats         print prefilter statistics to stderr
+//   --compiled A    match with the DFA in A (from recalc-compile, --unanchored
+//                   unless -x) instead of compiling a pattern; lines matching
+//                   any of its patterns are printed
+//
+// Exit status: 0 if a line matched, 1 if none did, 2 on error.
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "NFA.h"
+#include "DFA.h"
+#include "Grep.h"
+#include "Prefilter.h"
+#include "AutomatonFile.h"
+#include <memory>
+
+static const size_t CHUNK_SIZE = 1 << 20;
+
+struct Options {
+    bool wholeLine = false, countOnly = false, lineNumbers = false, chunked = false;
+    bool prefilter = true, stats = false;
+    std::string pattern, file, compiled;
+};
+
+// Prints matching lines straight out of whatever buffer holds them
+struct Printer {
+    const Options &opt;
+    uint64_t count = 0;
+    PrefilterStats stats{};
+
+    void line(const char *text, size_t len, uint64_t lineNumber) {
+        count++;
+        if (opt.countOnly) return;
+        if (opt.lineNumbers) std::printf("%llu:", (unsigned long long)lineNumber);
+        std::fwrite(text, 1, len, stdout);
+        std::fputc('\n', stdout);
+    }
+};
+
+// Whole input in memory: lines are printed from the mapping itself
+static void grepBuffer(const LineMatcher &m, const char *data, size_t size, Printer &out) {
+    auto onLine = [&](uint64_t from, uint64_t to, uint64_t ln, bool matched) {
+        if (matched) out.line(data + from, (size_t)(to - from), ln);
+    };
+    LineMatcher::State st = m.begin();
+    m.feed(st, data, size, onLine);
+    m.finish(st, onLine);
+    out.stats = st.stats;
+}
+
+// Fixed-size reads. Only the unfinished last line of a chunk is moved to the
+// front of the buffer so it can still be printed; it is never scanned twice.
+static void grepStream(const LineMatcher &m, std::FILE *in, Printer &out) {
+    std::vector<char> buf(CHUNK_SIZE);
+    uint64_t bufBase = 0; // stream offset of buf[0]
+    size_t used = 0;
+    LineMatcher::State st = m.begin();
+    auto onLine = [&](uint64_t from, uint64_t to, uint64_t ln, bool matched) {
+        if (matched) out.line(buf.data() + (from - bufBase), (size_t)(to - from), ln);
+    };
+    while (true) {
+        if (used == buf.size()) buf.resize(buf.size() * 2); // line longer than the buffer
+        size_t got = std::fread(buf.data() + used, 1, buf.size() - used, in);
+        if (got == 0) break;
+        m.feed(st, buf.data() + used, got, onLine);
+        used += got;
+        size_t keep = (size_t)(st.offset - st.lineStart);
+        std::memmove(buf.data(), buf.data() + used - keep, keep);
+        bufBase = st.lineStart;
+        used = keep;
+    }
+    m.finish(st, onLine);
+    out.stats = st.stats;
+}
+
+#ifdef _WIN32
+static bool grepMapped(const LineMatcher &m, const std::string &path, Printer &out) {
+    HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (f == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(f, &size)) { CloseHandle(f); return false; }
+    if (size.QuadPart == 0) { CloseHandle(f); grepBuffer(m, "", 0, out); return true; }
+    HANDLE map = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const char *data = map ? (const char *)MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!data) { if (map) CloseHandle(map); CloseHandle(f); return false; }
+    grepBuffer(m, data, (size_t)size.QuadPart, out);
+    UnmapViewOfFile(data);
+    CloseHandle(map);
+    CloseHandle(f);
+    return true;
+}
+#else
+static bool grepMapped(const LineMatcher &m, const std::string &path, Printer &out) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) { close(fd); return false; }
+    size_t size = (size_t)sb.st_size;
+    if (size == 0) { close(fd); grepBuffer(m, "", 0, out); return true; }
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    madvise(data, size, MADV_SEQUENTIAL);
+    grepBuffer(m, (const char *)data, size, out);
+    munmap(data, size);
+    return true;
+}
+#endif
+
+static int usage() {
+    std::fprintf(stderr, "usage: recalc-grep [-x] [-c] [-n] [--chunked] [--no-prefilter] [--stats] PATTERN [FILE]\n"
+                         "       recalc-grep [options] --compiled AUTOMATON [FILE]\n");
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    Options opt;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "-x") opt.wholeLine = true;
+        else if (a == "-c") opt.countOnly = true;
+        else if (a == "-n") opt.lineNumbers = true;
+        else if (a == "--chunked") opt.chunked = true;
+        else if (a == "--no-prefilter") opt.prefilter = false;
+        else if (a == "--stats") opt.stats = true;
+        else if (a == "--compiled" && i + 1 < argc) opt.compiled = argv[++i];
+        else if (a.size() > 1 && a[0] == '-' && args.empty()) return usage();
+        else args.push_back(a);
+    }
+    // with --compiled there is no PATTERN argument
+    size_t fileArg = opt.compiled.empty() ? 1 : 0;
+    if (args.size() < fileArg || args.size() > fileArg + 1) return usage();
+    if (fileArg) opt.pattern = args[0];
+    if (args.size() > fileArg && args[fileArg] != "-") opt.file = args[fileArg];
+
+    DFA dfa;
+    std::unique_ptr<CompiledAutomaton> compiled;
+    DFAView view;
+    std::string literal;
+    try {
+        if (opt.compiled.empty()) {
+            ThompsonNFA nfa;
+            nfa.buildFromRegex<NoTrace>(opt.pattern);
+            dfa = compileDFA(nfa, 100000, !opt.wholeLine);
+            view = dfa.view();
+        } else {
+            compiled.reset(new CompiledAutomaton(opt.compiled));
+            if (!compiled->hasDFA()) throw std::runtime_error(opt.compiled + " has no DFA");
+            if (compiled->unanchored() == opt.wholeLine)
+                throw std::runtime_error(opt.compiled + (opt.wholeLine ? " was compiled with --unanchored; drop it for -x"
+                                                                       : " was compiled without --unanchored; add it, or use -x"));
+            view = compiled->dfa();
+            // the prefilter literal needs a single pattern's text
+            if (compiled->patternCount() == 1) opt.pattern = std::string(compiled->pattern(0));
+        }
+        // the stored pattern may not parse, e.g. a file from another build
+        if (opt.prefilter && !opt.pattern.empty()) literal = prefilterLiteral(opt.pattern);
+    } catch (std::exception &ex) {
+        std::fprintf(stderr, "recalc-grep: %s\n", ex.what());
+        return 2;
+    }
+    LineMatcher matcher(view, opt.wholeLine, literal);
+    Printer out{opt};
+
+    if (opt.file.empty()) {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        grepStream(matcher, stdin, out);
+    } else if (opt.chunked || !grepMapped(matcher, opt.file, out)) {
+        std::FILE *in = std::fopen(opt.file.c_str(), "rb");
+        if (!in) { std::fprintf(stderr, "recalc-grep: cannot open %s\n", opt.file.c_str()); return 2; }
+        grepStream(matcher, in, out);
+        std::fclose(in);
+    }
+    if (opt.countOnly) std::printf("%llu\n", (unsigned long long)out.count);
+    if (opt.stats) {
+        const PrefilterStats &ps = out.stats;
+        std::fprintf(stderr, "literal: \"%s\"\n", literal.c_str());
+        std::fprintf(stderr, "lines skipped: %llu, verified: %llu, matched: %llu\n",
+                     (unsigned long long)ps.linesSkipped, (unsigned long long)ps.linesVerified, (unsigned long long)ps.linesMatched);
+        std::fprintf(stderr, "skip rate: %.1f%%, candidate hit rate: %.1f%%, bytes skipped: %llu\n",
+                     100.0 * ps.skipRate(), 100.0 * ps.hitRate(), (unsigned long long)ps.bytesSkipped);
+    }
+    return out.count ? 0 : 1;
+}
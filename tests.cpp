@@ -2,9 +2,38 @@
 #include <cassert>
 #include <vector>
 #include <string>
+#include <sstream>
+#include <algorithm>
+#include <functional>
 #include "Lexer.h"
 #include "Parser.h"
+#include "Bytecode.h"
+#include "Columnar.h"
+#include "Optimize.h"
+#include "Jit.h"
+#include "EvalPipeline.h"
+#include <random>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <cstdio>
+#include <chrono>
 #include "NFA.h"
+#include "DFA.h"
+#include "FlatNFA.h"
+#include "Grep.h"
+#include "RegexSet.h"
+#include "Prefilter.h"
+#include "Glushkov.h"
+#include "Regex.h"
+#include "Search.h"
+#include "AutomatonFile.h"
+#include "StaticRegex.h"
+#include "Parallel.h"
+#include "BenchSuite.h"
+#include "Stats.h"
+#include "TraceView.h"
+#include "CountingNew.h"
 
 void testArithmetic() {
     std::cout << "Testing Arithmetic..." << std::endl;
@@ -37,6 +66,420 @@ void testArithmetic() {
     std::cout << "  10 / 2 + 5 = " << result << " [PASS]" << std::endl;
 }
 
+void testBytecode() {
+    std::cout << "Testing Bytecode VM..." << std::endl;
+    const char *exprs[] = {"1 + 2", "3 * (4 - 2)", "10 / 2 + 5", "-(-3)", "+-+2 * 4", "1 / 0", "-1 / 0",
+                           "2 * (3 + 4 * (5 - 6 / (7 + 8))) - 9", "((((1))))", "1 - 2 - 3 - 4", "0.5 * .25 / 3"};
+    Lexer lexer;
+    Parser parser;
+    StackVM vm;
+    for (const char *e : exprs) {
+        lexer.setInput(e);
+        parser.setTokens(lexer.tokens);
+        auto ast = parser.parseExpression();
+        std::vector<std::string> trace;
+        double expected = evalAST(ast.get(), trace);
+        Bytecode bc = compileBytecode(ast.get());
+        assert(vm.run(bc) == expected);
+        assert(vm.run(bc) == expected); // the VM can be reused
+    }
+    lexer.setInput("1 + 2 * 3");
+    parser.setTokens(lexer.tokens);
+    Bytecode bc = compileBytecode(parser.parseExpression().get());
+    assert(bc.code.size() == 5 && bc.maxStack == 3);
+    std::cout << "  bytecode agrees with evalAST [PASS]" << std::endl;
+}
+
+void testColumnar() {
+    std::cout << "Testing variables and columnar evaluation..." << std::endl;
+    Lexer lexer("(a + b_2) * 2 / c");
+    assert(lexer.tokens[1].type == TOK_IDENT && lexer.tokens[1].value == "a");
+    assert(lexer.tokens[3].type == TOK_IDENT && lexer.tokens[3].value == "b_2");
+    Parser parser;
+    parser.setTokens(lexer.tokens);
+    auto ast = parser.parseExpression();
+    std::vector<std::string> trace;
+    Variables vars{{"a", 1}, {"b_2", 2}, {"c", 4}};
+    assert(evalAST(ast.get(), trace, &vars) == 1.5);
+    bool threw = false;
+    try { evalAST(ast.get(), trace); } catch (const std::runtime_error &) { threw = true; }
+    assert(threw);
+    std::cout << "  identifiers parse and evaluate [PASS]" << std::endl;
+
+    const char *formulas[] = {"(a + b) * 2 / c", "-a", "a", "3 - 4", "-(a - -b) * (c / a) - 2 * 3 + b", "1 / (a - a)", "x * x * x - y"};
+    const size_t sizes[] = {0, 1, 3, 1023, 1024, 1025, 5000};
+    std::vector<double> cols[4];
+    for (int v = 0; v < 4; ++v)
+        for (size_t r = 0; r < 5000; ++r) cols[v].push_back(((double)((r * 7919 + v * 104729) % 2001) - 1000.0) / 7.0);
+    StackVM vm;
+    for (const char *f : formulas) {
+        lexer.setInput(f);
+        parser.setTokens(lexer.tokens);
+        Bytecode bc = compileBytecode(parser.parseExpression().get());
+        std::vector<const double*> columns;
+        for (size_t i = 0; i < bc.variables.size(); ++i) columns.push_back(cols[i].data());
+        for (bool avx2 : {false, cpuHasAVX2()}) {
+            ColumnEvaluator ev(bc, avx2);
+            for (size_t rows : sizes) {
+                std::vector<double> out(rows + 1, 12345.0);
+                ev.run(columns, rows, out.data());
+                for (size_t r = 0; r < rows; ++r) {
+                    double row[4] = {cols[0][r], cols[1][r], cols[2][r], cols[3][r]};
+                    double expected = vm.run(bc, row);
+                    assert(std::memcmp(&out[r], &expected, sizeof(double)) == 0);
+                }
+                assert(out[rows] == 12345.0);
+            }
+        }
+    }
+    lexer.setInput("y - x");
+    parser.setTokens(lexer.tokens);
+    Bytecode bc = compileBytecode(parser.parseExpression().get());
+    ColumnEvaluator ev(bc);
+    std::vector<double> out(3);
+    double xs[] = {1, 2, 3}, ys[] = {10, 20, 30};
+    ev.run({{"x", xs}, {"y", ys}}, 3, out.data());
+    assert(out[0] == 9 && out[1] == 18 && out[2] == 27);
+    std::cout << "  columnar results are bit-identical to the stack VM [PASS]" << std::endl;
+}
+
+void testArenaParser() {
+    std::cout << "Testing arena parser..." << std::endl;
+    const char *exprs[] = {"1 + 2", "3 * (4 - 2)", "-(-3) / .5", "+-+2 * 4.", "2 * (3 + 4 * (5 - 6 / (7 + 8))) - 9",
+                           "(a + b) * 2 / c", "long_variable_name_that_needs_the_heap * a", "1 - 2 - 3 - 4"};
+    Variables vars{{"a", 3}, {"b", -1}, {"c", 8}, {"long_variable_name_that_needs_the_heap", 0.5}};
+    Lexer lexer;
+    Parser parser;
+    ArenaParser fast;
+    for (const char *e : exprs) {
+        lexer.setInput(e);
+        parser.setTokens(lexer.tokens);
+        auto ast = parser.parseExpression();
+        std::vector<std::string> trace;
+        std::ostringstream a, b;
+        renderAST(ast.get(), a);
+        const ASTNode *node = fast.parse(e);
+        renderAST(node, b);
+        assert(a.str() == b.str());
+        assert(evalAST(node, trace, &vars) == evalAST(ast.get(), trace, &vars));
+    }
+    std::cout << "  same trees as the traced parser [PASS]" << std::endl;
+
+    bool threw = false;
+    try { fast.parse("(1 + 2"); } catch (const std::runtime_error &) { threw = true; }
+    assert(threw);
+    threw = false;
+    try { fast.parse("1 + ."); } catch (const std::runtime_error &) { threw = true; }
+    assert(threw);
+    std::vector<std::string> trace;
+    assert(evalAST(fast.parse("6 / 3"), trace) == 2);
+
+    // the arena is rewound, not regrown, between expressions
+    fast.parse("2 * (3 + 4 * (5 - 6 / (7 + 8))) - 9");
+    size_t blocks = fast.memory().blockCount();
+    for (int i = 0; i < 100000; ++i) fast.parse("2 * (3 + 4 * (5 - 6 / (7 + 8))) - 9");
+    assert(fast.memory().blockCount() == blocks && blocks == 1);
+    std::cout << "  arena memory is reused across parses [PASS]" << std::endl;
+}
+
+void testTracePolicy() {
+    std::cout << "Testing trace policies..." << std::endl;
+    const char *exprs[] = {"1 + 2 * x", "-(3 - 4) / 2", "((7)) + 0"};
+    Variables vars{{"x", 5}};
+    for (const char *e : exprs) {
+        Lexer full(e);
+        BasicLexer<NoTrace> quiet(e);
+        assert(!full.steps.empty() && quiet.steps.empty());
+        assert(full.tokens.size() == quiet.tokens.size());
+        Parser p1;
+        BasicParser<NoTrace> p2;
+        p1.setTokens(full.tokens);
+        p2.setTokens(quiet.tokens);
+        auto a = p1.parseExpression(), b = p2.parseExpression();
+        assert(!p1.trace.empty() && p2.trace.empty());
+        std::vector<std::string> t1, t2;
+        assert(evalAST(a.get(), t1, &vars) == evalAST<NoTrace>(b.get(), t2, &vars));
+        assert(!t1.empty() && t2.empty());
+    }
+    ThompsonNFA traced, quiet;
+    traced.buildFromRegex("(a|b)*abb");
+    quiet.buildFromRegex<NoTrace>("(a|b)*abb");
+    assert(!traced.trace.empty() && quiet.trace.empty());
+    for (const char *s : {"abb", "aabb", "ab", "", "babb"}) {
+        std::vector<std::string> t1, t2;
+        assert(traced.simulate(s, t1) == quiet.simulate<NoTrace>(s, t2));
+        assert(!t1.empty() && t2.empty());
+    }
+    std::cout << "  NoTrace gives the same results with no trace output [PASS]" << std::endl;
+}
+
+// Random formulas over x, y, z for differential tests. Earlier subexpressions
+// are reused now and then, so the formulas have common subtrees.
+struct FormulaGenerator {
+    std::mt19937 rng;
+    std::vector<std::string> pool;
+    explicit FormulaGenerator(unsigned seed) : rng(seed) {}
+
+    std::string operator()(int depth) {
+        static const char *leaves[] = {"x", "y", "z", "0", "1", "2", "0.5", "3", "-0", "99999999999"};
+        if (!pool.empty() && rng() % 6 == 0) return "(" + pool[rng() % pool.size()] + ")";
+        if (depth == 0 || rng() % 4 == 0) return leaves[rng() % 10];
+        std::string e;
+        switch (rng() % 6) {
+            case 0: e = "-" + (*this)(depth - 1); break;
+            case 1: e = "--" + (*this)(depth - 1); break;
+            default: {
+                std::string l = (*this)(depth - 1);
+                char op = "+-*/"[rng() % 4];
+                e = "(" + l + " " + op + " " + (*this)(depth - 1) + ")";
+                break;
+            }
+        }
+        if (pool.size() < 50) pool.push_back(e);
+        return e;
+    }
+
+    // x, y, z drawn from values that exercise signed zeros, overflow, denormals, inf and NaN
+    Variables randomValues(std::mt19937 &r) const {
+        static const double values[] = {0.0, -0.0, 1.0, -1.0, 2.5, 1e308, -1e-310, INFINITY, -INFINITY, NAN};
+        return Variables{{"x", values[r() % 10]}, {"y", values[r() % 10]}, {"z", values[r() % 10]}};
+    }
+};
+
+// Bit-for-bit equality, except that any NaN matches any NaN: which NaN an
+// operation on two NaNs returns depends on the compiler's operand order
+bool sameResult(double a, double b) { return (std::isnan(a) && std::isnan(b)) || std::memcmp(&a, &b, sizeof a) == 0; }
+
+void testOptimizer() {
+    std::cout << "Testing AST optimizer..." << std::endl;
+    ArenaParser parser;
+    OptimizeStats st;
+    ExprDAG dag = optimizeAST(parser.parse("(x*1 + --y) * (x*1 + --y)"), &st);
+    assert(st.astNodes == 15 && st.simplifiedNodes == 7 && st.dagNodes == 4);
+    dag = optimizeAST(parser.parse("2 * (3 + 4) - 1 / 0"), &st);
+    assert(st.dagNodes == 1 && std::isinf(dag.nodes[0].value) && dag.nodes[0].value < 0);
+    dag = optimizeAST(parser.parse("0 + x"), &st);
+    assert(st.dagNodes == 3); // kept: -0 + 0 is +0
+    dag = optimizeAST(parser.parse("x / 0"), &st);
+    assert(st.dagNodes == 3 && std::isinf(dag.eval(Variables{{"x", 1}})));
+    std::cout << "  folding, identities and sharing [PASS]" << std::endl;
+
+    // randomized differential test against unoptimized evalAST, bit for bit
+    FormulaGenerator gen(12345);
+    std::mt19937 rng(54321);
+    size_t before = 0, after = 0;
+    std::vector<double> scratch;
+    for (int i = 0; i < 3000; ++i) {
+        std::string expr = gen(6);
+        const ASTNode *ast = parser.parse(expr);
+        dag = optimizeAST(ast, &st);
+        assert(st.dagNodes <= st.astNodes && st.simplifiedNodes <= st.astNodes);
+        before += st.astNodes;
+        after += st.dagNodes;
+        auto tree = dag.toAST();
+        for (int k = 0; k < 5; ++k) {
+            Variables vars = gen.randomValues(rng);
+            std::vector<std::string> trace;
+            double expected = evalAST<NoTrace>(ast, trace, &vars);
+            assert(sameResult(dag.eval(vars), expected));
+            assert(sameResult(evalAST<NoTrace>(tree.get(), trace, &vars), expected));
+        }
+    }
+    assert(after < before);
+    std::cout << "  3000 random formulas agree bit for bit (" << before << " -> " << after << " nodes) [PASS]" << std::endl;
+}
+
+void testJit() {
+    std::cout << "Testing JIT..." << std::endl;
+    ArenaParser parser;
+    JitFunction seven(parser.parse("1 + 2 * 3"));
+#ifdef RECALC_HAVE_JIT
+    assert(seven.native() && seven.fn()(nullptr) == 7);
+#endif
+    assert(seven.eval() == 7);
+    bool threw = false;
+    try { JitFunction(parser.parse("x + 1")).eval(); } catch (const std::runtime_error &) { threw = true; }
+    assert(threw);
+
+    // deep enough to spill the operand stack out of registers
+    std::string deep = "x";
+    for (int i = 0; i < 40; ++i) deep = "(" + std::to_string(i) + " - -(" + deep + ")) / 2";
+    std::string wide = "x";
+    for (int i = 0; i < 12; ++i) wide = std::to_string(i + 1) + " * (y - " + wide + ")";
+    for (const std::string &e : {deep, wide}) {
+        const ASTNode *ast = parser.parse(e);
+        JitFunction f(ast);
+        Variables vars{{"x", 1.25}, {"y", -3}};
+        std::vector<std::string> trace;
+        double in[2];
+        for (size_t i = 0; i < f.bytecode().variables.size(); ++i) in[i] = vars[f.bytecode().variables[i]];
+        assert(f.eval(in) == evalAST<NoTrace>(ast, trace, &vars));
+    }
+
+    // randomized differential test, native code and interpreter fallback
+    FormulaGenerator gen(777);
+    std::mt19937 rng(99);
+    for (int i = 0; i < 2000; ++i) {
+        const ASTNode *ast = parser.parse(gen(7));
+        JitFunction native(ast), interpreted(ast, false);
+        assert(!interpreted.native());
+        for (int k = 0; k < 5; ++k) {
+            Variables vars = gen.randomValues(rng);
+            double in[3];
+            const std::vector<std::string> &names = native.bytecode().variables;
+            for (size_t v = 0; v < names.size(); ++v) in[v] = vars[names[v]];
+            std::vector<std::string> trace;
+            double expected = evalAST<NoTrace>(ast, trace, &vars);
+            assert(sameResult(native.eval(in), expected));
+            assert(sameResult(interpreted.eval(in), expected));
+        }
+    }
+    std::cout << "  2000 random formulas agree with evalAST" << (seven.native() ? " (native x86-64)" : " (interpreter fallback)") << " [PASS]" << std::endl;
+}
+
+void testEvalPipeline() {
+    std::cout << "Testing eval pipeline..." << std::endl;
+    std::istringstream in("1 + 2 * 3\n\n(4 - 1) / 2\r\n1 +\nx * 2\n7 $ 1\n1 2\n-(5)");
+    std::ostringstream out;
+    EvalSummary sum = EvalPipeline().run(in, out);
+    assert(out.str() == "7\n\n1.5\nerror: Unexpected token in primary: \nerror: Unknown variable: x\n"
+                        "error: Invalid character '$' at 2\nerror: Unexpected input after expression\n-5\n");
+    assert(sum.lines == 8 && sum.errors == 4);
+    std::cout << "  Values, blank lines and per-line errors [PASS]" << std::endl;
+
+    // lines over maxLineBytes, within a block, across blocks and unterminated
+    EvalOptions capped;
+    capped.maxLineBytes = 100000;
+    std::string ones = "1";
+    while (ones.size() < capped.maxLineBytes - 1) ones += "+1";
+    std::istringstream longIn("2*3\n" + ones + "\n" + ones + "+1\n" + std::string(300000, ' ') + "\n4\n" + std::string(100001, '5'));
+    std::ostringstream longOut;
+    sum = EvalPipeline(capped).run(longIn, longOut);
+    assert(longOut.str() == "6\n50000\nerror: Line too long\nerror: Line too long\n4\nerror: Line too long\n");
+    assert(sum.lines == 6 && sum.errors == 3);
+    std::cout << "  Lines over maxLineBytes are reported, not wrapped [PASS]" << std::endl;
+
+    // tiny batches and queues: many batches in flight, order must survive
+    FormulaGenerator gen(4242);
+    ArenaParser parser;
+    std::string text;
+    std::vector<double> expected;
+    for (int i = 0; i < 3000; ++i) {
+        std::string e = gen(5);
+        // the generator's variables have no value here; swap them for constants
+        for (char &c : e) if (c >= 'x' && c <= 'z') c = (char)('1' + (c - 'x'));
+        text += e + "\n";
+        std::vector<std::string> trace;
+        expected.push_back(evalAST<NoTrace>(parser.parse(e), trace));
+    }
+    EvalOptions small;
+    small.batchLines = 7;
+    small.queueBatches = 1;
+    std::istringstream many(text);
+    std::ostringstream got;
+    sum = EvalPipeline(small).run(many, got);
+    assert(sum.lines == 3000 && sum.errors == 0);
+    std::istringstream lines(got.str());
+    std::string line;
+    size_t n = 0;
+    while (std::getline(lines, line)) { assert(n < expected.size() && sameResult(std::strtod(line.c_str(), nullptr), expected[n])); n++; }
+    assert(n == expected.size());
+    std::cout << "  3000 lines in input order through 1-batch queues [PASS]" << std::endl;
+}
+
+// Seconds fn takes, best of reps runs
+double secondsFor(const std::function<void()> &fn, int reps = 1) {
+    double best = 1e9;
+    for (int i = 0; i < reps; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+void testDeepExpressions() {
+    std::cout << "Testing deep expressions..." << std::endl;
+    Lexer lexer;
+    Parser parser;
+    lexer.setInput("-(1 + 2) * --x");
+    parser.setTokens(lexer.tokens);
+    auto ast = parser.parseExpression();
+    std::vector<std::string> expected{"Number 1", "Number 2", "Binary +", "Unary -", "Variable x", "Unary -", "Unary -", "Binary *"};
+    assert(parser.trace == expected);
+    std::ostringstream out;
+    renderAST(ast.get(), out);
+    assert(out.str() == "Binary(*)\n  Unary(-)\n    Binary(+)\n      Number(1)\n      Number(2)\n  Unary(-)\n    Unary(-)\n      Variable(x)\n");
+    std::vector<std::string> trace;
+    Variables vars{{"x", 2}};
+    assert(evalAST(ast.get(), trace, &vars) == -6);
+    expected = {"Variable x: 2.000000", "Unary -: 2.000000", "Unary -: -2.000000", "Mul: -3.000000 * 2.000000"};
+    assert(trace.size() == 6 && std::equal(expected.begin(), expected.end(), trace.begin() + 2));
+    auto error = [&](const std::string &text) {
+        std::string message;
+        try { lexer.setInput(text); parser.setTokens(lexer.tokens); parser.parseExpression(); } catch (const std::runtime_error &e) { message = e.what(); }
+        return message;
+    };
+    assert(error("(1 + 2") == "Expected )" && error("((1) 2)") == "Expected )" && error("1 * (2 +") == "Unexpected token in primary: ");
+    assert(error("1 + )") == "Unexpected token in primary: )" && error(std::string(100000, '(') + "1") == "Expected )");
+    std::cout << "  same trees, traces and errors as recursive descent [PASS]" << std::endl;
+
+    // nesting that would overflow the call stack, at 1 MB and 10 MB: time
+    // grows linearly and heap use per input byte stays flat
+    auto nested = [](size_t n) { return std::string(n / 2, '(') + "1" + std::string(n / 2, ')'); };
+    double seconds[2];
+    size_t heap[2], sizes[2] = {1 << 20, 10 << 20};
+    for (int k = 0; k < 2; ++k) {
+        std::string text = nested(sizes[k]);
+        size_t before = allocationCounter().bytes.load();
+        double value = 0;
+        seconds[k] = secondsFor([&] {
+            ArenaParser fast;
+            value = evalAST<NoTrace>(fast.parse(text), trace);
+        }, k == 0 ? 3 : 1);
+        heap[k] = (allocationCounter().bytes.load() - before) / (k == 0 ? 3 : 1);
+        assert(value == 1 && heap[k] < 32 * text.size());
+    }
+    assert(seconds[1] < 30 * seconds[0]);
+    std::cout << "  10 MB of parentheses in " << seconds[1] << " s, " << heap[1] / sizes[1] << " heap bytes per input byte [PASS]" << std::endl;
+
+    // one node per operator, chains and right-nested trees, through every stage
+    std::function<std::string(size_t)> shapes[] = {
+        [](size_t n) { return std::string(n - 1, '-') + "1"; },
+        [](size_t n) { std::string s; while (s.size() + 2 < n) s += "1+"; return s + "1"; },
+        [](size_t n) { std::string s; while (s.size() + 4 < n) s += "1/("; return s + "1" + std::string(s.size() / 3, ')'); },
+    };
+    for (auto &shape : shapes) {
+        for (int k = 0; k < 2; ++k) {
+            std::string text = shape(sizes[k] / 10);
+            size_t before = allocationCounter().bytes.load();
+            double v = 0, onVM = 0, onHeap = 0;
+            OptimizeStats st;
+            seconds[k] = secondsFor([&] {
+                ArenaParser fast;
+                const ASTNode *root = fast.parse(text);
+                v = evalAST<NoTrace>(root, trace);
+                StackVM vm;
+                onVM = vm.run(compileBytecode(root));
+                optimizeAST(root, &st);
+                std::ostringstream discard;
+                discard.setstate(std::ios::badbit);
+                renderAST(root, discard); // O(depth^2) characters, not written
+                BasicLexer<NoTrace> lex(text);
+                BasicParser<NoTrace> heapParser;
+                heapParser.setTokens(lex.tokens);
+                auto tree = heapParser.parseExpression();
+                onHeap = evalAST<NoTrace>(tree.get(), trace);
+            });
+            heap[k] = allocationCounter().bytes.load() - before;
+            assert(onVM == v && onHeap == v && heap[k] < 512 * text.size());
+            assert(st.dagNodes == 1); // all constants, folded
+        }
+        assert(seconds[1] < 30 * seconds[0] && heap[1] < 15 * heap[0]);
+    }
+    std::cout << "  --...-1, 1+...+1 and 1/(1/(...)) of 1 MB: parse, eval, bytecode, optimize, render, free [PASS]" << std::endl;
+}
+
 void testRegex() {
     std::cout << "Testing Regex..." << std::endl;
     ThompsonNFA nfa;
@@ -79,10 +522,1041 @@ void testRegex() {
     std::cout << "  (a|b)*c matches 'c', 'ac', 'abac' [PASS]" << std::endl;
 }
 
+void testLazyDFA() {
+    std::cout << "Testing Lazy DFA..." << std::endl;
+    const char *patterns[] = {"a|b", "a*", "(a|b)*c", "(a|b)*abb", "ab(c|d)*e", "((a|b)(c|d))*"};
+    const char *inputs[] = {"", "a", "b", "c", "ac", "abac", "aba", "abb", "babb", "abcdcde", "abe", "acbd", "acb"};
+    ThompsonNFA nfa;
+    std::vector<std::string> trace;
+    for (const char *p : patterns) {
+        nfa.buildFromRegex(p);
+        LazyDFA dfa(nfa);
+        LazyDFA tiny(nfa, 1); // budget too small for even one row: flushes every new state
+        for (const char *in : inputs) {
+            bool expected = nfa.simulate(in, trace);
+            assert(dfa.matches(in) == expected);
+            assert(dfa.matches(in) == expected); // warm cache
+            assert(tiny.matches(in) == expected);
+        }
+    }
+    std::cout << "  lazy DFA agrees with simulate [PASS]" << std::endl;
+
+    // (a|b)*a(a|b)(a|b)(a|b) needs many DFA states; a small budget must flush and still be right
+    nfa.buildFromRegex("(a|b)*a(a|b)(a|b)(a|b)(a|b)");
+    LazyDFA small(nfa, 1024); // rows are 3 classes wide, so states are small
+    std::string s;
+    for (int i = 0; i < 2000; ++i) s += (i * 7 % 3) ? 'a' : 'b';
+    assert(small.matches(s) == nfa.simulate(s, trace));
+    assert(small.stats.cacheFlushes > 0);
+    std::cout << "  lazy DFA flushes under a small budget [PASS]" << std::endl;
+}
+
+void testPikeVM() {
+    std::cout << "Testing Pike VM..." << std::endl;
+    const char *patterns[] = {"a|b", "a*", "(a|b)*c", "(a|b)*abb", "ab(c|d)*e", "((a|b)(c|d))*", "(a*|b*)*c"};
+    const char *inputs[] = {"", "a", "b", "c", "ac", "abac", "aba", "abb", "babb", "abcdcde", "abe", "acbd", "acb", "aabbc"};
+    ThompsonNFA nfa;
+    std::vector<std::string> trace;
+    for (const char *p : patterns) {
+        nfa.buildFromRegex(p);
+        FlatNFA flat(nfa);
+        PikeVM vm(flat);
+        for (const char *in : inputs) assert(vm.matches(in) == nfa.simulate(in, trace));
+    }
+    std::cout << "  Pike VM agrees with simulate [PASS]" << std::endl;
+}
+
+// Leftmost-longest non-overlapping spans by trying every substring with simulate
+static std::vector<MatchSpan> bruteFindAll(const ThompsonNFA &nfa, const std::string &s) {
+    std::vector<MatchSpan> spans;
+    std::vector<std::string> trace;
+    size_t lastEnd = std::string::npos;
+    for (size_t i = 0; i <= s.size();) {
+        size_t best = std::string::npos;
+        for (size_t j = s.size() + 1; j-- > i;)
+            if (nfa.simulate<NoTrace>(s.substr(i, j - i), trace)) { best = j; break; }
+        if (best == std::string::npos || (best == i && i == lastEnd)) { ++i; continue; }
+        spans.push_back({i, best});
+        lastEnd = best;
+        i = best > i ? best : i + 1;
+    }
+    return spans;
+}
+
+void testSearch() {
+    std::cout << "Testing unanchored search..." << std::endl;
+    const char *patterns[] = {"a", "ab", "a|bcd", "a*", "(a|b)*c", "ab(c|a)*b", "a*b|a", "(a*|b*)*c", "(a|b|c)*a(a|b|c)", "ba|abc"};
+    std::mt19937 rng(19);
+    std::vector<std::string> inputs{"", "a", "abcd", "bab", "aaab", "cabcabc"};
+    for (int i = 0; i < 200; ++i) {
+        std::string s;
+        for (int k = rng() % 12; k > 0; --k) s.push_back("abc"[rng() % 3]);
+        inputs.push_back(s);
+    }
+    ThompsonNFA nfa;
+    for (const char *p : patterns) {
+        nfa.buildFromRegex<NoTrace>(p);
+        NFASearcher search(nfa);
+        for (const auto &in : inputs) {
+            std::vector<MatchSpan> expected = bruteFindAll(nfa, in);
+            assert(search.findAll(in) == expected);
+            MatchSpan first{0, 0};
+            bool found = search.findFirst(in, first);
+            assert(found == !expected.empty());
+            if (found) assert(first == expected[0]);
+        }
+    }
+    std::cout << "  findFirst and findAll agree with simulate on every substring [PASS]" << std::endl;
+
+    nfa.buildFromRegex<NoTrace>("a|bcd");
+    NFASearcher leftmost(nfa);
+    assert((leftmost.findAll("xabcdx") == std::vector<MatchSpan>{{1, 2}, {2, 5}}));
+    nfa.buildFromRegex<NoTrace>("a*");
+    NFASearcher empties(nfa);
+    assert((empties.findAll("baab") == std::vector<MatchSpan>{{0, 0}, {1, 3}, {4, 4}}));
+    std::cout << "  leftmost beats longer, empty matches skip past previous ones [PASS]" << std::endl;
+
+    // a*b|a keeps a thread alive to the end of a run of a's: a search that
+    // restarts after every match would rescan the run each time
+    nfa.buildFromRegex<NoTrace>("a*b|a");
+    NFASearcher linear(nfa);
+    std::string run(200000, 'a');
+    assert(linear.findAll(run).size() == run.size());
+    run += 'b';
+    std::vector<MatchSpan> one = linear.findAll(run);
+    assert(one.size() == 1 && one[0] == (MatchSpan{0, run.size()}));
+    std::cout << "  one linear pass over 200000 overlapping candidates [PASS]" << std::endl;
+
+    nfa.buildFromRegexSet<NoTrace>({"abc", "b*", "ca"});
+    NFASearcher set(nfa);
+    MatchSpan first{0, 0};
+    assert(set.findFirst("xxcab", first) && first == (MatchSpan{0, 0}));
+    assert((set.findAll("abcab") == bruteFindAll(nfa, "abcab")));
+    std::cout << "  searches a pattern set [PASS]" << std::endl;
+}
+
+void testCharClasses() {
+    std::cout << "Testing character classes..." << std::endl;
+    ThompsonNFA nfa;
+    std::vector<std::string> trace;
+    auto matches = [&](const char *re, const std::string &s) { nfa.buildFromRegex<NoTrace>(re); return nfa.simulate<NoTrace>(s, trace); };
+    assert(matches("[a-c]x", "bx") && !matches("[a-c]x", "dx"));
+    assert(matches("[^a-c]", "d") && matches("[^a-c]", "\n") && !matches("[^a-c]", "b"));
+    assert(matches("a.b", "axb") && matches("a.b", std::string("a\0b", 3)) && !matches("a.b", "ab"));
+    assert(matches("\\.", ".") && !matches("\\.", "x") && matches("a\\*", "a*") && !matches("a\\*", "aa"));
+    assert(matches("[]a]*", "]a]") && matches("[a-]", "-") && matches("[\\x41-\\x43]", "B") && matches("\\x00", std::string(1, '\0')));
+    assert(matches("[a-z0-9_]*@[a-z]*\\.com", "user_42@example.com"));
+    for (const char *bad : {"[abc", "[z-a]", "a\\", "[^\\x00-\\xff]", "\\x4"}) {
+        bool threw = false;
+        try { nfa.buildFromRegex<NoTrace>(bad); } catch (const std::runtime_error &) { threw = true; }
+        assert(threw);
+    }
+    std::cout << "  [...], ranges, negation, . and escapes [PASS]" << std::endl;
+
+    // a class is one pair of states however many bytes it covers
+    nfa.buildFromRegex<NoTrace>("[a-z0-9]");
+    assert(nfa.stateCount() == 2);
+    std::string alternation = "a";
+    for (char c = 'b'; c <= 'z'; ++c) alternation += std::string("|") + c;
+    for (char c = '0'; c <= '9'; ++c) alternation += std::string("|") + c;
+    ThompsonNFA wide;
+    wide.buildFromRegex<NoTrace>(alternation);
+    assert(wide.stateCount() > 100);
+    std::cout << "  [a-z0-9] is 2 NFA states, the alternation " << wide.stateCount() << " [PASS]" << std::endl;
+
+    // every engine agrees on class patterns, over bytes inside and outside the classes
+    const char *patterns[] = {"[a-c]*x", "[^x]*", ".x.", "([ab]|x)*[^a]", "\\.[a.]*", "[a-b]*[b-x]"};
+    std::vector<std::string> inputs{""};
+    for (size_t i = 0; i < inputs.size(); ++i)
+        if (inputs[i].size() < 4) for (char c : std::string("abx.\xff")) inputs.push_back(inputs[i] + c);
+    for (const char *p : patterns) {
+        nfa.buildFromRegex<NoTrace>(p);
+        LazyDFA lazy(nfa);
+        FlatNFA flat(nfa);
+        PikeVM vm(flat);
+        DFA dfa = compileDFA(nfa);
+        Regex re(p);
+        NFASearcher search(nfa);
+        for (const auto &in : inputs) {
+            bool expected = nfa.simulate<NoTrace>(in, trace);
+            assert(lazy.matches(in) == expected && vm.matches(in) == expected);
+            assert(dfa.matches(in) == expected && re.matches(in) == expected);
+            MatchSpan m{0, 0};
+            if (expected) assert(search.findFirst(in, m) && m.start == 0);
+        }
+    }
+    std::cout << "  simulate, lazy DFA, Pike VM, DFA, bit-parallel and search agree [PASS]" << std::endl;
+
+    // DFA rows have one entry per byte class
+    nfa.buildFromRegex<NoTrace>("[a-z0-9]*@[a-z]*");
+    DFA dfa = compileDFA(nfa);
+    assert(dfa.numClasses == 4); // letters, digits, @, everything else
+    assert(dfa.byteClass['a'] == dfa.byteClass['q'] && dfa.byteClass['0'] == dfa.byteClass['9']);
+    assert(dfa.byteClass['a'] != dfa.byteClass['7'] && dfa.byteClass['A'] != dfa.byteClass['a']);
+    assert(dfa.tableBytes() == (size_t)dfa.numStates * 4 * sizeof(int32_t));
+    assert(dfa.matches("abc9@xyz") && !dfa.matches("abc9@x1"));
+    nfa.buildFromRegex<NoTrace>("(a|b)*abb");
+    assert(compileDFA(nfa).numClasses == 3); // a, b, everything else
+    std::cout << "  DFA table indexed by " << dfa.numClasses << " byte classes instead of 256 bytes [PASS]" << std::endl;
+}
+
+void testCountedRepetition() {
+    std::cout << "Testing counted repetition..." << std::endl;
+    ThompsonNFA nfa;
+    std::vector<std::string> trace;
+    auto matches = [&](const char *re, const std::string &s) { nfa.buildFromRegex<NoTrace>(re); return nfa.simulate<NoTrace>(s, trace); };
+    assert(matches("a+", "aaa") && !matches("a+", "") && matches("ab?c", "ac") && matches("ab?c", "abc") && !matches("ab?c", "abbc"));
+    assert(matches("a{3}", "aaa") && !matches("a{3}", "aa") && !matches("a{3}", "aaaa"));
+    assert(matches("a{2,}", "aaaaaaa") && !matches("a{2,}", "a") && matches("x{0,2}y", "y") && !matches("x{0,2}y", "xxxy"));
+    assert(matches("a\\+\\{2\\}", "a+{2}") && matches("[+?{]*}", "+?{}"));
+    for (const char *bad : {"*a", "a|+", "(?)", "a{", "a{2", "a{x}", "a{,3}", "a{3,2}", "a{0}", "a{1000001}"}) {
+        bool threw = false;
+        try { nfa.buildFromRegex<NoTrace>(bad); } catch (const std::runtime_error &) { threw = true; }
+        assert(threw);
+    }
+    std::cout << "  +, ?, {n}, {n,}, {n,m} and their errors [PASS]" << std::endl;
+
+    // each counted pattern against the same language written out by hand
+    const char *pairs[][2] = {
+        {"(ab){2,4}", "abab(ab(ab)?)?"}, {"(a|bb){1,3}c", "(a|bb)((a|bb)(a|bb)?)?c"}, {"[ab]{3,}", "[ab][ab][ab][ab]*"},
+        {"a{2,3}a{2,3}", "aaa?aaa?"}, {"(a|b*){3,4}b", "(a|b*)(a|b*)(a|b*)(a|b*)b"}, {"((ab){2}c){2,3}", "ababcababc(ababc)?"},
+        {"(a{2,3}b)*", "(aaa?b)*"}, {"(a|ab){0,3}b{2}", "((a|ab)((a|ab)(a|ab)?)?)?bb"}, {"c?(a+b){2,3}", "c?a+ba+b(a+b)?"}};
+    std::vector<std::string> inputs{""};
+    for (size_t i = 0; i < inputs.size(); ++i)
+        if (inputs[i].size() < 8) for (char c : std::string("abc")) inputs.push_back(inputs[i] + c);
+    ThompsonNFA plain;
+    for (auto &pr : pairs) {
+        nfa.buildFromRegex<NoTrace>(pr[0]);
+        plain.buildFromRegex<NoTrace>(pr[1]);
+        assert(!plain.hasCounters());
+        LazyDFA lazy(nfa);
+        FlatNFA flat(nfa);
+        PikeVM vm(flat);
+        DFA dfa = compileDFA(nfa);
+        Regex re(pr[0]);
+        NFASearcher search(nfa);
+        for (const auto &in : inputs) {
+            bool expected = plain.simulate<NoTrace>(in, trace);
+            assert(nfa.simulate<NoTrace>(in, trace) == expected);
+            assert(lazy.matches(in) == expected && vm.matches(in) == expected);
+            assert(dfa.matches(in) == expected && re.matches(in) == expected);
+            if (in.size() < 6) assert(search.findAll(in) == bruteFindAll(plain, in));
+        }
+    }
+    std::vector<std::string> set{"(ab){2,3}", "a{2,}b", "[ab]{4}"};
+    RegexSet viaDfa(set, SetEngine::DFA), viaThompson(set, SetEngine::Thompson);
+    for (const auto &in : inputs) assert(viaDfa.matches(in) == viaThompson.matches(in));
+    assert((viaDfa.matches("abab") == std::vector<int>{0, 2}));
+    std::cout << "  simulate, lazy DFA, Pike VM, DFA, bit-parallel, search and sets agree with the unrolled form [PASS]" << std::endl;
+
+    // the counted NFA is the same size for any bound; unrolling grows with it
+    nfa.buildFromRegex<NoTrace>("(ab){3,10}");
+    size_t small = nfa.stateCount();
+    nfa.buildFromRegex<NoTrace>("(ab){3,100000}");
+    assert(nfa.stateCount() == small && nfa.counters.size() == 1);
+    std::string ab;
+    for (int i = 0; i < 60000; ++i) ab += "ab";
+    assert(nfa.simulate<NoTrace>(ab, trace));
+    nfa.buildFromRegex<NoTrace>("(ab){3,50000}");
+    assert(!nfa.simulate<NoTrace>(ab, trace) && nfa.simulate<NoTrace>(ab.substr(0, 100000), trace));
+    // threads entering at every other byte still make one run of counts
+    EngineStats st;
+    {
+        StatsScope scope(&st);
+        nfa.buildFromRegex<NoTrace>("[a-z]*(ab){3,100000}");
+        assert(nfa.simulate<NoTrace>(ab.substr(0, 20000), trace));
+    }
+    assert(st.activeMax < 16);
+    nfa.buildFromRegex<NoTrace>("(ab){3,1000}");
+    plain.buildExpanded(nfa);
+    assert(plain.stateCount() > 1000 * (small - 3));
+    bool threw = false;
+    try { nfa.buildFromRegex<NoTrace>("(ab){3,1000000}"); FlatNFA tooBig(nfa); } catch (const std::runtime_error &) { threw = true; }
+    assert(threw);
+    std::cout << "  " << small << " NFA states for any m, active set stays under 16 [PASS]" << std::endl;
+}
+
+// Every engine must agree with simulate on every string over {a,b,c} up to length 5
+void testEnginesAgree() {
+    std::cout << "Testing engine agreement..." << std::endl;
+    const char *patterns[] = {"a|b", "a*", "(a|b)*c", "(a|b)*abb", "ab(c|a)*b", "((a|b)(c|a))*", "(a*|b*)*c", "abc", "(a|b|c)*a(a|b|c)"};
+    std::vector<std::string> inputs{""};
+    for (size_t i = 0; i < inputs.size(); ++i)
+        if (inputs[i].size() < 5) for (char c : std::string("abc")) inputs.push_back(inputs[i] + c);
+    ThompsonNFA nfa;
+    std::vector<std::string> trace;
+    for (const char *p : patterns) {
+        nfa.buildFromRegex(p);
+        LazyDFA lazy(nfa);
+        FlatNFA flat(nfa);
+        PikeVM vm(flat);
+        DFA dfa = compileDFA(nfa);
+        GlushkovAutomaton g(ThompsonNFA::toPostfix(p));
+        BitParallelMatcher<1> bp1(g);
+        BitParallelMatcher<2> bp2(g);
+        for (const auto &in : inputs) {
+            bool expected = nfa.simulate(in, trace);
+            assert(lazy.matches(in) == expected);
+            assert(vm.matches(in) == expected);
+            assert(dfa.matches(in) == expected);
+            assert(bp1.matches(in) == expected);
+            assert(bp2.matches(in) == expected);
+        }
+    }
+    std::cout << "  simulate, lazy DFA, Pike VM, DFA and bit-parallel agree [PASS]" << std::endl;
+}
+
+void testDFAMinimization() {
+    std::cout << "Testing DFA minimization..." << std::endl;
+    ThompsonNFA nfa;
+    // (a*b*)* and (a|b)* are the same language: one live state plus DEAD
+    nfa.buildFromRegex("(a*b*)*");
+    DFA d1 = compileDFA(nfa);
+    nfa.buildFromRegex("(a|b)*");
+    DFA d2 = compileDFA(nfa);
+    assert(d1.numStates == 2 && d2.numStates == 2);
+    assert(d1.statesBeforeMinimization > d1.numStates);
+    std::cout << "  (a*b*)* minimized " << d1.statesBeforeMinimization << " -> " << d1.numStates << " states [PASS]" << std::endl;
+
+    // the k-th symbol from the end needs 2^(k+1) states, so a limit must stop it
+    std::string re = "(a|b)*a";
+    for (int i = 0; i < 12; ++i) re += "(a|b)";
+    nfa.buildFromRegex(re);
+    bool threw = false;
+    try { compileDFA(nfa, 1000); } catch (const std::runtime_error &) { threw = true; }
+    assert(threw);
+    std::cout << "  state limit raises an error [PASS]" << std::endl;
+}
+
+// Matching line numbers, with the text fed in pieces of the given size
+std::vector<uint64_t> grepLines(const LineMatcher &m, const std::string &text, size_t piece) {
+    std::vector<uint64_t> lines;
+    auto onLine = [&](uint64_t, uint64_t, uint64_t ln, bool matched) { if (matched) lines.push_back(ln); };
+    LineMatcher::State st = m.begin();
+    for (size_t i = 0; i < text.size(); i += piece)
+        m.feed(st, text.data() + i, std::min(piece, text.size() - i), onLine);
+    m.finish(st, onLine);
+    return lines;
+}
+
+void testLineMatcher() {
+    std::cout << "Testing streaming line matcher..." << std::endl;
+    std::string text = "abb\nxxabbxx\nab\n\nbabb\naaaa\nc\nabbabb";
+    std::vector<std::string> lines{"abb", "xxabbxx", "ab", "", "babb", "aaaa", "c", "abbabb"};
+    ThompsonNFA nfa;
+    std::vector<std::string> trace;
+    const char *patterns[] = {"(a|b)*abb", "abb", "a*", "c"};
+    for (const char *p : patterns) {
+        nfa.buildFromRegex(p);
+        DFA anchored = compileDFA(nfa), unanchored = compileDFA(nfa, 10000, true);
+        std::string lit = prefilterLiteral(p);
+        LineMatcher whole(anchored, true), search(unanchored, false);
+        LineMatcher wholeFiltered(anchored, true, lit), searchFiltered(unanchored, false, lit);
+        // expected results straight from simulate: whole line, or any substring
+        std::vector<uint64_t> wantWhole, wantSearch;
+        for (size_t i = 0; i < lines.size(); ++i) {
+            const std::string &l = lines[i];
+            if (nfa.simulate(l, trace)) wantWhole.push_back(i + 1);
+            bool any = false;
+            for (size_t a = 0; a <= l.size() && !any; ++a)
+                for (size_t b = a; b <= l.size() && !any; ++b) any = nfa.simulate(l.substr(a, b - a), trace);
+            if (any) wantSearch.push_back(i + 1);
+        }
+        for (size_t piece : {text.size(), (size_t)1, (size_t)2, (size_t)3, (size_t)7}) {
+            assert(grepLines(whole, text, piece) == wantWhole);
+            assert(grepLines(search, text, piece) == wantSearch);
+            assert(grepLines(wholeFiltered, text, piece) == wantWhole);
+            assert(grepLines(searchFiltered, text, piece) == wantSearch);
+        }
+    }
+    std::cout << "  chunked feeding matches whole-buffer matching [PASS]" << std::endl;
+}
+
+void testRegexSet() {
+    std::cout << "Testing regex sets..." << std::endl;
+    std::vector<std::string> patterns{"a|b", "a*", "(a|b)*c", "(a|b)*abb", "abc", "", "(a|b|c)*a(a|b|c)"};
+    std::vector<std::string> inputs{""};
+    for (size_t i = 0; i < inputs.size(); ++i)
+        if (inputs[i].size() < 4) for (char c : std::string("abc")) inputs.push_back(inputs[i] + c);
+    ThompsonNFA nfa;
+    std::vector<std::string> trace;
+    RegexSet viaThompson(patterns, SetEngine::Thompson), viaDfa(patterns, SetEngine::DFA);
+    assert(viaThompson.engine() == SetEngine::Thompson && viaDfa.engine() == SetEngine::DFA);
+    std::vector<uint64_t> mask;
+    for (const auto &in : inputs) {
+        std::vector<int> expected;
+        for (size_t i = 0; i < patterns.size(); ++i) {
+            nfa.buildFromRegex(patterns[i]);
+            if (nfa.simulate(in, trace)) expected.push_back((int)i);
+        }
+        assert(viaThompson.matches(in) == expected);
+        assert(viaDfa.matches(in) == expected);
+        viaDfa.matchMask(in.data(), in.size(), mask);
+        for (size_t i = 0; i < patterns.size(); ++i)
+            assert(((mask[0] >> i) & 1) == (std::find(expected.begin(), expected.end(), (int)i) != expected.end()));
+    }
+    std::cout << "  one pass reports the same patterns as one simulate per pattern [PASS]" << std::endl;
+
+    // Auto falls back to Thompson when the combined DFA is too big
+    RegexSet big({"(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)", "b*"}, SetEngine::Auto, 100);
+    assert(big.engine() == SetEngine::Thompson);
+    assert(big.matches("abbbbbbbb") == std::vector<int>{0});
+    std::cout << "  Auto engine falls back to Thompson past the DFA limit [PASS]" << std::endl;
+}
+
+void testAutomatonFile() {
+    std::cout << "Testing compiled automaton files..." << std::endl;
+    std::vector<std::string> patterns{"a|b", "a*", "(a|b)*c", "[a-c]*abb", "abc", "", "(a|b|c)*a(a|b|c)"};
+    std::vector<std::string> inputs{""};
+    for (size_t i = 0; i < inputs.size(); ++i)
+        if (inputs[i].size() < 4) for (char c : std::string("abcd")) inputs.push_back(inputs[i] + c);
+    ThompsonNFA nfa;
+    nfa.buildFromRegexSet<NoTrace>(patterns);
+    DFA dfa = compileDFA(nfa);
+    FlatNFA flat(nfa);
+    RegexSet reference(patterns, SetEngine::Thompson);
+    // file images live in uint64_t storage, as a mapping would be 8-byte aligned
+    auto aligned = [](const std::string &image) {
+        std::vector<uint64_t> buf((image.size() + 7) / 8);
+        if (!image.empty()) std::memcpy(buf.data(), image.data(), image.size());
+        return buf;
+    };
+    std::vector<int> ids;
+    for (int engines = 1; engines <= 3; ++engines) {
+        std::string image = serializeAutomaton(patterns, engines & 1 ? &dfa : nullptr, engines & 2 ? &flat : nullptr, false);
+        std::vector<uint64_t> buf = aligned(image);
+        CompiledAutomaton ca(buf.data(), image.size());
+        assert(ca.hasDFA() == (engines & 1) && ca.hasNFA() == ((engines & 2) != 0) && !ca.unanchored());
+        assert(ca.patternCount() == patterns.size());
+        for (size_t i = 0; i < patterns.size(); ++i) assert(ca.pattern(i) == patterns[i]);
+        for (const auto &in : inputs) {
+            ca.matchSet(in.data(), in.size(), ids);
+            assert(ids == reference.matches(in));
+            if (ca.hasNFA()) {
+                PikeVM vm = ca.nfaVM();
+                std::vector<int> viaNfa;
+                vm.matchSet(in.data(), in.size(), viaNfa);
+                assert(viaNfa == ids);
+            }
+        }
+    }
+    std::cout << "  DFA-only, NFA-only and combined files match like the source set [PASS]" << std::endl;
+
+    // through a real file and mmap, unanchored, used in place by LineMatcher
+    nfa.buildFromRegex<NoTrace>("[0-9][0-9]*x");
+    DFA search = compileDFA(nfa, 10000, true);
+    std::string image = serializeAutomaton({"[0-9][0-9]*x"}, &search, nullptr, true);
+    std::string path = "recalc_test_automaton.bin";
+    { std::ofstream f(path, std::ios::binary); f.write(image.data(), (std::streamsize)image.size()); }
+    {
+        CompiledAutomaton mapped(path);
+        assert(mapped.unanchored() && mapped.fileSize() == image.size());
+        LineMatcher m(mapped.dfa(), false);
+        std::string text = "no\nab12xcd\nx\n9x";
+        std::vector<uint64_t> lines;
+        LineMatcher::State st = m.begin();
+        auto onLine = [&](uint64_t, uint64_t, uint64_t ln, bool matched) { if (matched) lines.push_back(ln); };
+        m.feed(st, text.data(), text.size(), onLine);
+        m.finish(st, onLine);
+        assert((lines == std::vector<uint64_t>{2, 4}));
+    }
+    std::remove(path.c_str());
+    bool threw = false;
+    try { CompiledAutomaton missing(path); } catch (const std::runtime_error &) { threw = true; }
+    assert(threw);
+    std::cout << "  a mapped file drives LineMatcher directly [PASS]" << std::endl;
+
+    // Every flipped byte and every truncation is rejected. Flips are then
+    // retried with the checksum fixed up: those must be caught by the
+    // structural checks or load into something that matches without
+    // touching memory outside the file (ASan builds check the latter).
+    image = serializeAutomaton(patterns, &dfa, &flat, false);
+    auto rejects = [&](const std::string &bad) {
+        std::vector<uint64_t> buf = aligned(bad);
+        try { CompiledAutomaton ca(buf.data(), bad.size()); } catch (const std::runtime_error &) { return true; }
+        return false;
+    };
+    for (size_t len = 0; len < image.size(); ++len) assert(rejects(image.substr(0, len)));
+    std::vector<uint64_t> misaligned(image.size() / 8 + 2);
+    std::memcpy((char *)misaligned.data() + 1, image.data(), image.size());
+    threw = false;
+    try { CompiledAutomaton ca((char *)misaligned.data() + 1, image.size()); } catch (const std::runtime_error &) { threw = true; }
+    assert(threw);
+    size_t loaded = 0;
+    for (size_t i = 0; i < image.size(); ++i) {
+        std::string bad = image;
+        bad[i] ^= 0x41;
+        assert(rejects(bad));
+        if (i >= offsetof(AutomatonFileHeader, checksum) && i < offsetof(AutomatonFileHeader, checksum) + 8) continue;
+        uint64_t sum = automatonChecksum((const unsigned char *)bad.data(), bad.size());
+        std::memcpy(&bad[offsetof(AutomatonFileHeader, checksum)], &sum, sizeof sum);
+        std::vector<uint64_t> buf = aligned(bad);
+        try {
+            CompiledAutomaton ca(buf.data(), bad.size());
+            loaded++;
+            for (const auto &in : inputs) ca.matchSet(in.data(), in.size(), ids);
+            if (ca.hasNFA()) {
+                PikeVM vm = ca.nfaVM();
+                for (const auto &in : inputs) vm.matchSet(in.data(), in.size(), ids);
+            }
+        } catch (const std::runtime_error &) {}
+    }
+    assert(loaded < image.size());
+    std::cout << "  corrupted and truncated files are rejected at load [PASS]" << std::endl;
+}
+
+// Patterns for testStaticRegex; template arguments need static storage
+static constexpr char kStaticAbb[] = "(a|b)*abb";
+static constexpr char kStaticCounted[] = "(ab){2,4}c?|x+";
+static constexpr char kStaticClass[] = "[a-c]*x[^a]";
+static constexpr char kStaticEscape[] = "\\.[a.]*\\x41?";
+static constexpr char kStaticNested[] = "(a*b*)*c{2,}";
+static constexpr char kStaticDate[] = "[0-9]{4}-[0-9][0-9]";
+
+// R agrees with compileDFA on its size and with Regex on every input
+template <class R>
+void expectSameAsRuntime(const char *pattern, const std::vector<std::string> &inputs) {
+    ThompsonNFA nfa;
+    nfa.buildFromRegex<NoTrace>(pattern);
+    DFA dfa = compileDFA(nfa);
+    Regex re(pattern);
+    assert(R::numStates == dfa.numStates && R::numClasses == dfa.numClasses);
+    for (const auto &in : inputs) assert(R::matches(in) == re.matches(in) && R::matches(in) == dfa.matches(in));
+}
+
+void testStaticRegex() {
+    std::cout << "Testing compile-time regexes..." << std::endl;
+    using Abb = StaticRegex<kStaticAbb>;
+    using Counted = StaticRegex<kStaticCounted>;
+    using Date = StaticRegex<kStaticDate>;
+    static_assert(Abb::matches("babb") && !Abb::matches("abab") && !Abb::matches(""));
+    static_assert(Counted::matches("ababc") && Counted::matches("abababab") && !Counted::matches("ab") && Counted::matches("xx"));
+    static_assert(Date::matches("2024-06") && !Date::matches("2024-6"));
+    static_assert(Abb::numStates == 5 && Abb::numClasses == 3); // dead state and a, b, everything else
+    // the tables are constants: their addresses and contents are known to the compiler
+    constexpr DFAView view = Date::view();
+    static_assert(view.table == Date::table.data() && view.matches("1999-12", 7));
+    std::vector<std::string> inputs{""};
+    for (size_t i = 0; i < inputs.size(); ++i)
+        if (inputs[i].size() < 5) for (char c : std::string("abcx.A")) inputs.push_back(inputs[i] + c);
+    expectSameAsRuntime<Abb>(kStaticAbb, inputs);
+    expectSameAsRuntime<Counted>(kStaticCounted, inputs);
+    expectSameAsRuntime<StaticRegex<kStaticClass>>(kStaticClass, inputs);
+    expectSameAsRuntime<StaticRegex<kStaticEscape>>(kStaticEscape, inputs);
+    expectSameAsRuntime<StaticRegex<kStaticNested>>(kStaticNested, inputs);
+    std::vector<std::string> dates{""};
+    for (size_t i = 0; i < dates.size(); ++i)
+        if (dates[i].size() < 7) for (char c : std::string("09-a")) dates.push_back(dates[i] + c);
+    expectSameAsRuntime<Date>(kStaticDate, dates);
+    std::cout << "  same language and minimal DFA size as the runtime engines [PASS]" << std::endl;
+
+    // Invalid patterns: the same message and offset as the runtime parser's
+    // exception. Only the empty pattern differs: the runtime parser accepts it
+    struct Bad { const char *pattern; StaticRegexStatus status; };
+    constexpr Bad errors[] = {
+        {"[abc", checkStaticRegex("[abc")}, {"ab[z-a]", checkStaticRegex("ab[z-a]")}, {"a\\", checkStaticRegex("a\\")},
+        {"\\x4", checkStaticRegex("\\x4")}, {"*a", checkStaticRegex("*a")}, {"a{3,2}", checkStaticRegex("a{3,2}")},
+        {"a{2", checkStaticRegex("a{2")}, {"a{0}", checkStaticRegex("a{0}")}, {"a|+", checkStaticRegex("a|+")},
+        {"a|", checkStaticRegex("a|")}, {"a||b", checkStaticRegex("a||b")}, {"x(a", checkStaticRegex("x(a")},
+        {"ab)", checkStaticRegex("ab)")}, {"a()", checkStaticRegex("a()")},
+    };
+    for (const Bad &b : errors) {
+        assert(!b.status.ok());
+        std::string message;
+        try { ThompsonNFA::toPostfix(b.pattern); } catch (const std::runtime_error &e) { message = e.what(); }
+        assert(message == std::string(b.status.error) + " at offset " + std::to_string(b.status.offset));
+    }
+    static_assert(checkStaticRegex("a|").offset == 2 && checkStaticRegex("a||b").offset == 2);
+    static_assert(checkStaticRegex("x(a").offset == 1 && checkStaticRegex("ab)").offset == 2);
+    static_assert(checkStaticRegex("a()").offset == 2 && !checkStaticRegex("").ok());
+    assert(ThompsonNFA::toPostfix("").empty());
+    static_assert(!checkStaticRegex("[^\\x00-\\xff]").ok() && !checkStaticRegex("a{1000}{1000}").ok());
+    static_assert(checkStaticRegex("(a|b)*[0-9]{2,}\\.").ok());
+    std::cout << "  invalid patterns are rejected with the runtime's message and offset [PASS]" << std::endl;
+
+    // matching touches nothing but the static tables
+    size_t before = allocationCounter().count.load();
+    size_t matched = 0;
+    for (const auto &in : inputs) matched += Abb::matches(in.data(), in.size()) + Counted::matches(in.data(), in.size());
+    assert(allocationCounter().count.load() == before && matched > 0);
+    std::string text = "2024-06\n20x4-06\n1999-12";
+    LineMatcher lm(Date::view(), true);
+    auto st = lm.begin();
+    std::vector<uint64_t> lines;
+    auto onLine = [&](uint64_t, uint64_t, uint64_t n, bool m) { if (m) lines.push_back(n); };
+    lm.feed(st, text.data(), text.size(), onLine);
+    lm.finish(st, onLine);
+    assert((lines == std::vector<uint64_t>{1, 3}));
+    std::cout << "  no allocation, and LineMatcher runs on the static tables [PASS]" << std::endl;
+}
+
+void testRegexParser() {
+    std::cout << "Testing regex parser..." << std::endl;
+    assert(ThompsonNFA::toPostfix("a(b|c)*d") == "abc|*.d." && ThompsonNFA::toPostfix("[a-c-]x+\\.") == "[\\x2da-c]x+.[\\x2e].");
+    assert(ThompsonNFA::toPostfix("(ab){2,}|c{3}?") == "ab.{2,}c{3,3}?|" && ThompsonNFA::toPostfix("").empty());
+    RegexAST ast = parseRegex("ab|c*");
+    assert(ast.nodes.size() == 6 && ast.root == 5 && ast.postfix() == "ab.c*|");
+    const RegexNode &concat = ast.nodes[2], &alt = ast.nodes[5], &star = ast.nodes[4];
+    assert(concat.kind == RegexNode::CONCAT && concat.lhs == 0 && concat.rhs == 1 && concat.offset == 1);
+    assert(alt.kind == RegexNode::ALTERNATE && alt.lhs == 2 && alt.rhs == 4 && alt.offset == 2);
+    assert(star.kind == RegexNode::REPEAT && star.op == '*' && star.lhs == 3 && star.offset == 4);
+    assert(ast.atom(ast.nodes[3]).isByte() && parseRegex("").empty());
+    std::cout << "  postfix spelling and node offsets [PASS]" << std::endl;
+
+    auto error = [](const std::function<void()> &fn) {
+        std::string message;
+        try { fn(); } catch (const std::runtime_error &e) { message = e.what(); }
+        return message;
+    };
+    std::pair<const char *, const char *> bad[] = {
+        {"a|", "Empty alternative at offset 2"}, {"|a", "Empty alternative at offset 0"}, {"(a|)", "Empty alternative at offset 3"},
+        {"a()", "Empty group at offset 2"}, {"(a", "Unmatched ( at offset 0"}, {"a(b(c)", "Unmatched ( at offset 1"},
+        {"a)b", "Unmatched ) at offset 1"}, {"(*a)", "Nothing to repeat at offset 1"}, {"a|{2}", "Nothing to repeat at offset 2"},
+        {"ab[c", "Unterminated character class at offset 2"},
+    };
+    for (auto &b : bad) {
+        assert(error([&] { parseRegex(b.first); }) == b.second);
+        assert(error([&] { ThompsonNFA nfa; nfa.buildFromRegex<NoTrace>(b.first); }) == b.second);
+    }
+    // malformed postfix used to pop an empty stack
+    ThompsonNFA nfa;
+    NFAFragment f;
+    assert(error([&] { nfa.buildFragment("a.", f); }) == "Operator . is missing an operand at offset 1");
+    assert(error([&] { nfa.buildFragment("*", f); }) == "Operator * is missing an operand at offset 0");
+    assert(error([&] { nfa.buildFragment("a[b-c]|{2,3}b", f); }) == "Missing operator at offset 13");
+    assert(nfa.buildFragment("a[b-c]|{2,3}b.", f) && !nfa.buildFragment("", f));
+    std::cout << "  positioned errors for malformed patterns and postfix [PASS]" << std::endl;
+
+    // 1 MB and 10 MB patterns: time grows linearly and heap use per byte stays flat
+    auto nested = [](size_t n) { return std::string(n / 2, '(') + "a" + std::string(n / 2, ')'); };
+    auto alternation = [](size_t n) { std::string s; while (s.size() + 2 < n) s += "a|"; return s + "b"; };
+    size_t sizes[2] = {1 << 20, 10 << 20};
+    for (auto shape : {+nested, +alternation}) {
+        double seconds[2];
+        size_t heap[2];
+        for (int k = 0; k < 2; ++k) {
+            std::string pattern = shape(sizes[k]);
+            size_t before = allocationCounter().bytes.load();
+            int root = -1;
+            seconds[k] = secondsFor([&] { root = parseRegex(pattern).root; }, k == 0 ? 3 : 1);
+            heap[k] = (allocationCounter().bytes.load() - before) / (k == 0 ? 3 : 1);
+            assert(root >= 0 && heap[k] < 128 * pattern.size());
+        }
+        assert(seconds[1] < 30 * seconds[0]);
+    }
+    std::cout << "  10 MB of nested groups and of alternation [PASS]" << std::endl;
+
+    // NFAs of deep patterns build and match
+    for (auto shape : {+nested, +alternation}) {
+        double seconds[2];
+        for (int k = 0; k < 2; ++k) {
+            std::string pattern = shape(sizes[k] / 100);
+            bool matched = false;
+            seconds[k] = secondsFor([&] {
+                ThompsonNFA deep;
+                deep.buildFromRegex<NoTrace>(pattern);
+                Regex re(pattern);
+                matched = re.matches("a") && !re.matches("ab");
+            }, k == 0 ? 3 : 1);
+            assert(matched);
+        }
+        assert(seconds[1] < 30 * seconds[0]);
+    }
+    std::cout << "  NFAs of 100 KB patterns [PASS]" << std::endl;
+}
+
+void testPrefilter() {
+    std::cout << "Testing literal prefilter..." << std::endl;
+    auto lits = [](const char *re) { return extractLiterals(ThompsonNFA::toPostfix(re)); };
+    RegexLiterals l = lits("error(a|b)*");
+    assert(l.prefix == "error" && l.required == "error" && l.suffix.empty() && !l.exact);
+    l = lits("(x|y)*timeout");
+    assert(l.prefix.empty() && l.suffix == "timeout" && l.required == "timeout");
+    l = lits("ab(c|d)*xyz(e|f)");
+    assert(l.prefix == "ab" && l.required == "xyz" && l.suffix.empty());
+    l = lits("abc");
+    assert(l.exact && l.prefix == "abc" && l.suffix == "abc" && l.required == "abc");
+    l = lits("abx|aby");
+    assert(l.prefix == "ab" && l.required == "ab");
+    assert(lits("(a|b)*").required.empty());
+    std::cout << "  required prefixes, suffixes and inner literals [PASS]" << std::endl;
+
+    // the SIMD search must agree with std::string::find at every alignment
+    std::string hay;
+    for (int i = 0; i < 3000; ++i) hay += "abcab"[(i * 7 + i / 13) % 5];
+    const char *needles[] = {"a", "ab", "cab", "bcabc", "abcabcabcabcabcabcab", "zz", "bb"};
+    for (const char *n : needles) {
+        LiteralSearcher ls(n);
+        for (size_t from = 0; from < 70; ++from) {
+            const char *hit = ls.find(hay.data() + from, hay.size() - from);
+            size_t want = hay.find(n, from);
+            assert(hit ? (size_t)(hit - hay.data()) == want : want == std::string::npos);
+        }
+    }
+    std::cout << "  vectorized search agrees with std::string::find [PASS]" << std::endl;
+}
+
+void testEngineSelection() {
+    std::cout << "Testing engine selection..." << std::endl;
+    ThompsonNFA nfa;
+    std::vector<std::string> trace;
+    // (a|b)*a(a|b)^k has 2k+3 positions
+    auto kth = [](int k) { std::string re = "(a|b)*a"; for (int i = 0; i < k; ++i) re += "(a|b)"; return re; };
+    std::string in;
+    for (int i = 0; i < 300; ++i) in += "ab"[(i * i + i / 3) % 2];
+    for (int k : {10, 40, 100, 200}) {
+        Regex re(kth(k));
+        assert(re.positions() == 2 * k + 3);
+        assert(re.engine() == (re.positions() <= 255 ? RegexEngine::BitParallel : RegexEngine::Thompson));
+        nfa.buildFromRegex(kth(k));
+        for (size_t len : {(size_t)k, (size_t)k + 1, (size_t)k + 7, in.size()}) {
+            std::string s = in.substr(0, len);
+            assert(re.matches(s) == nfa.simulate(s, trace));
+        }
+        // no engine allocates once warm: the Thompson fallback reuses its thread's scratch
+        std::string shorter = in.substr(0, k);
+        re.matches(in);
+        size_t before = allocationCounter().count.load();
+        bool matched = re.matches(in) || re.matches(shorter);
+        assert(matched == (in[in.size() - k - 1] == 'a') && allocationCounter().count.load() == before);
+    }
+    std::cout << "  bit-parallel up to 255 positions, Thompson beyond [PASS]" << std::endl;
+
+    // counted repetitions past the bit-parallel limit keep their counters
+    const char *counted = "[a-z]*(ab){3,1000}";
+    Regex re(counted);
+    assert(re.engine() == RegexEngine::Counting);
+    ThompsonNFA withCounters, expanded;
+    withCounters.buildFromRegex<NoTrace>(counted);
+    expanded.buildExpanded(withCounters);
+    assert(withCounters.hasCounters() && !expanded.hasCounters());
+    std::string abs;
+    for (int i = 0; i < 1001; ++i) abs += "ab";
+    std::vector<std::string> subjects{"", "ab", "abab", "ababab", "xababab", "zzabababa", "ababab!", abs.substr(0, 2000), abs, "q" + abs};
+    size_t hits = 0;
+    for (const std::string &s : subjects) {
+        bool m = re.matches(s);
+        assert(m == expanded.simulate<NoTrace>(s, trace));
+        hits += m;
+    }
+    assert(hits == 5 && re.matches(abs) && !re.matches("ababa"));
+    std::cout << "  counted repetitions beyond 255 positions run on the counting NFA [PASS]" << std::endl;
+}
+
+void testParallel() {
+    std::cout << "Testing parallel matching..." << std::endl;
+    ThreadPool pool(4);
+    std::atomic<long> sum{0};
+    pool.parallelFor(0, 10000, 37, [&](size_t from, size_t to) { for (size_t i = from; i < to; ++i) sum += (long)i; });
+    assert(sum == 10000L * 9999 / 2);
+    // a throwing piece: every piece finishes, then the caller gets the first exception
+    for (size_t bad : {(size_t)0, (size_t)5000, (size_t)9999}) {
+        std::atomic<int> running{0};
+        std::string message;
+        try {
+            pool.parallelFor(0, 10000, 10, [&](size_t from, size_t to) {
+                running++;
+                if (from <= bad && bad < to) throw std::runtime_error("piece " + std::to_string(from));
+                pool.parallelFor(from, to, 3, [](size_t, size_t) {}); // nested loops still finish
+                running--;
+            });
+        } catch (const std::runtime_error &e) { message = e.what(); }
+        assert(message == "piece " + std::to_string(bad / 10 * 10) && running == 1);
+    }
+    sum = 0;
+    pool.parallelFor(0, 100, 1, [&](size_t from, size_t) { sum += (long)from; });
+    assert(sum == 100L * 99 / 2);
+
+    ThompsonNFA nfa;
+    nfa.buildFromRegex("(a|b)*abb(a|b)*");
+    DFA dfa = compileDFA(nfa);
+    Regex re("(a|b)*abb(a|b)*");
+    std::vector<std::string> subjects;
+    for (int i = 0; i < 5000; ++i) {
+        std::string s;
+        for (int j = 0; j < i % 23; ++j) s += "ab"[(i * 31 + j * j) % 7 % 2];
+        subjects.push_back(s);
+    }
+    std::vector<char> byDfa = matchBatch(dfa, subjects, pool, 64), byRegex = matchBatch(re, subjects, pool, 64);
+    // simulate is const, so the workers can share the NFA too
+    std::vector<char> bySimulate(subjects.size());
+    pool.parallelFor(0, subjects.size(), 64, [&](size_t from, size_t to) {
+        std::vector<std::string> steps;
+        for (size_t i = from; i < to; ++i) bySimulate[i] = nfa.simulate(subjects[i], steps);
+    });
+    for (size_t i = 0; i < subjects.size(); ++i) {
+        assert(byDfa[i] == (dfa.matches(subjects[i]) ? 1 : 0));
+        assert(byRegex[i] == byDfa[i] && bySimulate[i] == byDfa[i]);
+    }
+    std::cout << "  batch matching across the pool [PASS]" << std::endl;
+
+    // one big input split into chunks must give the sequential answer
+    const char *patterns[] = {"(a|b)*abb", "(a|b)*a(a|b)(a|b)(a|b)", "(ab|ba)*", "a*b*"};
+    std::string big;
+    for (int i = 0; i < 20000; ++i) big += "ab"[(i * 7919 + i / 5) % 3 % 2];
+    for (const char *p : patterns) {
+        nfa.buildFromRegex(p);
+        DFA d = compileDFA(nfa);
+        for (size_t len : {(size_t)0, (size_t)5, (size_t)1000, (size_t)19999, big.size()})
+            assert(matchParallel(d, big.data(), len, pool, 100) == d.matches(big.data(), len));
+        std::string tail = big + "abb";
+        assert(matchParallel(d, tail.data(), tail.size(), pool, 100) == d.matches(tail));
+    }
+    std::cout << "  chunked speculative matching composes to the sequential result [PASS]" << std::endl;
+}
+
+void testTraceLog() {
+    std::cout << "Testing event trace..." << std::endl;
+    static_assert(sizeof(TraceEvent) <= 32, "trace records should stay compact");
+    // every EventTrace event must format to the line FullTrace produces
+    auto formatted = [](const TraceLog &log) {
+        std::vector<std::string> lines;
+        for (uint64_t i = log.first(); i < log.end(); ++i) lines.push_back(formatTraceEvent(log, log.at(i)));
+        return lines;
+    };
+    for (const char *expr : {"1 + 2 * 3", "-(x - 4.5) / --y", "((7)) + 0 * z", "2 $ 3"}) {
+        Lexer full(expr);
+        TraceLog log;
+        TraceLogScope scope(&log);
+        BasicLexer<EventTrace> lexer(expr);
+        assert(formatted(log) == full.steps && lexer.steps.empty());
+        if (std::string(expr).find('$') != std::string::npos) continue;
+
+        log.clear();
+        Parser fullParser;
+        fullParser.setTokens(full.tokens);
+        auto ast = fullParser.parseExpression();
+        BasicParser<EventTrace> parser;
+        parser.setTokens(lexer.tokens);
+        parser.parseExpression();
+        assert(formatted(log) == fullParser.trace);
+
+        log.clear();
+        Variables vars{{"x", 1.5}, {"y", -2}, {"z", 8}};
+        std::vector<std::string> fullTrace, unused;
+        double a = evalAST(ast.get(), fullTrace, &vars), b = evalAST<EventTrace>(ast.get(), unused, &vars);
+        assert(a == b && unused.empty() && formatted(log) == fullTrace);
+    }
+    for (const char *re : {"a(b|c)*", "(a|b)*abb", "ab*|c", "[^a-c]b.|\\*", "(ab){2,3}c?"}) {
+        ThompsonNFA full, events;
+        full.buildFromRegex(re);
+        TraceLog log;
+        TraceLogScope scope(&log);
+        events.buildFromRegex<EventTrace>(re);
+        assert(formatted(log) == full.trace && events.trace.empty());
+        for (const char *input : {"", "abcb", "aabb", "ac", "x", "ababc"}) {
+            log.clear();
+            std::vector<std::string> fullSteps, unused;
+            // the same NFA both times: closure order follows state addresses
+            bool a = full.simulate(input, fullSteps), b = full.simulate<EventTrace>(input, unused);
+            assert(a == b && formatted(log) == fullSteps);
+        }
+    }
+    std::cout << "  Events format to the FullTrace lines for every stage [PASS]" << std::endl;
+
+    // ring buffer: only the newest capacity() events are kept
+    ThompsonNFA nfa;
+    nfa.buildFromRegex<NoTrace>("(a|b)*abb");
+    std::string input;
+    for (int i = 0; i < 2000; ++i) input += "ab"[i % 3 == 0];
+    TraceLog small(100);
+    std::vector<std::string> unused;
+    {
+        TraceLogScope scope(&small);
+        small.note("start");
+        nfa.simulate<EventTrace>(input, unused);
+    }
+    assert(small.size() == 100 && small.dropped() == small.end() - 100);
+    assert(small.at(small.end() - 1).op == TraceEvent::RESULT);
+
+    // a long session with distinct names: the text table stays bounded too
+    {
+        TraceLogScope scope(&small);
+        for (int i = 0; i < 10000; ++i) {
+            VariableNode v("v" + std::to_string(i));
+            Variables vars{{v.name, (double)i}};
+            evalAST<EventTrace>(&v, unused, &vars);
+            if (i % 7 == 0) small.note("note " + std::to_string(i % 3));
+        }
+    }
+    assert(small.textCount() <= 2 * small.capacity() + 1);
+    std::vector<std::string> expected;
+    for (int i = 0; i < 10000; ++i) {
+        expected.push_back("Variable v" + std::to_string(i) + ": " + std::to_string((double)i));
+        if (i % 7 == 0) expected.push_back("note " + std::to_string(i % 3));
+    }
+    std::vector<std::string> newest = formatted(small);
+    assert(std::equal(expected.end() - 100, expected.end(), newest.begin()));
+    std::cout << "  Ring buffer keeps the newest " << small.size() << " of " << small.end() << " events, and their texts [PASS]" << std::endl;
+
+    // filtering: by stage, by text, incrementally and in bounded steps
+    TraceLog log;
+    {
+        TraceLogScope scope(&log);
+        nfa.traceTransitions<EventTrace>();
+        nfa.simulate<EventTrace>(input, unused);
+    }
+    size_t reads = 0, bs = 0;
+    for (uint64_t i = log.first(); i < log.end(); ++i) {
+        if (log.at(i).op == TraceEvent::READ) reads++;
+        if (log.at(i).op == TraceEvent::READ && log.at(i).ch == 'b') bs++;
+    }
+    TraceFilter filter;
+    filter.setStageMask(1u << TraceEvent::NFA);
+    assert(filter.update(log) && filter.size() > 0 && log.at(filter.row(0)).stage == TraceEvent::NFA);
+    filter.setStageMask(1u << TraceEvent::SIM);
+    filter.setSearch("Read 'b'");
+    int calls = 1;
+    while (!filter.update(log, 1000)) calls++;
+    assert(filter.size() == bs && calls > 1 && reads == input.size());
+    for (size_t i = 0; i < filter.size(); ++i) assert(formatTraceEvent(log, log.at(filter.row(i))) == "Read 'b'");
+    filter.setSearch("");
+    filter.update(log);
+    size_t simEvents = filter.size();
+    {
+        TraceLogScope scope(&log);
+        nfa.simulate<EventTrace>("abb", unused);
+    }
+    filter.update(log);
+    assert(filter.size() > simEvents && formatTraceEvent(log, log.at(filter.row(filter.size() - 1))) == "Accepted");
+    log.clear();
+    filter.update(log);
+    assert(filter.size() == 0);
+    std::cout << "  Stage mask, incremental search and clearing [PASS]" << std::endl;
+}
+
+void testStats() {
+    std::cout << "Testing instrumentation..." << std::endl;
+    EngineStats st;
+    Lexer lexer("1 + 2 * x");
+    Parser parser;
+    ThompsonNFA nfa;
+    std::vector<std::string> steps;
+    nfa.buildFromRegex("a|b");
+    nfa.simulate("a", steps);
+    assert(st.stages[EngineStats::LEX].runs == 0 && st.nfaStates == 0); // nothing collects without a scope
+
+    {
+        StatsScope scope(&st);
+        lexer.setInput("1 + 2 * x");
+        parser.setTokens(lexer.tokens);
+        auto ast = parser.parseExpression();
+        Variables vars{{"x", 3}};
+        std::vector<std::string> trace;
+        assert(evalAST(ast.get(), trace, &vars) == 7);
+        ArenaParser fast;
+        fast.parse("(1)");
+        nfa.buildFromRegex("a(b|c)*");
+        nfa.simulate("abcb", steps);
+    }
+    assert(st.stages[EngineStats::LEX].runs == 1 && st.stages[EngineStats::PARSE].runs == 2);
+    assert(st.stages[EngineStats::EVAL].runs == 1 && st.stages[EngineStats::NFA_BUILD].runs == 1);
+    assert(st.stages[EngineStats::SIMULATE].runs == 1);
+    assert(st.stages[EngineStats::LEX].allocations > 0); // the lexer's token and step strings
+    // a, b, c: 2 states each; | and * add 2 states each
+    assert(st.nfaStates == 10 && st.nfaTransitions == 12 && st.nfaEpsilonTransitions == 9);
+    assert(st.activeSets == 5 && st.closureCalls == 5);
+    assert(st.activeMax >= 1 && st.activeMean() > 0 && st.closureStates >= st.activeSets && st.closureEdges > 0);
+    std::cout << "  Stage runs, NFA counts and active sets [PASS]" << std::endl;
+
+    EngineStats inner;
+    {
+        StatsScope outerScope(&st);
+        {
+            StatsScope innerScope(&inner);
+            nfa.simulate("a", steps);
+        }
+        nfa.simulate("a", steps);
+        StatsScope off(nullptr);
+        nfa.simulate("a", steps);
+    }
+    assert(activeStats() == nullptr);
+    assert(inner.stages[EngineStats::SIMULATE].runs == 1 && st.stages[EngineStats::SIMULATE].runs == 2);
+
+    std::ostringstream json;
+    json.precision(3);
+    writeStatsJSON(json, st);
+    assert(json.precision() == 3);
+    for (const char *key : {"\"lex\"", "\"simulate\"", "\"epsilon_transitions\": 9", "\"active_set\"", "\"edges_followed\""})
+        assert(json.str().find(key) != std::string::npos);
+    std::cout << "  Nested scopes and JSON dump [PASS]" << std::endl;
+}
+
+void testBenchSuite() {
+    std::cout << "Testing benchmark harness..." << std::endl;
+    BenchSuite::Options opt;
+    opt.minSeconds = 0.001;
+    opt.repetitions = 2;
+    BenchSuite suite(opt);
+    int calls = 0;
+    suite.add("count/\"quoted\"", 8, [&] { calls++; });
+    suite.add("skipped", 0, [] {});
+    std::ostringstream log;
+    opt.filter = "count";
+    BenchSuite filtered(opt);
+    filtered.add("count", 0, [] {});
+    filtered.add("other", 0, [] {});
+    assert(filtered.run(log).size() == 1);
+    std::vector<BenchResult> results = suite.run(log);
+    assert(results.size() == 2 && calls > 0 && results[0].iterations > 0 && results[0].nsPerOp >= 0);
+
+    std::stringstream json;
+    json.precision(3);
+    writeBenchJSON(json, results);
+    assert(json.precision() == 3);
+    std::vector<BenchResult> back = readBenchJSON(json);
+    assert(back.size() == 2 && back[0].name == "count/\"quoted\"" && back[0].bytesPerOp == 8);
+    assert(back[0].nsPerOp == results[0].nsPerOp && back[0].iterations == results[0].iterations);
+    std::cout << "  JSON round trip [PASS]" << std::endl;
+
+    BenchResult fast = back[0], slow = back[0];
+    fast.nsPerOp = 100;
+    slow.nsPerOp = 115;
+    slow.allocsPerOp = fast.allocsPerOp;
+    std::vector<BenchDelta> d = compareBench({fast}, {slow}, 10);
+    assert(d.size() == 1 && d[0].slower && !d[0].moreAllocs);
+    assert(!compareBench({fast}, {slow}, 20)[0].slower);
+    slow.nsPerOp = 100;
+    slow.allocsPerOp = fast.allocsPerOp + 1;
+    assert(compareBench({fast}, {slow}, 10)[0].moreAllocs);
+    std::ios::fmtflags flags = log.flags();
+    log.precision(3);
+    assert(printBenchComparison(log, compareBench({fast}, {slow}, 10)) == 1);
+    assert(log.flags() == flags && log.precision() == 3); // the caller's formatting is left alone
+    assert(compareBench({fast}, {back[1]}, 10).empty()); // no common names
+    std::cout << "  Regressions flagged by time threshold and allocation count [PASS]" << std::endl;
+}
+
 int main() {
     try {
         testArithmetic();
+        testBytecode();
+        testColumnar();
+        testArenaParser();
+        testTracePolicy();
+        testOptimizer();
+        testJit();
+        testEvalPipeline();
+        testDeepExpressions();
         testRegex();
+        testLazyDFA();
+        testPikeVM();
+        testSearch();
+        testCharClasses();
+        testCountedRepetition();
+        testEnginesAgree();
+        testDFAMinimization();
+        testLineMatcher();
+        testRegexSet();
+        testAutomatonFile();
+        testStaticRegex();
+        testRegexParser();
+        testPrefilter();
+        testEngineSelection();
+        testParallel();
+        testTraceLog();
+        testStats();
+        testBenchSuite();
         std::cout << "All tests passed!" << std::endl;
     } catch (const std::exception &e) {
         std::cerr << "Test failed with exception: " << e.what() << std::endl;